@@ -0,0 +1,301 @@
+/**
+ * @file Block.c
+ * @brief Basic-Block Translation Cache for the XM-23 Emulator
+ *
+ * This module runs programs a block at a time instead of an instruction at a time.
+ * A block is translated the first time its start address is reached: instructions are
+ * decoded from memory until a branch, a branch with link, an instruction that references
+ * the PC, or BLOCK_MAX_INSTR instructions. Finished blocks remember the block that ran
+ * after them, so a hot loop jumps from block to block without looking anything up.
+ * Common instruction pairs (MOVL + MOVH, CMP + branch, LD/ST post-increment copies)
+ * are recognised at translation time and run as one fused operation.
+ *
+ * Every write to memory calls InvalidateBlocks(), which drops any block covering the
+ * written word. The clock is charged exactly as Control() charges it.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "Block.h"
+
+#define PC_REG 7
+
+/*
+*  purpose   : Function to initialize (or flush) the block cache of a machine
+*  parameters: m - Machine whose block cache is flushed, m->blocks must be allocated
+*  return    : None
+*/
+void InitializeBlocks(Machine* m) {
+    // Chains may still point into the pool, so every handed out block is invalidated
+    for (int i = 0; i < m->blocks->used; i++) m->blocks->pool[i].valid = false;
+    m->blocks->flushes++;
+    JitReset(m);
+    memset(m->blocks->block_at, 0, sizeof(m->blocks->block_at));
+    memset(m->blocks->code_words, 0, sizeof(m->blocks->code_words));
+    m->blocks->used = 0;
+}
+
+/*
+*  purpose   : Checks if an instruction ends a block, either because it branches or because it
+*              reads or writes R7 (the PC), which depends on the instruction's own address.
+*  parameters: instr - Decoded instruction
+*  return    : true if no further instruction may be added to the block
+*/
+static bool EndsBlock(const DecodedInstr* instr) {
+    if (instr->handler == Branching || instr->handler == BranchLink || instr->handler == Unimplemented)
+        return true;
+    return instr->dst == PC_REG || instr->src == PC_REG;
+}
+
+/*
+*  purpose   : Checks if an instruction is a BRA to its own address, the usual way an XM-23 program
+*              ends. Such a branch is always translated as a block of its own.
+*  parameters: instr - Decoded instruction
+*  return    : true if the instruction branches to itself
+*/
+bool BranchesToSelf(const DecodedInstr* instr) {
+    return instr->handler == Branching && instr->op == BRA && instr->offset == (unsigned short)-2;
+}
+
+/*
+*  purpose   : Checks if two consecutive instructions can run as one fused operation.
+*              MOVL + MOVH on one register always leaves the two bytes side by side, and an LD
+*              post-increment is only fused with an ST post-increment storing the loaded register.
+*  parameters: first  - First instruction of the pair
+*              second - Instruction following it
+*  return    : Fused operation (enum FusedPairs), FUSED_NONE if the pair is run one by one
+*/
+static unsigned char FusePair(const DecodedInstr* first, const DecodedInstr* second) {
+    if (first->handler == Movs && second->handler == Movs && first->dst == second->dst) {
+        if (first->op != MOVH && second->op == MOVH) return FUSED_MOV_CONST;
+        if (first->op == MOVH && second->op == MOVL) return FUSED_MOV_CONST;
+    }
+    if (first->handler == Arithmetic && first->op == CMP && second->handler == Branching)
+        return FUSED_CMP_BRANCH;
+    if (first->handler == IndexedAddressing && first->op == LD && first->addr_mode == POS_INC &&
+        second->handler == IndexedAddressing && second->op == ST && second->addr_mode == POS_INC &&
+        second->src == first->dst)
+        return FUSED_COPY;
+    return FUSED_NONE;
+}
+
+/*
+*  purpose   : Translates the block starting at an address and records it in BlockAt.
+*              The cache is flushed when the pool is exhausted.
+*  parameters: m     - Machine running the blocks
+*              start - Address of the first instruction
+*  return    : The translated block
+*/
+static Block* TranslateBlock(Machine* m, unsigned short start) {
+    if (m->blocks->used == BLOCK_POOL_SIZE) InitializeBlocks(m);
+
+    Block* block = &m->blocks->pool[m->blocks->used++];
+    unsigned short address = start;
+
+    block->start = start;
+    block->length = 0;
+    block->valid = true;
+    block->next[FALL_THROUGH] = NULL;
+    block->next[TAKEN] = NULL;
+    block->runs = 0;
+    block->native = NULL;
+
+    do {
+        const DecodedInstr* instr = &DecodeTable[m->memory.WordMem[address >> 1]];
+
+        if (block->length > 0 && BranchesToSelf(instr)) break;
+        block->ops[block->length++] = instr;
+        m->blocks->code_words[address >> 1] = 1;
+        address += 2;
+        if (EndsBlock(instr)) break;
+    } while (block->length < BLOCK_MAX_INSTR && address > start);
+
+    // Pairs never overlap, the second instruction of a pair is not fused again
+    memset(block->fused, FUSED_NONE, sizeof(block->fused));
+    for (int i = 0; i + 1 < block->length; i++) {
+        block->fused[i] = FusePair(block->ops[i], block->ops[i + 1]);
+        if (block->fused[i] != FUSED_NONE) i++;
+    }
+
+    block->end = address;
+    block->spins = block->length == 1 && BranchesToSelf(block->ops[0]);
+    // An odd and an even start address share the same word, only one block is kept
+    if (m->blocks->block_at[start >> 1] != NULL) m->blocks->block_at[start >> 1]->valid = false;
+    m->blocks->block_at[start >> 1] = block;
+    return block;
+}
+
+/*
+*  Purpose   : Drops every block that covers a word being written. A block starts at most
+*              BLOCK_MAX_INSTR words before any word it covers, so only those start addresses are checked.
+*
+*  Parameters:
+*              m       - Machine whose memory is written.
+*              address - Byte or word address being written.
+*/
+void InvalidateBlocks(Machine* m, unsigned short address) {
+    int word = address >> 1;
+
+    if (!m->blocks->code_words[word]) return;
+    m->blocks->code_words[word] = 0;
+
+    for (int i = 0; i < BLOCK_MAX_INSTR && word - i >= 0; i++) {
+        Block* block = m->blocks->block_at[word - i];
+        if (block == NULL) continue;
+
+        // Block covers start .. end - 1 (byte addresses)
+        if ((block->start >> 1) <= word && word < (block->start >> 1) + block->length) {
+            block->valid = false;
+            m->blocks->block_at[word - i] = NULL;
+        }
+    }
+}
+
+/*
+*  purpose   : Finds the block starting at the PC, translating it if needed
+*  parameters: m - Machine running the blocks
+*  return    : Block starting at the current PC
+*/
+static Block* LookupBlock(Machine* m) {
+    Block* block = m->blocks->block_at[PC >> 1];
+
+    if (block == NULL || block->start != PC) block = TranslateBlock(m, PC);
+    return block;
+}
+
+/*
+*  purpose   : Runs the fused pair starting at instruction i of a block, with the registers, PSW
+*              and clock the two instructions leave when run one by one.
+*  parameters: m     - Machine running the blocks
+*              block - Running block
+*              i     - Index of the first instruction of the pair
+*  return    : Number of instructions executed, 1 if a write back from the cache dropped the block
+*/
+static int RunFused(Machine* m, const Block* block, int i) {
+    const DecodedInstr* first = block->ops[i];
+    const DecodedInstr* second = block->ops[i + 1];
+
+    switch (block->fused[i]) {
+    case FUSED_MOV_CONST:
+        // Two fetches (memory + 1), decodes (1) and Movs() (1)
+        FETCH_MEMORY(m, PC);
+        FETCH_MEMORY(m, PC + 2);
+        m->cpu_clock += 6;
+        m->reg_file[REG][first->dst] = first->offset | second->offset;
+        PC = PC + 4;
+        break;
+
+    case FUSED_CMP_BRANCH:
+        // CMP: fetch and decode (memory + 2), Arithmetic() (1), Addc() charges its own cycle
+        FETCH_MEMORY(m, PC);
+        m->cpu_clock += 3;
+        (void)Addc(m, ~m->reg_file[first->reg_const][first->src], m->reg_file[REG][first->dst], 1, first->word_byte);
+        // Branch: fetch and decode (memory + 2), Branching() (1), offset is relative to the PC after the branch
+        FETCH_MEMORY(m, PC + 2);
+        m->cpu_clock += 3;
+        PC = PC + 4;
+        if (BranchCondition(m, second->op)) PC = PC + second->offset;
+        break;
+
+    default: // FUSED_COPY
+        FETCH_MEMORY(m, PC);
+        PC = PC + 2;
+        m->cpu_clock += 2;
+        IndexedAddressing(m, first);
+        // Reading may write a dirty cache line back over this block
+        if (!block->valid) {
+            m->instr_reg = first->word;
+            return 1;
+        }
+        FETCH_MEMORY(m, PC);
+        PC = PC + 2;
+        m->cpu_clock += 2;
+        IndexedAddressing(m, second);
+        break;
+    }
+    m->instr_reg = second->word;
+    return 2;
+}
+
+/*
+*  purpose   : Runs translated blocks starting at the PC. Each instruction costs the same cycles
+*              as one call to Control(): a memory access for the fetch (FETCH_MEMORY()), the fetch (1),
+*              the handler and the decode (1).
+*              Running stops before the instruction at stop_address, after a write invalidated the
+*              running block, or once exactly max_instr instructions have run: a block, fused pair
+*              or native segment is cut at the limit, and the next call goes on from there.
+*              A headless machine also stops before a BRA to itself.
+*
+*  parameters: m            - Machine running the blocks
+*              stop_address - Address to stop at (break point)
+*              max_instr    - Number of instructions after which control returns to the caller
+*
+*  return    : Number of instructions executed
+*/
+unsigned long RunBlocks(Machine* m, unsigned short stop_address, unsigned long max_instr) {
+    unsigned long executed = 0;
+    Block* block;
+
+    if (PC == stop_address) return 0;
+    block = LookupBlock(m);
+
+    while (executed < max_instr) {
+        JitSegment* segment;
+
+        if (block->spins && m->headless) return executed;
+        if (++block->runs == JIT_THRESHOLD) JitCompileBlock(m, block);
+        segment = block->native;
+
+        for (int i = 0; i < block->length; i++) {
+            const DecodedInstr* instr = block->ops[i];
+
+            if (PC == stop_address || !block->valid || executed == max_instr) return executed;
+
+            // Native segments never write memory, but must not run past the stop address or the limit
+            if (segment != NULL && segment->first == i) {
+                bool stops_inside = (unsigned short)(stop_address - PC) < 2 * segment->count || max_instr - executed < segment->count;
+
+                if (!stops_inside) {
+                    JitRunSegment(m, segment);
+                    executed += segment->count;
+                    i += segment->count - 1;
+                    segment = segment->next;
+                    continue;
+                }
+                segment = segment->next;
+            }
+            // A fused pair runs whole, unless it contains the stop address or the limit, or a native segment starts inside it
+            if (block->fused[i] != FUSED_NONE && (unsigned short)(PC + 2) != stop_address && max_instr - executed >= 2 &&
+                (segment == NULL || segment->first > i + 1)) {
+                int ran = RunFused(m, block, i);
+
+                executed += ran;
+                i += ran - 1;
+                continue;
+            }
+            m->instr_reg = instr->word;
+            FETCH_MEMORY(m, PC);
+            PC = PC + 2;
+            m->cpu_clock += 2;
+            instr->handler(m, instr);
+            executed++;
+        }
+        if (PC == stop_address || !block->valid) return executed;
+
+        // Follow the chain, or look up the successor and chain it for next time
+        int path = (PC == block->end) ? FALL_THROUGH : TAKEN;
+        Block* next = block->next[path];
+
+        if (next == NULL || !next->valid || next->start != PC) {
+            unsigned long flushes = m->blocks->flushes;
+
+            next = LookupBlock(m);
+            // Do not chain from a block that a flush just handed out again
+            if (flushes == m->blocks->flushes) block->next[path] = next;
+        }
+        block = next;
+    }
+    return executed;
+}
@@ -0,0 +1,56 @@
+/*
+* This is the header file for the basic-block translation cache.
+* A block is a straight-line run of instructions that ends at a branch (or any instruction that
+* may change the PC). Each block is translated once into an array of decoded instructions and
+* chained to the blocks that followed it, so hot loops run without fetching or decoding.
+*/
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdbool.h>
+#include "emulator.h"
+#include "Jit.h"
+
+// Defining constants
+#define BLOCK_MAX_INSTR 32      // Longest run of instructions translated into one block
+#define BLOCK_POOL_SIZE 4096    // Blocks kept before the whole cache is flushed
+#define FALL_THROUGH 0          // Successor reached by running past the last instruction
+#define TAKEN 1                 // Successor reached by a taken branch or a PC write
+
+// Instruction pairs run as one operation, recorded on the first instruction of the pair
+enum FusedPairs {
+    FUSED_NONE,
+    FUSED_MOV_CONST,    // MOVL/MOVLZ/MOVLS + MOVH (or MOVH + MOVL) building a 16-bit constant
+    FUSED_CMP_BRANCH,   // CMP followed by a conditional branch
+    FUSED_COPY          // LD post-increment followed by ST post-increment of the loaded register
+};
+
+// Block struct definition
+typedef struct Block {
+    unsigned short start;                       // Address of the first instruction
+    unsigned short end;                         // Address following the last instruction
+    unsigned char length;                       // Number of instructions in ops
+    bool valid;                                 // Cleared when a write overlaps the block
+    bool spins;                                 // Only a BRA to itself, the program never leaves it
+    const DecodedInstr* ops[BLOCK_MAX_INSTR];   // Translated instructions
+    unsigned char fused[BLOCK_MAX_INSTR];       // Pair starting at each instruction (enum FusedPairs)
+    struct Block* next[2];                      // Chained successors (FALL_THROUGH / TAKEN)
+    unsigned long runs;                         // Times the block was entered, compiled at JIT_THRESHOLD
+    JitSegment* native;                         // Compiled runs of instructions, in instruction order
+} Block;
+
+// BlockCache struct definition, one per machine (m->blocks)
+typedef struct BlockCache {
+    Block pool[BLOCK_POOL_SIZE];                // Storage for translated blocks
+    int used;                                   // Blocks handed out since the last flush
+    unsigned long flushes;                      // Number of times the cache was flushed
+    Block* block_at[WORD_MEM_SIZE];             // Block starting at each word address
+    unsigned char code_words[WORD_MEM_SIZE];    // Set for words covered by a translated block
+} BlockCache;
+
+extern void InitializeBlocks(Machine* m);
+extern void InvalidateBlocks(Machine* m, unsigned short address);
+extern bool BranchesToSelf(const DecodedInstr* instr);
+extern unsigned long RunBlocks(Machine* m, unsigned short stop_address, unsigned long max_instr);
+
+#endif
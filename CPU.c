@@ -21,43 +21,116 @@
 #include <assert.h>
 #include <stdio.h>
 #include "emulator.h"
+#include "Block.h"
+#include "Snapshot.h"
 
 //#define PrintInstra
 // #define BusDEBUG
 
-// 2-d array to hold registers and constants
-unsigned short RegFile[REG_CONS][NUM_REG] = {
-    {0X0000, 0X0000, 0X0000, 0X0000, 0X0000, 0X0000, 0X0000, 0X0000},
-    {0, 1, 2, 4, 8, 16, 32, -1}
-};
+// Constants row of the register file, the same in every machine
+static const unsigned short Constants[NUM_REG] = { 0, 1, 2, 4, 8, 16, 32, -1 };
+
+// Instruction handler and operands for every possible instruction word, shared by all machines
+DecodedInstr DecodeTable[DECODE_TABLE_SIZE];
+
+/**
+ * purpose: Allocates a machine with cleared registers, memory, PSW and clock, an empty cache of the
+ *          default configuration (ConfigureCache() changes it) and an empty block cache.
+ *          InitializeDecodeTable() must have been called once before it runs.
+ *
+ * @return: The new machine, NULL if it could not be allocated.
+ */
+Machine* CreateMachine() {
+    Machine* m = calloc(1, sizeof(Machine));
+    CacheConfig configs[CACHE_LEVELS];
+
+    if (m == NULL) return NULL;
+    DefaultCacheConfig(configs);
+    m->blocks = calloc(1, sizeof(BlockCache));
+    if (m->blocks == NULL || !ConfigureCache(m, configs)) {
+        free(m->blocks);
+        free(m);
+        return NULL;
+    }
+    memcpy(m->reg_file[REG_CONS - 1], Constants, sizeof(Constants));
+    InitializeBlocks(m);
+    return m;
+}
+
+/**
+ * purpose: Frees a machine created by CreateMachine(), with its block cache and native code.
+ *
+ * @param m: Machine to free, may be NULL.
+ */
+void DestroyMachine(Machine* m) {
+    if (m == NULL) return;
+    JitRelease(m);
+    ReleaseSnapshot(m);
+    ReleaseShadows(m);
+    ReleaseCache(m);
+    free(m->blocks);
+    free(m);
+}
+
+/**
+ * purpose: Puts a machine back to the state of a fresh run of what is in its memory: registers,
+ *          PSW, instruction register and clock cleared, and the counters of every cache level and
+ *          the miss tables emptied. Memory, the constants and the contents of the caches are kept.
+ *          Nothing timed by the old clock is left waiting: the write buffers are emptied (their
+ *          stores are already in the levels below) and every prefetch counts as arrived.
+ *
+ * @param m: Machine to reset.
+ */
+void ResetMachineState(Machine* m) {
+    memset(m->reg_file[REG], 0, sizeof(m->reg_file[REG]));
+    memset(&m->psw, 0, sizeof(m->psw));
+    memset(&m->lazy_psw, 0, sizeof(m->lazy_psw));
+    m->instr_reg = 0;
+    m->cpu_clock = 0;
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        CacheLevel* level = &m->cache[i];
+
+        memset(&level->counters, 0, sizeof(level->counters));
+        if (!LEVEL_ENABLED(level)) continue;
+        ResetWriteBuffer(&level->wbuffer);
+        ClearPrefetchTimes(&level->prefetch, level->config.size / level->config.line_size);
+    }
+    for (unsigned int address = 0; address < MEM_SIZE; address += SNAPSHOT_PAGE_SIZE) {
+        SNAPSHOT_WRITE(m, SNAPSHOT_FETCH_MISSES, address);
+        SNAPSHOT_WRITE(m, SNAPSHOT_DATA_MISSES, address);
+    }
+    memset(m->fetch_misses, 0, sizeof(m->fetch_misses));
+    memset(m->data_misses, 0, sizeof(m->data_misses));
+}
 
 /**
  * purpose: Simulates a bus that reads from or writes to memory.
  *
+ * @param m: Machine whose memory is accessed.
  * @param mar: The memory address to be accessed.
  * @param mdr: Pointer to the data to be written or read into/from memory.
  * @param read_write: 0 for read operation, 1 for write.
  * @param word_byte: 0 for a word (2 bytes) operation, 1 for a byte operation.
  * @return: void. Modifies the mdr or memory directly. Prints error if mdr is NULL during write.
  */
-void Bus(unsigned short mar, unsigned short* mdr, int read_write, int word_byte) {
+void Bus(Machine* m, unsigned short mar, unsigned short* mdr, int read_write, int word_byte) {
     
-    CPU_CLOCK += 3;
+    m->cpu_clock += BUS_CYCLES;
 
     assert(word_byte == 0 || word_byte == 1);
     assert(read_write == 0 || read_write == 1);
     if (read_write == 0) {  // read = 0 
         if (word_byte == 0) {
-            *mdr = memory_u.WordMem[mar >> 1];
+            *mdr = m->memory.WordMem[mar >> 1];
 
 #ifdef BusDEBUG
-            printf(" Bus Read Word Function: ADDRESS -> %04X Memory stored -> %04X  \n", mar/2, memory_u.WordMem[mar/2]); //>> 1
+            printf(" Bus Read Word Function: ADDRESS -> %04X Memory stored -> %04X  \n", mar/2, m->memory.WordMem[mar/2]); //>> 1
 #endif // BusDEBUG
         }
         else {
-            *mdr = (unsigned char)memory_u.ByteMem[mar];
+            *mdr = (unsigned char)m->memory.ByteMem[mar];
 #ifdef BusDEBUG
-            printf(" Bus Read Byte Function: ADDRESS -> %2X Memory stored -> %4x  \n", mar, memory_u.ByteMem[mar]);
+            printf(" Bus Read Byte Function: ADDRESS -> %2X Memory stored -> %4x  \n", mar, m->memory.ByteMem[mar]);
 #endif // BusDEBUG
         }
     }
@@ -70,17 +143,19 @@ void Bus(unsigned short mar, unsigned short* mdr, int read_write, int word_byte)
             printf("\n");
             return 0;
         }
+        InvalidateDecoded(m, mar);
+        SNAPSHOT_WRITE(m, SNAPSHOT_MEMORY, mar);
         if (word_byte == 0) { // word = 0
 
-            memory_u.WordMem[mar>>1] = *mdr;
+            m->memory.WordMem[mar>>1] = *mdr;
 #ifdef BusDEBUG
-            printf(" Bus Write Word Function: ADDRESS -> %04X Memory stored -> %04x  \n", mar, memory_u.WordMem[mar>>1]);
+            printf(" Bus Write Word Function: ADDRESS -> %04X Memory stored -> %04x  \n", mar, m->memory.WordMem[mar>>1]);
 #endif // BusDEBUG
         }
         else {
-            memory_u.ByteMem[mar] = (unsigned char)(*mdr & 0xFF);
+            m->memory.ByteMem[mar] = (unsigned char)(*mdr & 0xFF);
 #ifdef BusDEBUG
-            printf(" Bus Write Byte Function: ADDRESS -> %04X Memory stored -> %04x  \n", mar, memory_u.ByteMem[mar]);
+            printf(" Bus Write Byte Function: ADDRESS -> %04X Memory stored -> %04x  \n", mar, m->memory.ByteMem[mar]);
 #endif // BusDEBUG
         }
     }
@@ -88,17 +163,41 @@ void Bus(unsigned short mar, unsigned short* mdr, int read_write, int word_byte)
 
 }
 
+/**
+ * purpose: Simulates a burst transfer of a whole cache line over the bus. The first word costs the
+ *          same as a Bus() access and every following word one more cycle, so a line of several
+ *          words is moved in one transaction instead of one Bus() call per word.
+ *
+ * @param m: Machine whose memory is accessed.
+ * @param mar: Address of the first byte, aligned to length.
+ * @param data: Bytes read from or written to memory, in memory order.
+ * @param length: Number of bytes, an even number.
+ * @param read_write: 0 for read operation, 1 for write.
+ */
+void BusBurst(Machine* m, unsigned short mar, unsigned char* data, unsigned int length, int read_write) {
+    m->cpu_clock += BUS_CYCLES + (length / 2 - 1);
+
+    if (read_write == R) memcpy(data, &m->memory.ByteMem[mar], length);
+    else {
+        for (unsigned int i = 0; i < length; i += 2) {
+            InvalidateDecoded(m, mar + i);
+            SNAPSHOT_WRITE(m, SNAPSHOT_MEMORY, mar + i);
+        }
+        memcpy(&m->memory.ByteMem[mar], data, length);
+    }
+}
+
 /**
  * purpose: Simulates the control flow of a processor.
  *          It sequentially calls the Fetch and Decode operations 
-            and increments CPU_CLOCK for each operation.
+            and increments the clock for each operation.
  */
-void Control() {
+void Control(Machine* m) {
 
-    Fetch();
-    CPU_CLOCK+=1;
-    Decode();
-    CPU_CLOCK+=1;
+    Fetch(m);
+    m->cpu_clock+=1;
+    Decode(m);
+    m->cpu_clock+=1;
     
 
 }
@@ -106,340 +205,250 @@ void Control() {
 /**
  * Simulates the fetch operation in a processor's instruction cycle.
  * It reads a 16-bit instruction into the instruction register and increments the program counter.
+ * The first fetch from an address reads memory and records the decoded instruction in the predecode store,
+ * later fetches from the same address reuse it until a write to that address invalidates it.
+ * Either way the fetch costs a memory access, or an L1 instruction cache access when there is one (FETCH_MEMORY()).
  *
  */
-void Fetch() {
+void Fetch(Machine* m) {
+    const DecodedInstr** predecoded = &m->predecoded[PC >> 1];
 
-    Bus(PC, &instr_reg, R, WORD);
+    if (*predecoded == NULL) {
+        m->instr_reg = m->memory.WordMem[PC >> 1];
+        *predecoded = &DecodeTable[m->instr_reg];
+    }
+    else m->instr_reg = (*predecoded)->word;
+    FETCH_MEMORY(m, PC);
     PC = PC + 2;
     
 }
 
+/**
+ * Purpose: Drops the predecoded instruction and any translated block covering the word containing an
+ *          address that is being written, so self-modifying code and reloaded files are decoded again.
+ *
+ * @param address: Byte or word address being written.
+ */
+void InvalidateDecoded(Machine* m, unsigned short address) {
+    m->predecoded[address >> 1] = NULL;
+    InvalidateBlocks(m, address);
+}
+
 /**
  * Simulates the decode operation in a processor's instruction cycle.
- * It decodes the instruction stored in the instruction register (instr_reg) and calls the corresponding
- * function to handle each type of operation.
+ * The instruction stored in the instruction register (instr_reg) was decoded once by InitializeDecodeTable(),
+ * so decoding is a single lookup in DecodeTable followed by a call to the corresponding handler.
  *
  */
-void Decode() {
+void Decode(Machine* m) {
 #ifdef DEBUG
     printf("\n Binary being decoded \n");
-    printBits(instr_reg);
+    printBits(m->instr_reg);
 #endif
+    const DecodedInstr* instr = &DecodeTable[m->instr_reg];
 
-
-    if (Hex_2_Bit(instr_reg, 15)) {
-        // LDR/STR instruction
-            if (Hex_2_Bit(instr_reg, 14)) {
-#ifdef PrintInstra
-                printf("STR\n");
-#endif
-                RelativeAddressing();
-            }
-            else {
 #ifdef PrintInstra
-                printf("LDR\n");
+    printf("%s\n", instr->mnemonic);
 #endif
-                RelativeAddressing();
-            }
-
-        
-    }
-    
-    else {
-            // Branch instruction If bit 14 is clear
-        if (Hex_2_Bit(instr_reg, 14) == 0) {
-            if (Hex_2_Bit(instr_reg, 13) == 0) {
-#ifdef PrintInstra
-                printf("BL\n");
+    instr->handler(m, instr);
+}
 
-#endif // !PrintInstra
-                BranchLink();
-            }
-            else {
-            int BR;
-                
-                    switch (Hex_2_Bit(instr_reg, 12) << 2 | Hex_2_Bit(instr_reg, 11) << 1 | Hex_2_Bit(instr_reg, 10)) {
-                    case BEQ:
-                        BR = BEQ;
-#ifdef PrintInstra
-                        printf("BEQ");
-#endif
-                        break;
-                    case BNE:
-                        BR = BNE;
-#ifdef PrintInstra
-                        printf(" BNE");
-#endif
-                        break;
-                    case BC:
-                        BR = BC;
-#ifdef PrintInstra
-                        printf("BC");
-#endif
-                        break;
-                    case BNC:
-                        BR = BNC;
-#ifdef PrintInstra
-                        printf("BNC");
-#endif
-                        break;
-                    case BN:
-#ifdef PrintInstra
-                        printf("BN\n");
-#endif
-                        BR = BN;
-                        break;
-                    case BGE:
-#ifdef PrintInstra
-                        printf("BGE\n");
-#endif
-                        BR = BGE;
-                        break;
-                    case BLT:
+/**
+ * Purpose: Fills a decode table entry with the handler to call and the operation it must perform.
+ *
+ * @param instr: Entry being filled.
+ * @param handler: Instruction implementation.
+ * @param op: Operation passed to the handler.
+ * @param mnemonic: Name printed when PrintInstra is defined.
+ */
+static void SetEntry(DecodedInstr* instr, InstrHandler handler, unsigned char op, const char* mnemonic) {
+    instr->handler = handler;
+    instr->op = op;
 #ifdef PrintInstra
-                        printf("BLT\n");
+    instr->mnemonic = mnemonic;
+#else
+    (void)mnemonic;
 #endif
-                        BR = BLT;
-                        break;
-                    case BRA:
+}
 
-                        
+/**
+ * Purpose: Picks the label the threaded interpreter (Threaded.c) jumps to for a decoded entry.
+ *          Branches, moves and byte swaps are run inline there, everything else calls its handler.
+ *
+ * @param instr: Entry with its handler and op already set.
+ * @return: Dispatch kind (enum ThreadedKinds).
+ */
+static unsigned char ThreadedKind(const DecodedInstr* instr) {
+    if (instr->handler == RelativeAddressing) return T_RELATIVE;
+    if (instr->handler == IndexedAddressing) return T_INDEXED;
+    if (instr->handler == Arithmetic) return T_ARITHMETIC;
+    if (instr->handler == SRA_RRC) return T_SRA_RRC;
+    if (instr->handler == SignChange) return T_SIGN_CHANGE;
+    if (instr->handler == BranchLink) return T_BL;
+    if (instr->handler == Branching) return T_BEQ + instr->op;
+    if (instr->handler == Mov_SWAP) return (instr->op == MOV) ? T_MOV : T_SWAP;
+    if (instr->handler == SwapPB) return T_SWPB;
+    if (instr->handler == Movs) return T_MOVL + instr->op;
+    return T_UNIMPLEMENTED;
+}
 
-#ifdef PrintInstra
-                        printf("BRA\n");
-#endif       
-                        BR = BRA;
-                        break;
-                    }
-                    Branching(BR);
-            }
+/**
+ * Purpose: Decodes one instruction word into its table entry. The operand fields are extracted
+ *          up front and the opcode bits are walked the same way the XM-23 encoding is laid out,
+ *          so every handler receives the operation and operands it used to extract itself.
+ *
+ * @param word: The 16-bit instruction word.
+ * @param instr: Entry to fill.
+ */
+static void DecodeWord(unsigned short word, DecodedInstr* instr) {
+    unsigned short offset;
+
+    instr->word = word;
+    instr->src = SRC(word);
+    instr->dst = DST(word);
+    instr->word_byte = WB(word);
+    instr->reg_const = RC(word);
+    instr->addr_mode = Hex_2_Bit(word, 9) << 2 | Hex_2_Bit(word, 8) << 1 | Hex_2_Bit(word, 7);
+    instr->offset = 0;
+
+    if (Hex_2_Bit(word, 15)) {
+        // LDR/STR instruction, offset sign bit is bit 13
+        offset = REL_AD_MASK(word);
+        instr->offset = (Hex_2_Bit(word, 13)) ? offset | 0XFF80 : offset;
+        if (Hex_2_Bit(word, 14)) SetEntry(instr, RelativeAddressing, STR, "STR");
+        else SetEntry(instr, RelativeAddressing, LDR, "LDR");
+    }
+
+    // Branch instruction If bit 14 is clear
+    else if (Hex_2_Bit(word, 14) == 0) {
+        // shifting 1 bit to the left so that | sign |x| EncodedOffset | 0 |
+        offset = word << 1;
+        if (Hex_2_Bit(word, 13) == 0) {
+            offset = (Hex_2_Bit(word, 12)) ? offset | SEXT_BL : offset & ~(1 << 12);
+            instr->offset = offset;
+            SetEntry(instr, BranchLink, 0, "BL");
         }
         else {
-            // if bits 13 and 12 clear its ADD TO CEX 
-            if ( (Hex_2_Bit(instr_reg, 13)) == 0 && (Hex_2_Bit(instr_reg, 12)) == 0) {
-                // IF TRUE then ADD TO AND 
-                if (Hex_2_Bit(instr_reg, 11) == 0) {
-                    switch (Hex_2_Bit(instr_reg, 10) << 2 | Hex_2_Bit(instr_reg, 9) << 1 | Hex_2_Bit(instr_reg, 8))
-                    {
-                    case ADD:
-#ifdef PrintInstra
-                        printf("ADD");
-#endif
-                        Arithmetic(ADD);
-                        break;
-                    case ADDC:
-#ifdef PrintInstra
-                        printf("ADDC");
-#endif
-                        Arithmetic(ADDC);
-                        break;
-                    case SUB:
-                        
-#ifdef PrintInstra
-                        printf("SUB");
-#endif
-                        Arithmetic(SUB);
-                        break;
-                    case SUBC:
-#ifdef PrintInstra
-                        printf("SUBC");
-#endif
-                        Arithmetic(SUBC);
-                        break;
-                    case DADD:
-#ifdef PrintInstra
-                        printf("DADD");
-#endif
-                        Arithmetic(DADD);
-                        break;
-                    case CMP:
-#ifdef PrintInstra
-                        printf("CMP");
-#endif
-                        Arithmetic(CMP);
-                        break;
-                    case XOR:
-#ifdef PrintInstra
-                        printf("XOR");
-#endif
-                        Arithmetic(XOR);
-                        break;
-                    case AND:
-#ifdef PrintInstra
-                        printf("AND");
-#endif
-                        Arithmetic(AND);
-                        break;
-                    }
-                    
-                }
-                // ELSE ITS OR to CLRCC
-                else {
-                    // IF bit 10 is set then MOV TO CLRCC
-                    if (Hex_2_Bit(instr_reg, 10)) {
-                        // if bit 8 is clear then its MOV or SWAP
-                        if (Hex_2_Bit(instr_reg, 8) == 0) {
-                            if (Hex_2_Bit(instr_reg, 7) == 0) {
-#ifdef PrintInstra
-                                printf("MOV");
-#endif
-                                Mov_SWAP(MOV);
-                            }
-                            else {
-#ifdef PrintInstra
-                                printf("SWAP");
-#endif
-                                Mov_SWAP(SWAP);
-                            }
-                        }
-                        // else SRA TO CLRCC 
-                        else {
-                            //IF BIT 8 AND 7 11 THEN SETPRI TO CLRCC
-                            if (Hex_2_Bit(instr_reg, 8) && Hex_2_Bit(instr_reg, 7)) {
-                                printf("Error 404: I am working very hard to get this part done, thank you for your patience  \n");
-                            }
-                            else{
-                                switch (Hex_2_Bit(instr_reg, 5) << 2 | Hex_2_Bit(instr_reg, 4) << 1 | Hex_2_Bit(instr_reg, 3))
-                                {
-                                case SRA:
-#ifdef PrintInstra
-                                    printf("SRA");
-#endif
-                                    SRA_RRC(SRA);
-                                    break;
-                                case RRC:
-#ifdef PrintInstra
-                                    printf("RRC");
-#endif
-                                    SRA_RRC(RRC);
-                                    break;
-                                case 0b010:
-#ifdef PrintInstra
-                                    printf("COMP");
-#endif
-                                    SignChange(COMP);
-                                    break;
-                                case SWAPB:
-#ifdef PrintInstra
-                                    printf("SWAPB");
-#endif
-                                    SwapPB();
-                                    break;
-                                case SXT:
-#ifdef PrintInstra
-                                    printf("SXT");
-#endif                              
-                                    SignChange(SXT);
-                                    break;
-                                defult:
-#ifdef PrintInstra
-                                    printf("Program Error: Invalid Opcode\n");
-#endif
-                                    break;
+            static const char* branches[] = { "BEQ", "BNE", "BC", "BNC", "BN", "BGE", "BLT", "BRA" };
+            int branch = Hex_2_Bit(word, 12) << 2 | Hex_2_Bit(word, 11) << 1 | Hex_2_Bit(word, 10);
 
-                                }
+            instr->offset = (Hex_2_Bit(word, 9)) ? offset | SEXT_BRA : offset & 0X1FF;
+            SetEntry(instr, Branching, branch, branches[branch]);
+        }
+    }
 
-                            }
-                        }
-                    }
-                    else {
-                        switch (Hex_2_Bit(instr_reg, 9) << 1 | Hex_2_Bit(instr_reg, 8)) {
-                        case ORs:
-#ifdef PrintInstra
-                            printf("OR");
-#endif
-                            Arithmetic(OR);
-                            break;
-                        case BITs:
-#ifdef PrintInstra
-                            printf("BIT");
-#endif
-                            Arithmetic(BIT);
-                            break;
-                        case BICs:
-#ifdef PrintInstra
-                            printf("BIC");
-#endif
-                            Arithmetic(BIC);
-                            break;
-                        case BISs:
-#ifdef PrintInstra
-                            printf("BIS");
-#endif
-                            Arithmetic(BIS);
-                            break;
-                        }
+    // if bits 13 and 12 clear its ADD TO CEX 
+    else if (Hex_2_Bit(word, 13) == 0 && Hex_2_Bit(word, 12) == 0) {
+        // IF TRUE then ADD TO AND 
+        if (Hex_2_Bit(word, 11) == 0) {
+            static const char* arithmetics[] = { "ADD", "ADDC", "SUB", "SUBC", "DADD", "CMP", "XOR", "AND" };
+            int arithmetic = Hex_2_Bit(word, 10) << 2 | Hex_2_Bit(word, 9) << 1 | Hex_2_Bit(word, 8);
 
-                    
-                    }
-                }
-           
+            SetEntry(instr, Arithmetic, arithmetic, arithmetics[arithmetic]);
+        }
+        // IF bit 10 is set then MOV TO CLRCC
+        else if (Hex_2_Bit(word, 10)) {
+            // if bit 8 is clear then its MOV or SWAP
+            if (Hex_2_Bit(word, 8) == 0) {
+                if (Hex_2_Bit(word, 7) == 0) SetEntry(instr, Mov_SWAP, MOV, "MOV");
+                else SetEntry(instr, Mov_SWAP, SWAP, "SWAP");
             }
-            
-            // CEX TO MOV H
+            //IF BIT 8 AND 7 11 THEN SETPRI TO CLRCC
+            else if (Hex_2_Bit(word, 7)) {
+                SetEntry(instr, Unimplemented, UNIMPL_PRI, "SETPRI");
+            }
+            // else SRA TO SXT
             else {
+                switch (Hex_2_Bit(word, 5) << 2 | Hex_2_Bit(word, 4) << 1 | Hex_2_Bit(word, 3))
+                {
+                case SRA:
+                    SetEntry(instr, SRA_RRC, SRA, "SRA");
+                    break;
+                case RRC:
+                    SetEntry(instr, SRA_RRC, RRC, "RRC");
+                    break;
+                case COMP:
+                    SetEntry(instr, SignChange, COMP, "COMP");
+                    break;
+                case SWAPB:
+                    SetEntry(instr, SwapPB, SWAPB, "SWAPB");
+                    break;
+                case SXT:
+                    SetEntry(instr, SignChange, SXT, "SXT");
+                    break;
+                default:
+                    SetEntry(instr, Unimplemented, UNIMPL_NONE, "Program Error: Invalid Opcode");
+                    break;
+                }
+            }
+        }
+        // ELSE ITS OR to BIS
+        else {
+            static const char* logics[] = { "OR", "BIT", "BIC", "BIS" };
+            int logic = Hex_2_Bit(word, 9) << 1 | Hex_2_Bit(word, 8);
 
-                if ( (Hex_2_Bit(instr_reg, 13))== 0) {
-                    // CEX LD OR ST
-                    switch (Hex_2_Bit(instr_reg, 11) << 1 | Hex_2_Bit(instr_reg, 10)) {
-                    case 0b00:
-#ifdef PrintInstra
-                        printf("CEX");
-#endif
-                        printf("Error 404: Something great will be here soon (not due for Assigment - 1)\n");
-                        break;
-                    case LD:
-#ifdef PrintInstra
-                        printf("LD");
-#endif
-                        IndexedAddressing(LD);
-                        break;
-                    case ST:
-#ifdef PrintInstra
-                        printf("ST");
-#endif
-                        IndexedAddressing(ST);
-                        break;
-                    default:
-                        printf("Program Error Invalid Opcode\n");
-                        break;
+            SetEntry(instr, Arithmetic, OR + logic, logics[logic]);
+        }
+    }
 
-                    }
-                }
-                else { // MOVx instruction 
-                    switch (Hex_2_Bit(instr_reg, 12) << 1 | Hex_2_Bit(instr_reg, 11)) {
-                    case MOVL:
-#ifdef PrintInstra
-                        printf("MOVL");
-#endif
+    // CEX LD OR ST
+    else if (Hex_2_Bit(word, 13) == 0) {
+        switch (Hex_2_Bit(word, 11) << 1 | Hex_2_Bit(word, 10)) {
+        case 0b00:
+            SetEntry(instr, Unimplemented, UNIMPL_CEX, "CEX");
+            break;
+        case LD:
+            SetEntry(instr, IndexedAddressing, LD, "LD");
+            break;
+        case ST:
+            SetEntry(instr, IndexedAddressing, ST, "ST");
+            break;
+        default:
+            SetEntry(instr, Unimplemented, UNIMPL_OPCODE, "");
+            break;
+        }
+    }
 
-                        break;
-                    case MOVLZ:
-#ifdef PrintInstra
-                        printf("MOVLZ");
-#endif
-                        break;
-                    case MOVLS:
-#ifdef PrintInstra
-                        printf("MOVLS");
-#endif
-                        break;
-                    case MOVH:
-#ifdef PrintInstra
-                        printf("MOVH");
-#endif
-                        break;
-                    }
-                    Movs();
+    // MOVx instruction 
+    else {
+        static const char* movs[] = { "MOVL", "MOVLZ", "MOVLS", "MOVH" };
+        int mov = Hex_2_Bit(word, 12) << 1 | Hex_2_Bit(word, 11);
 
-                }
+        instr->offset = (mov == MOVH) ? MOV_B(word) << 8 : MOV_B(word);
+        SetEntry(instr, Movs, mov, movs[mov]);
+    }
+    instr->kind = ThreadedKind(instr);
+}
 
-            }
-        }
+/**
+ * Purpose: Builds the decode table, one entry for each of the 64K possible instruction words.
+ *          Must be called once before the first instruction is executed.
+ */
+void InitializeDecodeTable() {
+    for (int word = 0; word < DECODE_TABLE_SIZE; word++) {
+        DecodeWord((unsigned short)word, &DecodeTable[word]);
     }
-#ifdef PrintInstra
-    printf("\n");
-#endif
 }
 
+/**
+ * Purpose: Handles the instructions that are decoded but not emulated yet.
+ *          Nothing is printed on a headless machine.
+ *
+ * @param instr: Decoded instruction, op selects the message printed.
+ */
+void Unimplemented(Machine* m, const DecodedInstr* instr) {
+    if (m->headless) return;
+    switch (instr->op) {
+    case UNIMPL_PRI:
+        printf("Error 404: I am working very hard to get this part done, thank you for your patience  \n");
+        break;
+    case UNIMPL_CEX:
+        printf("Error 404: Something great will be here soon (not due for Assigment - 1)\n");
+        break;
+    case UNIMPL_OPCODE:
+        printf("Program Error Invalid Opcode\n");
+        break;
+    default:
+        break;
+    }
+}
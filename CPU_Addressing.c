@@ -25,27 +25,22 @@
  * Purpose: Handles the Indexed Addressing Mode for Load (LD) and Store (ST) operations.
  * It calculates the effective address based on multiple bits (PREPOS, DEC, INC)
  * 
- * @param load_store: An enum indicating the operation to be performed. LD for a load operation, ST for a store operation.
+ * @param instr: Decoded instruction, op is LD for a load operation, ST for a store operation.
  */
-void IndexedAddressing(extern enum IndexedAddressings load_store) {
-    CPU_CLOCK += 1;
-    unsigned short  dst = DST(instr_reg);
-    unsigned short  src = SRC(instr_reg);
-    unsigned char   word_byte = Hex_2_Bit(instr_reg, 6);
-    unsigned char   PREPOS = Hex_2_Bit(instr_reg, 9);
-    unsigned char   DEC = Hex_2_Bit(instr_reg, 8);
-    unsigned char   INC = Hex_2_Bit(instr_reg, 7);
-
-    unsigned char WORD_BYTE = Hex_2_Bit(instr_reg, 6);
+void IndexedAddressing(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
+    unsigned short  dst = instr->dst;
+    unsigned short  src = instr->src;
+    unsigned char WORD_BYTE = instr->word_byte;
     unsigned short EffectiveAddress;
     unsigned short  address_modifiers;
-    if (load_store == LD)
-        address_modifiers = RegFile[0][src];
+    if (instr->op == LD)
+        address_modifiers = m->reg_file[0][src];
     else
-        address_modifiers = RegFile[0][dst];
+        address_modifiers = m->reg_file[0][dst];
 
 
-    switch (PREPOS << 2 | DEC << 1 | INC) {
+    switch (instr->addr_mode) {
     case Normal:  // '000'
         EffectiveAddress = address_modifiers;
         break;
@@ -79,19 +74,19 @@ void IndexedAddressing(extern enum IndexedAddressings load_store) {
 
     default:
         // Handle invalid case
-        printf("Error: PRPO | DEC | INC | has an undefined combination\n");
+        if (!m->headless) printf("Error: PRPO | DEC | INC | has an undefined combination\n");
         break;
     }
 
-    if (load_store == LD) {
+    if (instr->op == LD) {
 
 #ifdef DEBUG
         printf(" EffectiveAddress= %4X\n", EffectiveAddress);
 #endif
 
         //Bus(EffectiveAddress, &RegFile[0][dst], R, WORD_BYTE);
-        Cache(EffectiveAddress, &RegFile[0][dst], R, WORD_BYTE);
-        if (src!=dst) RegFile[0][src] = address_modifiers;
+        Cache(m, EffectiveAddress, &m->reg_file[0][dst], R, WORD_BYTE);
+        if (src!=dst) m->reg_file[0][src] = address_modifiers;
     }
     else {
 
@@ -100,10 +95,10 @@ void IndexedAddressing(extern enum IndexedAddressings load_store) {
 #endif
         // Cache(unsigned short address, unsigned short* content,
         // unsigned char read_write, unsigned char word_byte, unsigned char wrt_back_thro
-        Cache(EffectiveAddress, &RegFile[0][src], WR, WORD_BYTE);
+        Cache(m, EffectiveAddress, &m->reg_file[0][src], WR, WORD_BYTE);
 
         // Bus(EffectiveAddress, &RegFile[0][src], WR, WORD_BYTE);
-        if (src != dst) RegFile[0][dst] = address_modifiers;
+        if (src != dst) m->reg_file[0][dst] = address_modifiers;
     }
 
 }
@@ -111,48 +106,46 @@ void IndexedAddressing(extern enum IndexedAddressings load_store) {
 /**
  * Purpose: Handles the Relative Addressing Mode for Load (LDR) and Store (STR) operations.
  *          It calculates the effective relative address based on the source or destination register and a postive 
- *          or negative offset.
+ *          or negative offset. The access goes through the data cache, like LD and ST.
  *
  */
 
-void RelativeAddressing() {
-    CPU_CLOCK += 1;
-    unsigned short dst = DST(instr_reg);
-    unsigned short src = SRC(instr_reg);
-    unsigned char word_byte = Hex_2_Bit(instr_reg, 6);
-    // Checking the signed bit from OG intput this is bit 13
-    unsigned char signed_bit = Hex_2_Bit(instr_reg, 13);
-    unsigned short offset = REL_AD_MASK(instr_reg);
+void RelativeAddressing(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
+    unsigned short dst = instr->dst;
+    unsigned short src = instr->src;
+    unsigned char word_byte = instr->word_byte;
+    // Offset is sign extended (bit 13) when the table is built
+    unsigned short offset = instr->offset;
     unsigned short RelativeAddress;
-    // IF signed bit set sign extend 
-    offset = (signed_bit) ? offset | 0XFF80 : offset;
-    RelativeAddress = (Hex_2_Bit(instr_reg, 14) == 1) ? (RegFile[0][dst] + offset) : (RegFile[0][src] + offset);
+    RelativeAddress = (instr->op == STR) ? (m->reg_file[0][dst] + offset) : (m->reg_file[0][src] + offset);
 #ifdef ReltiveAdressDebug
     printf("OFFSET: %4X\n", offset);
     printf("Reltive Adress: %4X \n", RelativeAddress);
 #endif // !ReltiveAdressDebug
 
     // STR
-    if (Hex_2_Bit(instr_reg, 14)) Bus(RelativeAddress, &RegFile[0][src], WR, word_byte);
+    if (instr->op == STR) Cache(m, RelativeAddress, &m->reg_file[0][src], WR, word_byte);
     // LDR
-    else Bus(RelativeAddress, &RegFile[0][dst], R, word_byte);
+    else Cache(m, RelativeAddress, &m->reg_file[0][dst], R, word_byte);
 
 }
 
 /**
  * Performs a all of move operations, which handle different parts of the destination register (high or low byte, or sign).
  * *
+ * @param instr: Decoded instruction, op is MOVL, MOVLZ, MOVLS or MOVH and offset holds the byte to move.
  */
 
-void Movs() {
-    CPU_CLOCK += 1;
-    unsigned short byte_mov = MOV_B(instr_reg);
-    unsigned short dst = DST(instr_reg);
-    switch (Hex_2_Bit(instr_reg, 12) << 1 | Hex_2_Bit(instr_reg, 11)) {
+void Movs(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
+    unsigned short byte_mov = instr->offset;
+    unsigned short dst = instr->dst;
+    switch (instr->op) {
         case MOVL:
             // MOVL 
             // 1) High Byte and with 11111111 00000000  
-            RegFile[REG][dst] = RegFile[REG][dst] & SET_HI;
+            m->reg_file[REG][dst] = m->reg_file[REG][dst] & SET_HI;
             // 2) OR Instruction with byte 
         
             break;
@@ -160,26 +153,25 @@ void Movs() {
         case MOVLZ:
             // MOVLZ
             // 1) High byte  is zero'd by anding with 0x0000 
-            RegFile[REG][dst] = RegFile[REG][dst] & CLEAR_ALL;
+            m->reg_file[REG][dst] = m->reg_file[REG][dst] & CLEAR_ALL;
             // 2) value stored into the LOW byte using OR 
             break;
         case MOVLS:
             // MOVLS
             // MSB Is set to 1's by OR with  11111111 00000000 
-            RegFile[REG][dst] = RegFile[REG][dst] | SET_HI;
+            m->reg_file[REG][dst] = m->reg_file[REG][dst] | SET_HI;
             // 2) using AND we set LSB to zero's
-            RegFile[REG][dst] = RegFile[REG][dst] & SET_HI;
+            m->reg_file[REG][dst] = m->reg_file[REG][dst] & SET_HI;
             // 3) using OR we set LSB to Byte
             break;
         case MOVH:
             // MOVH
             // 1) High bit set to zero LSB Unchanged
-            RegFile[REG][dst] = RegFile[REG][dst] & SET_LOW;
-            // 2) shift Byte so it aligns with high byte then OR 
-            byte_mov = byte_mov << 8;
+            m->reg_file[REG][dst] = m->reg_file[REG][dst] & SET_LOW;
+            // 2) Byte was shifted to align with high byte in the decode table, then OR 
             break;
     }
-    RegFile[REG][dst] = RegFile[REG][dst] | byte_mov;
+    m->reg_file[REG][dst] = m->reg_file[REG][dst] | byte_mov;
 }
 
 /**
@@ -187,67 +179,53 @@ void Movs() {
  *          and modifies the program counter (PC) depending on the branch operation
  * 
  *
- * @param branch_type: An enum indicating the branch type. Valid values are BEQ, BNE, BC, BNC, BN, BGE, BLT, and BRA.
+ * @param instr: Decoded instruction, op is the branch type. Valid values are BEQ, BNE, BC, BNC, BN, BGE, BLT, and BRA.
+ *               offset holds the encoded offset, already shifted and sign extended by the decode table.
  */
-void Branching(enum BR branch_type) {
-    CPU_CLOCK += 1;
+void Branching(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
 #ifdef PrintInstra
     printf("\n");
 #endif
  
-    unsigned int signed_bit = Hex_2_Bit(instr_reg, 9);
-    // shifting 1 bit to the left so that | sign |x| EncodedOffset | 0 |
-    instr_reg = instr_reg << 1;
-    unsigned short branchedPC;
-
-    if (signed_bit)
-    {
-        instr_reg = instr_reg | SEXT_BRA; 
-        branchedPC = PC + instr_reg;
-
-#ifdef Branch_DEBUG
-        printf("Branch PC:  %hx\n", branchedPC);
-        printf("\n Binary OFFSET AFTER SHIFT + Set (SIGNED Bit) \n ");
-        printBits(instr_reg);
-#endif
-
-    }
-    else
-    {
-        instr_reg = instr_reg & 0X1FF;
-        branchedPC = instr_reg + PC;
+    unsigned short branchedPC = PC + instr->offset;
 
-#ifdef Branch_DEBUG
-        printf("Branch PC   :  %hx\n", branchedPC);
-        printf("\n Binary OFFSET AFTER SHIFT + Set (Non-SIGNED Bit) \n");
-        printBits(instr_reg);
-#endif
-    }
 #ifdef Branch_DEBUG
     printf("\n Branched PC:  %hx\n", branchedPC);
     printf("Current PC: %hx\n", PC);
-
+    printf("\n Binary OFFSET AFTER SHIFT \n ");
+    printBits(instr->offset);
 #endif //
-    switch (branch_type)
+    if (BranchCondition(m, instr->op)) PC = branchedPC;
+}
+
+/**
+ * Purpose: Evaluates the condition of a branch against the PSW.
+ *
+ * @param branch: Branch type. Valid values are BEQ, BNE, BC, BNC, BN, BGE, BLT, and BRA.
+ * @return: 1 if the branch is taken, 0 otherwise.
+ */
+int BranchCondition(Machine* m, unsigned char branch) {
+    switch (branch)
     {
 
     case BEQ:
-        PC = psw.z == 1 ? branchedPC : PC; break;
+        return PSW_Z() == 1;
     case BNE:
-        PC = psw.z == 0 ? branchedPC : PC; break;
+        return PSW_Z() == 0;
     case BC:
-        PC = psw.c == 1 ? branchedPC : PC; break;
+        return PSW_C() == 1;
     case BNC:
-        PC = psw.c == 0 ? branchedPC : PC; break;
+        return PSW_C() == 0;
     case BN:
-        PC = psw.n == 1 ? branchedPC : PC; break;
+        return PSW_N() == 1;
     case BGE:
-        PC = (psw.n ^ psw.v) == 0 ? branchedPC : PC; break;
+        return (PSW_N() ^ PSW_V()) == 0;
     case BLT:
-        PC = (psw.n ^ psw.v) == 1 ? branchedPC : PC; break;
+        return (PSW_N() ^ PSW_V()) == 1;
     case BRA:
-        PC = branchedPC; break;
-    default: break;
+        return 1;
+    default: return 0;
     }
 
 }
@@ -256,37 +234,22 @@ void Branching(enum BR branch_type) {
  * Purpose: Handles the Branch and Link (BL) operation only. It stores the current program counter (PC) in the link register (LR)
  *          and then branches to a new location by adding a signed offset to the PC.
  *
+ * @param instr: Decoded instruction, offset holds the shifted and sign extended offset.
  */
-void BranchLink() {
-    CPU_CLOCK += 1;
+void BranchLink(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
 #ifdef DEBUG
     printf("\n");
-    printf("\nEncoded offset:  %hx\n", instr_reg);
+    printf("\nEncoded offset:  %hx\n", instr->word);
     printf("Current PC: %hx\n", PC);
+    printf("\n Binary OFFSET AFTER SHIFT + Set \n");
+    printBits(instr->offset);
 #endif
-    int signed_bit = Hex_2_Bit(instr_reg, 12);
-    // shifting 1 bit to the left so that | sign |x| EncodedOffset | 0 |
-    instr_reg = instr_reg << 1;
-    unsigned short branchedPC;
-#ifdef DEBUG
-    printf("\n Binary OFFSET AFTER SHIFT\n ");
-    printBits(instr_reg);
-#endif
-    if (signed_bit)
-    {
-        instr_reg = instr_reg | SEXT_BL; 
-    }
-    else
-    {
-        instr_reg = SET_BIT(instr_reg, 12, 0);
-    }
     // Storing PC into Link Register or R5
     LR = PC;
-    PC = PC + instr_reg;
+    PC = PC + instr->offset;
 
 #ifdef DEBUG
-    printf("\n Binary OFFSET AFTER SHIFT + Set \n");
-    printBits(instr_reg);
     printf("Branch PC:  %hx\n", PC);
 #endif
 }
@@ -29,31 +29,31 @@
  *         MOV copies a value from the source register to the destination register.
  *         SWAP exchanges the values between the source and destination registers.
  *
- * @param operation: An integer that indicates the operation to be performed. MOV for a move operation, SWAP for a swap operation.
+ * @param instr: Decoded instruction, op is MOV for a move operation, SWAP for a swap operation.
  */
-void Mov_SWAP(int opration) {
-    CPU_CLOCK += 1;
+void Mov_SWAP(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
     // Src register points to an adress in memory 
-    unsigned char word_byte = Hex_2_Bit(instr_reg, 6);
+    unsigned char word_byte = instr->word_byte;
 
-    unsigned short dst_reg = DST(instr_reg);
-    unsigned short src_reg = SRC(instr_reg);
+    unsigned short dst_reg = instr->dst;
+    unsigned short src_reg = instr->src;
     unsigned short src_val;
     unsigned short result;
 
-    src_val = RegFile[REG][src_reg];
+    src_val = m->reg_file[REG][src_reg];
 
     
-    switch (opration)
+    switch (instr->op)
     {
     case MOV:
         result = (word_byte == WORD) ? src_val :  (unsigned char)src_val;
-        RegFile[REG][dst_reg] = result;
+        m->reg_file[REG][dst_reg] = result;
         break;
     
     case SWAP:
-        RegFile[REG][src_reg] = RegFile[REG][dst_reg];
-        RegFile[REG][dst_reg] = src_val;
+        m->reg_file[REG][src_reg] = m->reg_file[REG][dst_reg];
+        m->reg_file[REG][dst_reg] = src_val;
         break;
 
     default:
@@ -64,26 +64,26 @@ void Mov_SWAP(int opration) {
 /**
  * Purpose: Simulates the SXT (Sign Extend) and COMP (One's Complement) operations in a processor.
  *
- * @param operation: An enum indicating the operation to be performed. 
+ * @param instr: Decoded instruction, op is SXT or COMP.
  */
 
-void SignChange(extern enum OneOprands opration) {
-    CPU_CLOCK += 1;
-    unsigned short dst_reg = DST(instr_reg);
+void SignChange(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
+    unsigned short dst_reg = instr->dst;
     unsigned short dst_val;
     unsigned short result;
     unsigned char sxt_bit;
     unsigned char word_byte;
-    word_byte = Hex_2_Bit(instr_reg, 6);
-    dst_val = RegFile[REG][dst_reg];
+    word_byte = instr->word_byte;
+    dst_val = m->reg_file[REG][dst_reg];
     unsigned short hi_byte = dst_reg & 0xFF00;
 
-    switch (opration)
+    switch (instr->op)
     {
   
     case SXT:
         result = dst_val;
-        sxt_bit = Hex_2_Bit(RegFile[REG][DST(instr_reg)], 7);
+        sxt_bit = Hex_2_Bit(m->reg_file[REG][dst_reg], 7);
         result = (sxt_bit == 0) ? result & SET_LOW : result | SET_HI;
 
         break;
@@ -92,11 +92,11 @@ void SignChange(extern enum OneOprands opration) {
         result = (word_byte == WORD) ? ~ dst_val : ~(unsigned char)dst_val;
         break;
     default:
-        printf("Error: Unkown OPCODE\n");
+        if (!m->headless) printf("Error: Unkown OPCODE\n");
         break;
     }
     if (word_byte == BYTE) result = hi_byte |result;
-    RegFile[REG][dst_reg] = result ; 
+    m->reg_file[REG][dst_reg] = result ; 
 }
 
 /**
@@ -108,24 +108,25 @@ void SignChange(extern enum OneOprands opration) {
  * @param word_byte: Flag to indicate if the operation is byte-wise or word-wise.
  * @return: The result of the DADD operation. 
  */
-unsigned short Dadd(unsigned srcValue, unsigned dstValue, unsigned char word_byte) {
-    CPU_CLOCK += 1;
+unsigned short Dadd(Machine* m, unsigned srcValue, unsigned dstValue, unsigned char word_byte) {
+    m->cpu_clock += 1;
     // This function uses two unions of bcd_digits one for source and the other for dst 
-    unsigned short temp_carry = psw.c;
+    SyncPsw(m);
+    unsigned short temp_carry = m->psw.c;
     union bcd_digits src_ip, dst_ip;
     // SrcValue and dstValue is loaded in the memory which is then accessed using a union
     src_ip.data_val = srcValue;
     dst_ip.data_val = dstValue;
 
     // 4 bits accessed in the struct using fields in the struct dadd_bits which is inside the uinion bcd_digits
-    dst_ip.nibble.n_0 = BcdAdd(src_ip.nibble.n_0, dst_ip.nibble.n_0, &temp_carry);
-    dst_ip.nibble.n_1 = BcdAdd(src_ip.nibble.n_1, dst_ip.nibble.n_1, &temp_carry);
+    dst_ip.nibble.n_0 = BcdAdd(m, src_ip.nibble.n_0, dst_ip.nibble.n_0, &temp_carry);
+    dst_ip.nibble.n_1 = BcdAdd(m, src_ip.nibble.n_1, dst_ip.nibble.n_1, &temp_carry);
     // If it's a word then 4 bytes must be accessed 
     if (!word_byte) {
-        dst_ip.nibble.n_2 = BcdAdd(src_ip.nibble.n_2, dst_ip.nibble.n_2, &temp_carry);
-        dst_ip.nibble.n_3 = BcdAdd(src_ip.nibble.n_3, dst_ip.nibble.n_3, &temp_carry);
+        dst_ip.nibble.n_2 = BcdAdd(m, src_ip.nibble.n_2, dst_ip.nibble.n_2, &temp_carry);
+        dst_ip.nibble.n_3 = BcdAdd(m, src_ip.nibble.n_3, dst_ip.nibble.n_3, &temp_carry);
     }
-    psw.c = temp_carry;
+    m->psw.c = temp_carry;
     return dst_ip.data_val;
 
 
@@ -140,9 +141,9 @@ unsigned short Dadd(unsigned srcValue, unsigned dstValue, unsigned char word_byt
  * @return: The sum of the two nibbles and the input carry. If the sum exceeds 9, it wraps around by 10, and the carry is set to 1.
  */
 
-unsigned short BcdAdd(unsigned short nibble_x, unsigned short nibble_y,unsigned short *carry) 
+unsigned short BcdAdd(Machine* m, unsigned short nibble_x, unsigned short nibble_y,unsigned short *carry) 
 {
-    CPU_CLOCK += 1;
+    m->cpu_clock += 1;
     unsigned short result;
 
     result = nibble_x + nibble_y + *carry;
@@ -168,14 +169,14 @@ unsigned short BcdAdd(unsigned short nibble_x, unsigned short nibble_y,unsigned
  * @param word_byte: Flag to indicate if the operation is byte-wise or word-wise.
  * @return: The result of the arithmetic operation. This function also updates the PSW.
  */
-unsigned short Addc(unsigned short src, unsigned short dst, unsigned short temp_carry, char word_byte) {
-    CPU_CLOCK += 1;
+unsigned short Addc(Machine* m, unsigned short src, unsigned short dst, unsigned short temp_carry, char word_byte) {
+    m->cpu_clock += 1;
     unsigned short dst_high;
     unsigned short result;
     dst_high = dst & 0xFF00;
     if (word_byte == WORD) {
         result = dst + src + temp_carry;
-        update_psw((src + temp_carry), dst, result, word_byte);
+        update_psw(m, (src + temp_carry), dst, result, word_byte);
     }
     else {
         unsigned char src_lsb = src & 0x00FF; // Get the LSB of src
@@ -183,7 +184,7 @@ unsigned short Addc(unsigned short src, unsigned short dst, unsigned short temp_
         (unsigned char)result = src_lsb + dst_lsb + temp_carry;        
         (unsigned char)dst = dst & 0XFF00;
         result = dst | result;
-        update_psw((src_lsb + temp_carry), dst_lsb, (unsigned char)result, word_byte);
+        update_psw(m, (src_lsb + temp_carry), dst_lsb, (unsigned char)result, word_byte);
     }
 
     if (word_byte == BYTE) result = result | dst_high;
@@ -193,13 +194,13 @@ unsigned short Addc(unsigned short src, unsigned short dst, unsigned short temp_
     return result;
 }
 
-void SRA_RRC(int oprartion) {
-    CPU_CLOCK += 1;
+void SRA_RRC(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
     unsigned int msb_value;
     unsigned int temp_carry;
     unsigned int msb_position;
-    unsigned char word_byte = Hex_2_Bit(instr_reg, 6);
-    unsigned short dst = DST(instr_reg);
+    unsigned char word_byte = instr->word_byte;
+    unsigned short dst = instr->dst;
     // -> MSB is eithr bit 7 when its a BYTE or bit 15 when its a WORD
     msb_position = (word_byte) ?  7: 15;
     /*
@@ -209,8 +210,8 @@ void SRA_RRC(int oprartion) {
     * PSW.C is set through arithmetic shift
     * DST.MSB → … → DST.LSB → C
     */
-    if (oprartion == SRA) {
-        temp_carry = (word_byte) ? Hex_2_Bit(RegFile[REG][dst], 7) : Hex_2_Bit(RegFile[REG][dst], 15);
+    if (instr->op == SRA) {
+        temp_carry = (word_byte) ? Hex_2_Bit(m->reg_file[REG][dst], 7) : Hex_2_Bit(m->reg_file[REG][dst], 15);
     }
     /*
     * RRC
@@ -218,18 +219,19 @@ void SRA_RRC(int oprartion) {
     * C → DST.MSB → … → DST.LSB → C 
     */
     else {
-        temp_carry = psw.c;
-        psw.c = Hex_2_Bit(RegFile[REG][dst], 0);
+        SyncPsw(m);
+        temp_carry = m->psw.c;
+        m->psw.c = Hex_2_Bit(m->reg_file[REG][dst], 0);
     }
 
     // If a byte update MSB so its unchanged 
-    if (word_byte) (unsigned char)RegFile[REG][dst] >>= 1;
-    else RegFile[REG][dst] >>= 1;
-    SET_BIT(RegFile[REG][dst], msb_position, temp_carry);
+    if (word_byte) (unsigned char)m->reg_file[REG][dst] >>= 1;
+    else m->reg_file[REG][dst] >>= 1;
+    SET_BIT(m->reg_file[REG][dst], msb_position, temp_carry);
 }
 
-void SwapPB() {
-    CPU_CLOCK += 1;
+void SwapPB(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
     /*
     * (Word Only)
     * Swaps Bytes in DST
@@ -237,7 +239,7 @@ void SwapPB() {
     * DST.MSB <--- DST.LSB
     * DST.LSB <--- TMP
     */
-    unsigned short dst_val = RegFile[0][DST(instr_reg)];
+    unsigned short dst_val = m->reg_file[0][instr->dst];
     #ifdef SwapDebug
 
     printf("\n OLD DEST: %4x\n", dst_val);
@@ -245,9 +247,9 @@ void SwapPB() {
     unsigned char msB = (dst_val >> 8) & 0xFF;  // Extract MSB (Most Significant Byte)
     unsigned char lsB = dst_val & 0xFF;         // Extract LSB (Least Significant Byte)
     dst_val = (lsB << 8) | msB;  // Swap the bytes
-    RegFile[0][DST(instr_reg)] = dst_val;
+    m->reg_file[0][instr->dst] = dst_val;
     #ifdef SwapDebug
-        printf(" NEW DEST: %4x\n", RegFile[0][DST(instr_reg)]);
+        printf(" NEW DEST: %4x\n", m->reg_file[0][instr->dst]);
     #endif
 
 }
@@ -256,18 +258,19 @@ void SwapPB() {
  * Purpose: Handles all of arithmetic operations either directly or by calling Addc and setting the temp_carry according
  *          to the operation.
  *
- * @param operation: An enum indicating the operation to be performed.
+ * @param instr: Decoded instruction, op is the arithmetic operation to be performed.
  */
-void Arithmetic(extern enum Arithmetics opration) {
-    CPU_CLOCK += 1;
+void Arithmetic(Machine* m, const DecodedInstr* instr) {
+    m->cpu_clock += 1;
 #ifdef PrintInstra
     printf("\n");
 #endif
-    unsigned char word_byte = Hex_2_Bit(instr_reg, 6);
-    unsigned char reg_const = Hex_2_Bit(instr_reg, 7);
+    enum Arithmetics opration = instr->op;
+    unsigned char word_byte = instr->word_byte;
+    unsigned char reg_const = instr->reg_const;
 
-    unsigned short dst = DST(instr_reg);
-    unsigned short src = SRC(instr_reg);
+    unsigned short dst = instr->dst;
+    unsigned short src = instr->src;
     unsigned short result;
     unsigned short dstValue;
     unsigned short srcValue;
@@ -278,8 +281,8 @@ void Arithmetic(extern enum Arithmetics opration) {
 #endif
 
 
-    dstValue = RegFile[REG][dst];
-    srcValue = RegFile[reg_const][src];
+    dstValue = m->reg_file[REG][dst];
+    srcValue = m->reg_file[reg_const][src];
 #ifdef ARITH_DEBUG
 
     printf("Source: %hx\n", src);
@@ -296,16 +299,16 @@ void Arithmetic(extern enum Arithmetics opration) {
 #endif
     if (opration == BIT || opration == CMP) {
         if (opration == CMP) {
-            (void)Addc(~srcValue, dstValue, 1, word_byte);
+            (void)Addc(m, ~srcValue, dstValue, 1, word_byte);
 #ifdef ARITH_DEBUG
             printf("CMP\n");
 #endif
         }
         else {
             // BIT  
-            if (word_byte == BYTE && srcValue > ByteLength) printf(YELLOW "Warning: Byte Operation but Source value is bigger than 8 \n" RESET);
+            if (!m->headless && word_byte == BYTE && srcValue > ByteLength) printf(YELLOW "Warning: Byte Operation but Source value is bigger than 8 \n" RESET);
             result = (word_byte == BYTE) ? (dstValue & (1 << srcValue)) : (unsigned char)((dstValue & (1 << srcValue)));
-            update_psw_2(result, word_byte);
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("BIT\n");
 #endif
@@ -315,85 +318,85 @@ void Arithmetic(extern enum Arithmetics opration) {
         switch (opration)
         {
         case ADD:
-            result = Addc(srcValue, dstValue, 0, word_byte);
+            result = Addc(m, srcValue, dstValue, 0, word_byte);
 #ifdef ARITH_DEBUG
             printf("ADD\n");
 #endif
             break;
 
         case ADDC:
-            result = Addc(srcValue, dstValue, psw.c, word_byte);
+            result = Addc(m, srcValue, dstValue, PSW_C(), word_byte);
 #ifdef ARITH_DEBUG
             printf("ADDC\n");
 #endif
             break;
 
         case SUB:
-            result = Addc(~srcValue, dstValue, 1, word_byte);
+            result = Addc(m, ~srcValue, dstValue, 1, word_byte);
 #ifdef ARITH_DEBUG
             printf("SUB\n");
 #endif
             break;
 
         case SUBC:
-            result = Addc(~srcValue, dstValue, psw.c, word_byte);
+            result = Addc(m, ~srcValue, dstValue, PSW_C(), word_byte);
 #ifdef ARITH_DEBUG
             printf("SUBC\n");
 #endif
             break;
 
         case XOR:
-            result = (word_byte == WORD) ? ((dstValue ^ srcValue) + psw.c) : ((unsigned char)(dstValue ^ srcValue)) + psw.c;
-            update_psw_2(result, word_byte);
+            result = (word_byte == WORD) ? ((dstValue ^ srcValue) + PSW_C()) : ((unsigned char)(dstValue ^ srcValue)) + PSW_C();
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("XOR\n");
 #endif
             break;
         case AND:
-            result = (word_byte == WORD) ? ((dstValue & srcValue) + psw.c) : ((unsigned char)dstValue & (unsigned char)srcValue) + psw.c;
-            update_psw_2(result, word_byte);
+            result = (word_byte == WORD) ? ((dstValue & srcValue) + PSW_C()) : ((unsigned char)dstValue & (unsigned char)srcValue) + PSW_C();
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("AND\n");
 #endif
             break;
         case OR:
             result = (word_byte == WORD) ? (dstValue | srcValue) : (unsigned char)(dstValue | srcValue);
-            update_psw_2(result, word_byte);
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("OR\n");
 #endif
             break;
         case BIC:
-            if (word_byte == 1 && srcValue > ByteLength) printf(YELLOW "Warning: Byte Operation but Source value is bigger than 8 \n" RESET);
+            if (!m->headless && word_byte == 1 && srcValue > ByteLength) printf(YELLOW "Warning: Byte Operation but Source value is bigger than 8 \n" RESET);
             result = (word_byte == WORD) ? (dstValue & ~(1 << srcValue)) : (unsigned char)(dstValue & ~(1 << srcValue));
-            update_psw_2(result, word_byte);
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("BIC\n");
 #endif
             break;
         case BIS:
-            if (word_byte == 1 && srcValue > ByteLength) printf(YELLOW "Warning: Byte Operation but Source value is bigger than 8 \n" RESET);
+            if (!m->headless && word_byte == 1 && srcValue > ByteLength) printf(YELLOW "Warning: Byte Operation but Source value is bigger than 8 \n" RESET);
             result = (word_byte == WORD) ? (dstValue | (1 << srcValue)) : (unsigned char)(dstValue | (1 << srcValue));
-            update_psw_2(result, word_byte);
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("BIS\n");
 #endif
             break;
         case DADD:
-            result = Dadd(srcValue, dstValue, word_byte);
-            update_psw_2(result, word_byte);
+            result = Dadd(m, srcValue, dstValue, word_byte);
+            update_psw_2(m, result, word_byte);
 #ifdef ARITH_DEBUG
             printf("DADD\n");
 #endif
             break;
 
         default:
-            printf("Program Error: Unkown Arithmetic operation %d\n", opration);
+            if (!m->headless) printf("Program Error: Unkown Arithmetic operation %d\n", opration);
             return -1;
             break;
         }
         
-        RegFile[0][dst] = result;
+        m->reg_file[0][dst] = result;
     }
 }
 
@@ -3,354 +3,1062 @@
  * CACHE MEMORY SYSTEM IMPLEMENTATION
  *
  * This file provides a comprehensive emulation of cache memory operations, offering
- * both write-back and write-through caching strategies. The file contains functions for
- * cache initialization, address location, cache updating, cache printing, and cache line aging.
- * It emulates associative as well as direct mapping cache strategies.
+ * both write-back and write-through caching strategies, with or without write allocation.
+ * The file contains functions for cache configuration, initialization, address location,
+ * cache updating and cache printing.
+ * The hierarchy has three levels (CacheLevel in cache.h): an L1 instruction cache that fetches go
+ * through, an L1 data cache for every load and store, and a unified L2 that both L1 caches miss
+ * into and write back to. A level of size 0 is not there: accesses skip to the level below it, and
+ * fetches with no L1 instruction cache cost a flat memory access. By default only the L1 data
+ * cache is there, so the timing is that of a single cache.
+ * Everything about a level is set at run time with a CacheConfig (cache.h): total size, line
+ * size, associativity, write policy and replacement policy. Each level is N-way set associative:
+ * the address picks a set and only the lines of that set are searched, so a lookup costs the same
+ * at any cache size. A line holds line_size bytes and is moved to and from the level below in one
+ * burst (BusBurst() from memory, L2_ACCESS_CYCLES plus a cycle per further word from the L2), so a
+ * line of several words costs one transaction per miss.
+ * Every level counts its read and write hits and misses, evictions, write backs and byte and word
+ * accesses (CacheCounters in cache.h), and the misses of the levels the CPU accesses are added up
+ * per instruction address, so TopMisses() can name the instructions that miss most. Nothing is
+ * printed while the caches run; PrintCache() (PH) and DumpCacheCounters() (headless) report them.
+ * A level can have a prefetcher (PrefetchState in cache.h, Prefetch.c), trained on the accesses the
+ * CPU makes to it; its prefetches fill lines in the background. The data cache can have a write
+ * buffer (WriteBuffer.c) that the stores it sends down drain through in the background.
+ * The lines are kept as a structure of arrays (CacheLines in cache.h): a dense array of tags and
+ * bitmasks of valid and dirty lines. A lookup reads only the tags and valid bits of one set, and
+ * with CACHE_SIMD compares 8 (SSE2) or 16 (AVX2) tags per instruction, so even highly associative
+ * sets are searched in a few steps.
+ *
+ * Configuration options, on the command line (-cache key=value,...) or one per line in a file:
+ *     size=<bytes> line=<bytes> ways=<n>|full write=back|through allocate=yes|no policy=<name> seed=<n>
+ *     prefetch=none|next|stride|stream degree=<lines> distance=<lines or strides> wbuffer=<entries>
+ * An option sets the L1 data cache unless its key starts with the level, e.g. l1i.size=1024 or l2.ways=16.
  *
  *
  * Author: Omar
  */
 
-
-
-
-// Macro to choose Write-Back or Write-Through caching strategy, 
-// uncomment to select this strategy and comment out the Write-Through macro
-
-#define WRT_BACK // "Achraf Hakimi is the best"
-// #define WRT_THRO
-
-// Macro to choose Associative OR DIRCT caching please dont uncomment both
-#define Associative 
-#define DIRCT
-
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "cache.h"
+#include <string.h>
+#include "Cache.h"
 #include "emulator.h"
+#include "Snapshot.h"
+
+#ifdef CACHE_SIMD
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // #define CacheUpdate
 // #define CacheDebug
 
-CacheLine cache[CACHE_SIZE];
 
 /*
-*  purpose   :   Function to decrement the age of all cache lines, except the one at the provided index
-*  parameters : Index to be excluded from decrement
-*  return    :  none
+*  purpose   : Function to check that a number is a power of two
+*  parameters: value - Number checked
+*  return    : true if value is a power of two
 */
-void DecrementAllExcept(int index) {
-    for (int i = 0; i < CACHE_SIZE; i++) {
+static bool IsPowerOfTwo(unsigned int value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
 
-        if (cache[i].age > 0 && cache[i].age > cache[index].age) {
-            cache[i].age--;
-        }
+/*
+*  purpose   : Function to find the lowest set bit of a mask
+*  parameters: mask - Bits searched, not 0
+*  return    : Index of the lowest set bit
+*/
+static int LowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
 
+/*
+*  purpose   : Function to allocate the arrays of count empty lines
+*  parameters: lines - Arrays allocated
+*              count - Number of lines
+*              line_size - Bytes per line
+*  return    : true if every array could be allocated, all are left NULL otherwise
+*/
+static bool AllocateLines(CacheLines* lines, int count, unsigned int line_size) {
+    lines->tag = calloc(count, sizeof(unsigned short));
+    lines->valid = calloc(BITMASK_WORDS(count), sizeof(unsigned long long));
+    lines->dirty = calloc(BITMASK_WORDS(count), sizeof(unsigned long long));
+    lines->data = calloc(count, line_size);
+    if (lines->tag == NULL || lines->valid == NULL || lines->dirty == NULL || lines->data == NULL) {
+        free(lines->tag);
+        free(lines->valid);
+        free(lines->dirty);
+        free(lines->data);
+        memset(lines, 0, sizeof(*lines));
+        return false;
     }
-    cache[index].age = MAX_AGE;
+    return true;
 }
+
+// Names of the levels, the prefix of their options
+const char* CacheLevelNames[CACHE_LEVELS] = { "l1i", "l1d", "l2" };
+
 /*
-*  purpose   : Function to initialize the cache
-*  parameters: None
+*  purpose   : Function to give the configuration a machine's caches start with: only the L1 data
+*              cache, 64 bytes of one-word lines, direct mapped, write-back with write allocation, LRU,
+*              no prefetcher and no write buffer.
+*              The L1 instruction cache and the L2 are off until given a size.
+*  parameters: configs - Configuration of every level, filled in
 *  return    : None
 */
-void InitializeCache() {
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        cache[i].address = 0x0000;
-        cache[i].cache_line.word = 0x0000;
-        cache[i].age = 0;
-        cache[i].dirty_lo = false;
-        cache[i].dirty_hi = false;
-        cache[i].valid = false;
-    }
+void DefaultCacheConfig(CacheConfig configs[CACHE_LEVELS]) {
+    const CacheConfig l1i = { CACHE_OFF, L1I_LINE_SIZE, L1I_WAYS, true, true, POLICY_LRU, 1, PREFETCH_NONE, 1, 1, 0 };
+    const CacheConfig l1d = { CACHE_SIZE, CACHE_LINE_SIZE, CACHE_WAYS, true, true, POLICY_LRU, 1, PREFETCH_NONE, 1, 1, 0 };
+    const CacheConfig l2 = { CACHE_OFF, L2_LINE_SIZE, L2_WAYS, true, true, POLICY_LRU, 1, PREFETCH_NONE, 1, 1, 0 };
+
+    configs[CACHE_L1I] = l1i;
+    configs[CACHE_L1D] = l1d;
+    configs[CACHE_L2] = l2;
 }
 
 /*
-*  Purpose   : Searches through all cache lines. If the current cache line's address matches the requested address, the index is returned.
-*              If the address is not found, the function returns -1.
-*
-*  Parameters:
-*              address - The address to be located in the cache.
-*
-*  Return    : Returns the index of the found address in cache. If the address is not found, returns -1.
+*  purpose   : Function to check the configuration of one level
+*  parameters: config - Configuration checked, size CACHE_OFF for no cache
+*  return    : NULL if the configuration is valid, otherwise what is wrong with it
 */
-int FindInCache(unsigned short address) {
+static const char* CheckLevelConfig(const CacheConfig* config) {
+    if (config->size == CACHE_OFF) return NULL;
+    if (!IsPowerOfTwo(config->line_size) || config->line_size < 2 || config->line_size > MAX_LINE_SIZE)
+        return "line size must be a power of two from 2 to 256 bytes";
+    if (!IsPowerOfTwo(config->size) || config->size < config->line_size || config->size > MEM_SIZE)
+        return "size must be 0 or a power of two from one line to 65536 bytes";
+    if (config->ways != CACHE_FULLY_ASSOCIATIVE &&
+        (!IsPowerOfTwo(config->ways) || config->ways > config->size / config->line_size))
+        return "ways must be a power of two no larger than the number of lines";
+    if (config->policy < 0 || config->policy >= POLICY_COUNT)
+        return "unknown replacement policy";
+    if (config->prefetcher < 0 || config->prefetcher >= PREFETCH_COUNT)
+        return "unknown prefetcher";
+    if (config->degree < 1 || config->degree > PREFETCH_MAX_DEGREE || config->distance < 1 || config->distance > PREFETCH_MAX_DISTANCE)
+        return "prefetch degree must be from 1 to 8 and distance from 1 to 64";
+    if (config->write_buffer > WBUFFER_MAX_ENTRIES)
+        return "write buffer must have 0 to 16 entries";
+    return NULL;
+}
 
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        // Check if address matches and cache line is valid
-        if (cache[i].address == address && cache[i].valid) {
-            return i;
+/*
+*  purpose   : Function to check the configuration of every level before it is used.
+*              An L1 line must fit in one L2 line, so it is moved to and from the L2 whole.
+*  parameters: configs - Configuration of every level
+*  return    : NULL if the configuration is valid, otherwise what is wrong with it
+*/
+const char* CheckCacheConfig(const CacheConfig configs[CACHE_LEVELS]) {
+    static char message[CACHE_CONFIG_LINE];
+
+    for (int level = 0; level < CACHE_LEVELS; level++) {
+        const char* error = CheckLevelConfig(&configs[level]);
+
+        if (error != NULL) {
+            snprintf(message, sizeof(message), "%s %s", CacheLevelNames[level], error);
+            return message;
         }
     }
-    return -1;  // Return -1 if address is not found in cache
+    if (configs[CACHE_L2].size != CACHE_OFF) {
+        for (int level = CACHE_L1I; level <= CACHE_L1D; level++) {
+            if (configs[level].size != CACHE_OFF && configs[level].line_size > configs[CACHE_L2].line_size)
+                return "l2 line size must be at least the line size of each l1 cache";
+        }
+    }
+    return NULL;
 }
 
 /*
-*  purpose    : Function to update the cache with a new address and content
-*                   Searches through all cache lines to locate the oldest one, and updates it with the new address and content.
-*                   This function follows an associative addressing approach. If Write-Back is enabled, it also checks dirty bits
-*                   to decide if a memory write is needed before updating the cache line.
-*
-*  parameters : address - The new address to be added to the cache
-*                   content - The content associated with the new address
-*                   word_byte - Flag to determine if the operation is on a word or byte (WORD/BYTE)
-*
-*  return     :  Returns the index of the oldest cache line that was updated
+*  purpose   : Function to set one option of a cache configuration
+*  parameters: configs - Configuration of every level, changed
+*              key - Option name (size, line, ways, write, allocate, policy, seed, prefetch, degree,
+*                    distance, wbuffer), for the L1 data
+*                    cache unless prefixed with a level name and a dot (l1i.size, l2.line, ...)
+*              value - Option value
+*  return    : true if the option was known and its value valid, the configuration is not checked as a whole
 */
+bool SetCacheOption(CacheConfig configs[CACHE_LEVELS], const char* key, const char* value) {
+    CacheConfig* config = &configs[CACHE_L1D];
+    const char* dot = strchr(key, '.');
+    char* end;
+    unsigned long number = strtoul(value, &end, 10);
+    bool is_number = (*value != '\0' && *end == '\0');
+
+    if (dot != NULL) {
+        int level = 0;
+
+        while (level < CACHE_LEVELS && (strlen(CacheLevelNames[level]) != (size_t)(dot - key) ||
+            strncmp(key, CacheLevelNames[level], dot - key) != 0)) level++;
+        if (level == CACHE_LEVELS) return false;
+        config = &configs[level];
+        key = dot + 1;
+    }
 
-int UpdateCache(unsigned short address, unsigned short content, unsigned int word_byte) {
-#ifdef CacheUpdate
-    printf("Cache Update Request: Address = 0x%04X, Content = 0x%02X\n", address, content);
-#endif
-    int oldest_index = 0;
+    if (strcmp(key, "size") == 0 && is_number) config->size = (unsigned int)number;
+    else if (strcmp(key, "line") == 0 && is_number) config->line_size = (unsigned int)number;
+    else if (strcmp(key, "ways") == 0 && is_number) config->ways = (unsigned int)number;
+    else if (strcmp(key, "ways") == 0 && strcmp(value, "full") == 0) config->ways = CACHE_FULLY_ASSOCIATIVE;
+    else if (strcmp(key, "seed") == 0 && is_number) config->seed = (unsigned int)number;
+    else if (strcmp(key, "degree") == 0 && is_number) config->degree = (unsigned int)number;
+    else if (strcmp(key, "distance") == 0 && is_number) config->distance = (unsigned int)number;
+    else if (strcmp(key, "wbuffer") == 0 && is_number) config->write_buffer = (unsigned int)number;
+    else if (strcmp(key, "prefetch") == 0 && FindPrefetcher(value) >= 0) config->prefetcher = FindPrefetcher(value);
+    else if (strcmp(key, "write") == 0 && strcmp(value, "back") == 0) config->write_back = true;
+    else if (strcmp(key, "write") == 0 && strcmp(value, "through") == 0) config->write_back = false;
+    else if (strcmp(key, "allocate") == 0 && strcmp(value, "yes") == 0) config->write_allocate = true;
+    else if (strcmp(key, "allocate") == 0 && strcmp(value, "no") == 0) config->write_allocate = false;
+    else if (strcmp(key, "policy") == 0 && FindPolicy(value) >= 0) config->policy = FindPolicy(value);
+    else return false;
+    return true;
+}
 
+/*
+*  purpose   : Function to set the options of a cache configuration from a comma separated list
+*  parameters: configs - Configuration of every level, changed
+*              options - List of key=value options, e.g. "size=1024,line=16,ways=4,l2.size=8192"
+*  return    : true if every option was valid
+*/
+bool ParseCacheOptions(CacheConfig configs[CACHE_LEVELS], const char* options) {
+    char buffer[CACHE_CONFIG_LINE];
+
+    if (strlen(options) >= CACHE_CONFIG_LINE) return false;
+    strcpy(buffer, options);
+
+    for (char* option = strtok(buffer, ","); option != NULL; option = strtok(NULL, ",")) {
+        char* value = strchr(option, '=');
 
-#ifdef Associative 
-    for (int i = 1; i < CACHE_SIZE; i++) {
-        
-        if (cache[i].age <= cache[oldest_index].age) {
+        if (value == NULL) return false;
+        *value++ = '\0';
+        if (!SetCacheOption(configs, option, value)) return false;
+    }
+    return true;
+}
 
-            oldest_index = i;
+/*
+*  purpose   : Function to set the options of a cache configuration from a file of "key = value" lines.
+*              Blank lines and lines starting with '#' are skipped.
+*  parameters: configs - Configuration of every level, changed
+*              file_name - Configuration file
+*  return    : true if the file was read and every option was valid
+*/
+bool ReadCacheConfig(CacheConfig configs[CACHE_LEVELS], const char* file_name) {
+    FILE* file = fopen(file_name, "r");
+    char line[CACHE_CONFIG_LINE];
+    int line_number = 0;
+    bool valid = true;
+
+    if (file == NULL) return false;
+
+    while (valid && fgets(line, CACHE_CONFIG_LINE, file) != NULL) {
+        char key[CACHE_CONFIG_LINE];
+        char value[CACHE_CONFIG_LINE];
+        int fields = sscanf(line, " %[^= \t\n] = %s", key, value);
+
+        line_number++;
+        if (fields < 1 || key[0] == '#') continue;
+        if (fields != 2 || !SetCacheOption(configs, key, value)) {
+            fprintf(stderr, "Error: invalid cache option on line %d of %s\n", line_number, file_name);
+            valid = false;
         }
     }
-#endif
-#ifdef  DIRCT
-    oldest_index = address % CACHE_SIZE;
-#endif 
+    fclose(file);
+    return valid;
+}
 
-#ifdef CacheUpdate
-    printf(RED "Cache Evicted: Address = 0x%04X, Content = 0x%02X\n" RESET, cache[oldest_index].address, cache[oldest_index].contents);
-#endif
+/*
+*  purpose   : Function to free the lines, policy, prefetcher and write buffer of one level, leaving it off
+*  parameters: level - Level released
+*  return    : None
+*/
+static void ReleaseLevel(CacheLevel* level) {
+    free(level->lines.tag);
+    free(level->lines.valid);
+    free(level->lines.dirty);
+    free(level->lines.data);
+    memset(&level->lines, 0, sizeof(level->lines));
+    ReleaseReplacement(&level->replacement);
+    ReleasePrefetch(&level->prefetch);
+    ReleaseWriteBuffer(&level->wbuffer);
+}
 
-#ifdef WRT_BACK
+/*
+*  purpose   : Function to allocate one empty level of a configuration
+*  parameters: level - Level allocated, zeroed
+*              config - Its configuration, CACHE_FULLY_ASSOCIATIVE ways becomes the number of lines
+*  return    : true if it could be allocated; on failure ReleaseLevel() frees what was
+*/
+static bool AllocateLevel(CacheLevel* level, const CacheConfig* config) {
+    int count;
+
+    level->config = *config;
+    if (config->size == CACHE_OFF) return true;
+    count = config->size / config->line_size;
+    if (level->config.ways == CACHE_FULLY_ASSOCIATIVE) level->config.ways = count;
+
+    return AllocateLines(&level->lines, count, config->line_size) &&
+        InitializeReplacement(&level->replacement, config->policy, config->seed, count / level->config.ways, level->config.ways) &&
+        InitializePrefetch(&level->prefetch, config->prefetcher, config->degree, config->distance, count, config->line_size) &&
+        InitializeWriteBuffer(&level->wbuffer, config->write_buffer, config->line_size);
+}
+
+/*
+*  purpose   : Function to give a machine's caches a new configuration. Dirty lines of the old
+*              configuration are written back first; the new levels start empty, with cleared
+*              statistics. Shadow tag arrays are dropped, since they had the old geometry.
+*  parameters: m - Machine whose caches are configured
+*              configs - New configuration of every level, CACHE_FULLY_ASSOCIATIVE ways becomes the number of lines
+*  return    : true if the configuration is valid and could be allocated, the old caches are kept otherwise
+*/
+bool ConfigureCache(Machine* m, const CacheConfig configs[CACHE_LEVELS]) {
+    CacheLevel levels[CACHE_LEVELS] = { 0 };
 
-     // If either the high byte or low byte of the dirty bit is set then we must write to memory to avoid brain damage 
-    if ( (cache[oldest_index].dirty_lo || cache[oldest_index].dirty_hi) && cache[oldest_index].valid) {
-        if (word_byte == WORD) {
-            Bus(cache[oldest_index].address, &cache[oldest_index].cache_line.word, WR, WORD);
-            cache[oldest_index].dirty_lo = false;
-            cache[oldest_index].dirty_hi = false;
+    if (CheckCacheConfig(configs) != NULL) return false;
 
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        if (!AllocateLevel(&levels[i], &configs[i])) {
+            do ReleaseLevel(&levels[i]); while (--i >= 0);
+            return false;
         }
-        else{
+    }
 
-           
-            if (address % 2 == 0) {
-                // If address is even, load high byte
-                Bus(address, &cache[oldest_index].cache_line.byte[1], WR, BYTE);
-                cache[oldest_index].dirty_hi = true;
+    FlushCache(m);
+    ReleaseCache(m);
+    ReleaseShadows(m);
+    memcpy(m->cache, levels, sizeof(levels));
+
+    // Both L1 caches miss into the L2 when it is there, otherwise into memory
+    for (int i = CACHE_L1I; i <= CACHE_L1D; i++)
+        m->cache[i].next = LEVEL_ENABLED(&m->cache[CACHE_L2]) ? &m->cache[CACHE_L2] : NULL;
+    m->fetch_level = LEVEL_ENABLED(&m->cache[CACHE_L1I]) ? &m->cache[CACHE_L1I] : NULL;
+    m->data_level = LEVEL_ENABLED(&m->cache[CACHE_L1D]) ? &m->cache[CACHE_L1D] :
+        LEVEL_ENABLED(&m->cache[CACHE_L2]) ? &m->cache[CACHE_L2] : NULL;
+    return true;
+}
 
-            }
-            else {
-                // If address is odd, load low byte
-                Bus(address, &cache[oldest_index].cache_line.byte[0], WR, BYTE);
-                cache[oldest_index].dirty_lo = true;
+/*
+*  purpose   : Function to free the lines of a machine's caches, leaving every level off
+*  parameters: m - Machine
+*  return    : None
+*/
+void ReleaseCache(Machine* m) {
+    for (int i = 0; i < CACHE_LEVELS; i++) ReleaseLevel(&m->cache[i]);
+    m->fetch_level = NULL;
+    m->data_level = NULL;
+}
 
-            }
-            cache[oldest_index].dirty_lo = false;
-            cache[oldest_index].dirty_hi = false;
+/*
+*  purpose   : Function to copy the contents of a level into another of the same geometry: lines,
+*              policy state, prefetcher, write buffer and counters
+*  parameters: to - Level overwritten
+*              from - Level copied
+*  return    : None
+*/
+static void CopyLevel(CacheLevel* to, const CacheLevel* from) {
+    int count;
+
+    to->config = from->config;
+    to->counters = from->counters;
+    if (!LEVEL_ENABLED(from)) return;
+    count = from->config.size / from->config.line_size;
+    memcpy(to->lines.tag, from->lines.tag, count * sizeof(unsigned short));
+    memcpy(to->lines.valid, from->lines.valid, BITMASK_WORDS(count) * sizeof(unsigned long long));
+    memcpy(to->lines.dirty, from->lines.dirty, BITMASK_WORDS(count) * sizeof(unsigned long long));
+    memcpy(to->lines.data, from->lines.data, from->config.size);
+    CopyReplacement(&to->replacement, &from->replacement);
+    CopyPrefetch(&to->prefetch, &from->prefetch, count, from->config.line_size);
+    CopyWriteBuffer(&to->wbuffer, &from->wbuffer);
+}
+
+/*
+*  purpose   : Function to keep a copy of a machine's caches (Snapshot.c)
+*  parameters: m - Machine whose caches are copied
+*              saved - Levels allocated with the same geometry and filled in, zeroed before
+*  return    : true if the copy could be allocated, saved is left released otherwise
+*/
+bool SaveCache(const Machine* m, CacheLevel saved[CACHE_LEVELS]) {
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        if (!AllocateLevel(&saved[i], &m->cache[i].config)) {
+            do ReleaseLevel(&saved[i]); while (--i >= 0);
+            return false;
         }
+        CopyLevel(&saved[i], &m->cache[i]);
     }
+    return true;
+}
 
+/*
+*  purpose   : Function to put back the caches kept by SaveCache()
+*  parameters: m - Machine whose caches are overwritten
+*              saved - Copy of its caches
+*  return    : true if they were put back, false if the caches were configured with another
+*              geometry since (they are left as they are)
+*/
+bool RestoreCache(Machine* m, const CacheLevel saved[CACHE_LEVELS]) {
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        const CacheConfig* now = &m->cache[i].config;
+        const CacheConfig* then = &saved[i].config;
+
+        if (now->size != then->size || now->line_size != then->line_size || now->ways != then->ways || now->policy != then->policy
+            || now->prefetcher != then->prefetcher || now->degree != then->degree || now->write_buffer != then->write_buffer)
+            return false;
+    }
+    for (int i = 0; i < CACHE_LEVELS; i++) CopyLevel(&m->cache[i], &saved[i]);
+    return true;
+}
 
-#endif
-
+/*
+*  purpose   : Function to free a copy made by SaveCache()
+*  parameters: saved - Copy of the caches
+*  return    : None
+*/
+void ReleaseSavedCache(CacheLevel saved[CACHE_LEVELS]) {
+    for (int i = 0; i < CACHE_LEVELS; i++) ReleaseLevel(&saved[i]);
+}
 
-        cache[oldest_index].address = address;
-        cache[oldest_index].valid = true; 
-    if (word_byte == WORD) {
-        cache[oldest_index].cache_line.word = content;
+/*
+*  purpose   : Function to initialize the caches
+*              Empties every line and write buffer of every level and resets the state of the
+*              replacement policies and prefetchers.
+*  parameters: None
+*  return    : None
+*/
+void InitializeCache(Machine* m) {
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        CacheLevel* level = &m->cache[i];
+        int count;
+
+        if (!LEVEL_ENABLED(level)) continue;
+        count = level->config.size / level->config.line_size;
+        memset(level->lines.tag, 0, count * sizeof(unsigned short));
+        memset(level->lines.valid, 0, BITMASK_WORDS(count) * sizeof(unsigned long long));
+        memset(level->lines.dirty, 0, BITMASK_WORDS(count) * sizeof(unsigned long long));
+        memset(level->lines.data, 0, level->config.size);
+        ResetReplacement(&level->replacement);
+        ResetPrefetch(&level->prefetch, count);
+        ResetWriteBuffer(&level->wbuffer);
+    }
+}
 
+/*
+*  purpose   : Function to count a hit or miss of a level
+*  parameters: level - Level accessed
+*              read_write - R or WR
+*              hit - true if the line was found
+*  return    : None
+*/
+static void CountAccess(CacheLevel* level, int read_write, bool hit) {
+    CacheCounters* counters = &level->counters;
 
+    if (read_write == R) {
+        if (hit) counters->read_hits++;
+        else counters->read_misses++;
+    }
+    else if (hit) counters->write_hits++;
+    else counters->write_misses++;
+}
 
+/*
+*  purpose   : Function to read or write bytes of one line of a lower level (the L2) for the level above it.
+*              Costs L2_ACCESS_CYCLES plus one per further word, and whatever a miss costs below.
+*  parameters: level - Level accessed
+*              address - Address of the first byte
+*              data - Bytes read or written
+*              length - Number of bytes, within one line of the level
+*              read_write - R or WR
+*  return    : None
+*/
+static void LevelTransfer(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data,
+    unsigned int length, int read_write) {
+    unsigned int line_size = level->config.line_size;
+    int index = FindInCache(level, address);
+    unsigned char* line;
+
+    m->cpu_clock += L2_ACCESS_CYCLES + (length + 1) / 2 - 1;
+    CountAccess(level, read_write, index != -1);
+    if (index != -1) ReplacementHit(&level->replacement, index);
+    else {
+        if (read_write == WR && !level->config.write_allocate) {
+            WriteBelow(m, level, address, data, length);
+            return;
+        }
+        // A whole line written from above is not read first
+        index = UpdateCache(m, level, address, read_write == R || length != line_size);
     }
+
+    line = &level->lines.data[index * line_size + (address & (line_size - 1))];
+    if (read_write == R) memcpy(data, line, length);
     else {
-        if (address % 2 == 0) {
-            // If address is even, load high byte
-            cache[oldest_index].cache_line.byte[1] = content >> 8;
+        memcpy(line, data, length);
+        if (level->config.write_back) SET_LINE_BIT(level->lines.dirty, index);
+        else WriteBelow(m, level, address, data, length);
+    }
+}
+
+/*
+*  purpose   : Function to move bytes from the level below a cache level (the next level or memory)
+*  parameters: level - Level the bytes are for
+*              address - Address of the first byte
+*              data - Bytes read
+*              length - Number of bytes, a line of the level
+*  return    : None
+*/
+void ReadBelow(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length) {
+    if (level->next == NULL) BusBurst(m, address, data, length, R);
+    else LevelTransfer(m, level->next, address, data, length, R);
+}
+
+/*
+*  purpose   : Function to move bytes to the level below a cache level (the next level or memory)
+*  parameters: level - Level the bytes come from
+*              address - Address of the first byte, even unless length is 1
+*              data - Bytes written
+*              length - Number of bytes: a line, a word or a byte
+*  return    : None
+*/
+void WriteBelow(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length) {
+    if (level->next != NULL) LevelTransfer(m, level->next, address, data, length, WR);
+    else if (length == 1) {
+        unsigned short byte = *data;
+
+        Bus(m, address, &byte, WR, BYTE);
+    }
+    else BusBurst(m, address, data, length, WR);
+}
+
+/*
+*  purpose   : Function to send a store of the data cache down, through its write buffer when it has one
+*  parameters: level - Level the store comes from
+*              address - Address of the first byte, even unless length is 1
+*              data - Bytes stored
+*              length - Number of bytes, a word or a byte
+*  return    : None
+*/
+static void StoreBelow(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length) {
+    if (BUFFERING(level)) BufferStore(m, level, address, data, length);
+    else WriteBelow(m, level, address, data, length);
+}
+
+/*
+*  purpose   : Function to write every dirty line back, the lines stay valid.
+*              The L1 caches are flushed into the L2 before the L2 is flushed to memory.
+*  parameters: m - Machine whose caches are flushed
+*  return    : None
+*/
+void FlushCache(Machine* m) {
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        CacheLevel* level = &m->cache[i];
+        unsigned int line_size = level->config.line_size;
+        int count;
+
+        if (!LEVEL_ENABLED(level)) continue;
+        count = level->config.size / line_size;
+        for (int line = 0; line < count; line++) {
+            if (LINE_BIT(level->lines.valid, line) && LINE_BIT(level->lines.dirty, line)) {
+                CLEAR_LINE_BIT(level->lines.dirty, line);
+                WriteBelow(m, level, level->lines.tag[line], &level->lines.data[line * line_size], line_size);
+            }
         }
-        else {
-            // If address is odd, load low byte
-            cache[oldest_index].cache_line.byte[0] = content & 0xFF; 
+    }
+}
+
+/*
+*  purpose   : Function to write back the dirty lines holding any byte of an address range, the
+*              lines stay valid. Done in the background: the CPU clock does not move.
+*  parameters: m - Machine whose caches are cleaned
+*              address - First address of the range
+*              length - Number of bytes, the range does not wrap past the last address
+*  return    : None
+*/
+void CleanCacheRange(Machine* m, unsigned int address, unsigned int length) {
+    unsigned long long start = m->cpu_clock;
+
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        CacheLevel* level = &m->cache[i];
+        unsigned int line_size = level->config.line_size;
+
+        if (!LEVEL_ENABLED(level)) continue;
+        for (unsigned int base = address & ~(line_size - 1); base < address + length; base += line_size) {
+            int line = FindInCache(level, (unsigned short)base);
+
+            if (line < 0 || !LINE_BIT(level->lines.dirty, line)) continue;
+            CLEAR_LINE_BIT(level->lines.dirty, line);
+            WriteBelow(m, level, (unsigned short)base, &level->lines.data[line * line_size], line_size);
         }
     }
-#ifdef CacheUpdate
-    printf("Cache Updated Completed: Address = 0x%04X, Content = 0x%02X\n", cache[oldest_index].address, cache[oldest_index].contents);
-#endif
+    m->cpu_clock = start;
+}
 
-    DecrementAllExcept(oldest_index);
+/*
+*  purpose   : Function to drop the lines holding any byte of an address range from every level,
+*              after writing back the dirty ones, along with the copies of those lines in stream
+*              buffers and write buffers. Used when memory is changed without going through the
+*              caches. Done in the background: the CPU clock does not move.
+*  parameters: m - Machine whose caches are invalidated
+*              address - First address of the range
+*              length - Number of bytes, the range does not wrap past the last address
+*  return    : Number of lines dropped
+*/
+int InvalidateCacheRange(Machine* m, unsigned int address, unsigned int length) {
+    unsigned long long start = m->cpu_clock;
+    int dropped = 0;
+
+    for (int i = 0; i < CACHE_LEVELS; i++) {
+        CacheLevel* level = &m->cache[i];
+        unsigned int line_size = level->config.line_size;
+
+        if (!LEVEL_ENABLED(level)) continue;
+        for (unsigned int base = address & ~(line_size - 1); base < address + length; base += line_size) {
+            int line = FindInCache(level, (unsigned short)base);
+
+            if (level->prefetch.kind == PREFETCH_STREAM) StreamInvalidate(level, (unsigned short)base);
+            if (BUFFERING(level)) BufferInvalidate(&level->wbuffer, (unsigned short)base);
+            if (line < 0) continue;
+            if (LINE_BIT(level->lines.dirty, line))
+                WriteBelow(m, level, (unsigned short)base, &level->lines.data[line * line_size], line_size);
+            if (PREFETCHING(level)) CLEAR_LINE_BIT(level->prefetch.prefetched, line);
+            CLEAR_LINE_BIT(level->lines.valid, line);
+            CLEAR_LINE_BIT(level->lines.dirty, line);
+            dropped++;
+        }
+    }
+    m->cpu_clock = start;
+    return dropped;
+}
 
-    return oldest_index;
+/*
+*  purpose   :   Function to find the set an address maps to in a level
+*  parameters : level - Level accessed
+*               address - Address being accessed
+*  return    :  Set of the address, its lines are the ways lines from set * ways
+*/
+int CacheSet(const CacheLevel* level, unsigned short address) {
+    return (address / level->config.line_size) & (level->replacement.sets - 1);
 }
 
+#ifdef CACHE_SIMD
+/*
+*  purpose   : Function to compare 8 tags with a tag (SSE2)
+*  parameters: tags - First of the 8 tags
+*              tag - Tag looked for
+*  return    : One bit per tag, set where the tags are equal
+*/
+static unsigned int MatchTags8(const unsigned short* tags, unsigned short tag) {
+    __m128i equal = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)tags), _mm_set1_epi16((short)tag));
+
+    // Narrow the 16-bit results to one byte per tag, then one bit per tag
+    return _mm_movemask_epi8(_mm_packs_epi16(equal, _mm_setzero_si128()));
+}
 
 /*
-*  purpose   : Function to print the current state of the cache
-*              Loop over all cache lines, Print the cache line, address, and age of each cache line
-*  parameters: None
-*  return    : None
+*  purpose   : Function to compare 16 tags with a tag, in one instruction with AVX2
+*  parameters: tags - First of the 16 tags
+*              tag - Tag looked for
+*  return    : One bit per tag, set where the tags are equal
 */
+static unsigned int MatchTags16(const unsigned short* tags, unsigned short tag) {
+#ifdef __AVX2__
+    __m256i equal = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)tags), _mm256_set1_epi16((short)tag));
 
-void PrintCache() {
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        printf(" |CACHE LINE %2d", i);
-        printf(" | Address: 0x%04X ", cache[i].address);
-        printf(" | Contents: 0x%4X ", cache[i].cache_line.word);
-        printf(" | Age: %02d ", cache[i].age);
-        printf(" | Word/Byte: %02d ", cache[i].word_byte);
-        printf(" | DL: %s |", cache[i].dirty_lo ? "1" : "0");
-        printf(" | DH: %s |\n", cache[i].dirty_hi ? "1" : "0");
+    return _mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(equal), _mm256_extracti128_si256(equal, 1)));
+#else
+    __m128i key = _mm_set1_epi16((short)tag);
+    __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)tags), key);
+    __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)&tags[8]), key);
+
+    return _mm_movemask_epi8(_mm_packs_epi16(low, high));
+#endif
+}
+#endif
+
+/*
+*  Purpose   : Searches the tags of one set for a valid line with the given tag. With CACHE_SIMD, sets of
+*              8 ways or more compare 8 tags (SSE2) or 16 tags (AVX2) per instruction; smaller sets and
+*              CACHE_SCALAR builds compare one tag at a time.
+*
+*  Parameters:
+*              tags - Tag of every line
+*              valid - Valid bit of every line
+*              first - First line of the set, a multiple of ways
+*              ways - Lines in the set, a power of two
+*              tag - Address of the first byte of the line looked for
+*
+*  Return    : Returns the index of the line. If no valid line has the tag, returns -1.
+*/
+int FindTag(const unsigned short* tags, const unsigned long long* valid, int first, int ways, unsigned short tag) {
+#ifdef CACHE_SIMD
+    if (ways >= 8) {
+        // Large sets are compared 32 tags per step; the valid bits are only read once a tag matches
+        int step = (ways >= 32) ? 32 : ways;
+
+        for (int i = first; i < first + ways; i += step) {
+            unsigned int match = (step == 8) ? MatchTags8(&tags[i], tag) : MatchTags16(&tags[i], tag);
+
+            if (step == 32) match |= MatchTags16(&tags[i + 16], tag) << 16;
+            if (match == 0) continue;
+            match &= (unsigned int)(valid[i / CACHE_BITS_WORD] >> (i % CACHE_BITS_WORD));
+            if (match != 0) return i + LowestBit(match);
+        }
+        return -1;
     }
+#endif
+    for (int i = first; i < first + ways; i++) {
+        // Check if address matches and cache line is valid
+        if (tags[i] == tag && LINE_BIT(valid, i)) {
+            return i;
+        }
+    }
+    return -1;  // Return -1 if address is not found in cache
 }
 
+/*
+*  Purpose   : Searches through the lines of the set the address maps to. If a valid line holds the address, its index is returned.
+*              If the address is not found, the function returns -1.
+*
+*  Parameters:
+*              level - The level searched.
+*              address - The address to be located in the cache.
+*
+*  Return    : Returns the index of the line holding the address. If the address is not found, returns -1.
+*/
+int FindInCache(const CacheLevel* level, unsigned short address) {
+    int ways = level->config.ways;
+
+    return FindTag(level->lines.tag, level->lines.valid, CacheSet(level, address) * ways, ways, address & ~(level->config.line_size - 1));
+}
 
 /*
-*  purpose   : Function to manage the cache read and write operations.
-*              This function handles the logic of read/write operations in cache, including miss/hit situations,
-*              with different behaviors for Write-through (1) and Write-back (0) methods.
-*              In Write-through, it simultaneously writes into cache and main memory.
-*              In Write-back, it delays the main memory write operation until the CACHE line is evicted.
-*              If a cache miss occurs (when the cache does not contain the requested data),
-*              the function calls the appropriate UpdateCache().
-*              In case of a cache hit (when the requested data is found in cache),
-*              it directly manipulates the cache contents (if its a write) and calls DecrementAllExcept() function in both cases
-*  
-*  parameters: address - The memory address to be read/written
-*              content - Pointer to the content to be written or where the read content should be stored
-*              read_write - Symbol to determine if the operation is a read (R) or write (WR)
-*              word_byte - Symbol to determine if the operation is on a word or byte (WORD/BYTE)
+*  purpose    : Function to load the line holding an address into a level
+*                   Replaces the line of the address's set picked by the replacement policy.
+*                   A dirty victim is written back to the level below first, then the new line is
+*                   read from below, each in one burst.
 *
-*  return    : None
+*  parameters : level - Level the line is loaded into
+*                   address - Any address of the new line
+*                   fill - false when the line is about to be overwritten whole, so it is not read
+*
+*  return     :  Returns the index of the cache line that was updated
 */
+int UpdateCache(Machine* m, CacheLevel* level, unsigned short address, bool fill) {
+    unsigned int line_size = level->config.line_size;
+    unsigned short base = address & ~(line_size - 1);
+    int victim = ReplacementVictim(&level->replacement, CacheSet(level, address));
+    unsigned char* data = &level->lines.data[victim * line_size];
 
+#ifdef CacheUpdate
+    printf("Cache Update Request: Address = 0x%04X, Evicted = 0x%04X\n", base, level->lines.tag[victim]);
+#endif
 
+    if (LINE_BIT(level->lines.valid, victim)) level->counters.evictions++;
+    if (PREFETCHING(level) && LINE_BIT(level->prefetch.prefetched, victim)) {
+        // Evicted before its first use
+        level->counters.useless_prefetches++;
+        CLEAR_LINE_BIT(level->prefetch.prefetched, victim);
+    }
+    if (LINE_BIT(level->lines.valid, victim) && LINE_BIT(level->lines.dirty, victim)) {
+        level->counters.writebacks++;
+        WriteBelow(m, level, level->lines.tag[victim], data, line_size);
+    }
+    if (fill) ReadBelow(m, level, base, data, line_size);
 
-void Cache(unsigned short address, unsigned short* content,
-    unsigned char read_write, unsigned char word_byte) {
+    level->lines.tag[victim] = base;
+    CLEAR_LINE_BIT(level->lines.dirty, victim);
+    SET_LINE_BIT(level->lines.valid, victim);
+    ReplacementFill(&level->replacement, victim);
 
+    return victim;
+}
 
-    int found_index;
-    found_index = FindInCache(address);
+/*
+*  purpose   : Function to give the cycles of moving one line of a level to or from the level
+*              below it, at worst: every level below misses and writes back a dirty line
+*  parameters: level - Level whose line is moved
+*  return    : Cycles
+*/
+static unsigned long LineMoveCycles(const CacheLevel* level) {
+    unsigned long words = level->config.line_size / 2;
 
-    if (read_write == R) {
-        
-        if (found_index == -1) {
-            // Read  A Word from bus 
-            if (word_byte == WORD ) Bus(address, content, R, WORD);
-            else Bus(address, content, R, WORD);
-            UpdateCache(address, *content, word_byte);
-        }
-        
-        else DecrementAllExcept(found_index);
+    if (level->next == NULL) return BUS_CYCLES + words - 1;
+    return L2_ACCESS_CYCLES + words - 1 + 2 * LineMoveCycles(level->next);
+}
 
-        found_index = FindInCache(address);
-        if (found_index == -1) {
-            printf(RED "\nError oopsi: CACHE LINE INCORRECTLY SET \n"RESET);
-            return 0;
-        }
-        cache[found_index].valid = true;
-        DecrementAllExcept(found_index);
-        // Trust me Im an Engineer 
-        *content = cache[found_index].cache_line.word;
+/*
+*  purpose   : Function to give the most cycles one access to a level can cost. A miss moves at most
+*              two lines: a dirty victim and the new line, or the new line and a write-through store.
+*  parameters: level - Level accessed, NULL for memory
+*  return    : Cycles
+*/
+unsigned long WorstAccessCycles(const CacheLevel* level) {
+    if (level == NULL) return BUS_CYCLES;
+    return 2 * LineMoveCycles(level);
+}
 
-        printf("CACHE READ  %s  AT ADDRESS %04X FILLED WITH %04X \n", word_byte ? "BYTE" : "WORD", cache[found_index].address, cache[found_index].cache_line.word);
+/*
+*  purpose   : Function to look an instruction fetch up in the L1 instruction cache, loading its line
+*              on a miss. The instruction word itself is read by Fetch(); the instruction cache only
+*              decides what the fetch costs. Its lines are never written, so never dirty.
+*              A miss is counted against the instruction's address. A prefetcher of the level is
+*              trained on every fetch.
+*  parameters: m - Machine with an L1 instruction cache (m->fetch_level)
+*              address - Address of the instruction
+*  return    : None
+*/
+void InstructionFetch(Machine* m, unsigned short address) {
+    CacheLevel* level = m->fetch_level;
+    int index = FindInCache(level, address);
+    int event = PREFETCH_HIT;
+
+    CountAccess(level, R, index != -1);
+    level->counters.word_accesses++;
+    if (index != -1) {
+        ReplacementHit(&level->replacement, index);
+        if (PREFETCHING(level) && PrefetchHit(m, level, index)) event = PREFETCH_USED;
     }
     else {
-    
+        SNAPSHOT_WRITE(m, SNAPSHOT_FETCH_MISSES, address);
+        m->fetch_misses[address >> 1]++;
+        if (PREFETCHING(level)) index = StreamFill(m, level, address);
+        if (index != -1) event = PREFETCH_USED;
+        else {
+            event = PREFETCH_MISS;
+            UpdateCache(m, level, address, true);
+        }
+    }
+    if (PREFETCHING(level)) Prefetch(m, level, address, address, R, event);
+}
+
+/*
+*  purpose   : Function to find the instruction addresses with the most cache misses, fetch and data
+*              misses added up. Ties go to the lower address.
+*  parameters: m - Machine
+*              table - Filled with the addresses, most misses first
+*  return    : Number of entries filled, fewer than MISS_TABLE_SIZE when fewer addresses missed
+*/
+int TopMisses(const Machine* m, MissEntry table[MISS_TABLE_SIZE]) {
+    int count = 0;
+
+    for (int word = 0; word < WORD_MEM_SIZE; word++) {
+        unsigned long misses = (unsigned long)m->fetch_misses[word] + m->data_misses[word];
+        int slot = count;
+
+        if (misses == 0) continue;
+        // Insertion into the sorted table, an address missing less than the last entry is dropped
+        while (slot > 0 && (unsigned long)table[slot - 1].fetch + table[slot - 1].data < misses) slot--;
+        if (slot == MISS_TABLE_SIZE) continue;
+        if (count < MISS_TABLE_SIZE) count++;
+        memmove(&table[slot + 1], &table[slot], (count - 1 - slot) * sizeof(MissEntry));
+        table[slot].address = (unsigned short)(word << 1);
+        table[slot].fetch = m->fetch_misses[word];
+        table[slot].data = m->data_misses[word];
+    }
+    return count;
+}
 
-#ifdef WRT_THRO
 
-        if (found_index == -1) { // MISS ME
-            Bus(address, content, WR, (word_byte == WORD) ? WORD : BYTE);
-            UpdateCache(address, *content, word_byte);
+/*
+*  purpose   : Function to print the configuration, counters and valid lines of every cache level,
+*              then the instruction addresses with the most misses
+*              Prints the address, set, replacement rank, dirty bit and words of each line
+*  parameters: None
+*  return    : None
+*/
+
+void PrintCache(Machine* m) {
+    for (int level_id = 0; level_id < CACHE_LEVELS; level_id++) {
+        const CacheLevel* level = &m->cache[level_id];
+        const CacheConfig* config = &level->config;
+        int count;
+
+        if (!LEVEL_ENABLED(level)) continue;
+        count = config->size / config->line_size;
+        printf(" Cache %s: %u bytes, %u-byte lines, %u-way, write-%s, %s, %s replacement\n", CacheLevelNames[level_id],
+            config->size, config->line_size, config->ways, config->write_back ? "back" : "through",
+            config->write_allocate ? "write-allocate" : "no-write-allocate", ReplacementPolicies[config->policy].name);
+        printf(" Reads: %lu hits, %lu misses | Writes: %lu hits, %lu misses | Evictions: %lu | Write backs: %lu | Byte: %lu Word: %lu\n",
+            level->counters.read_hits, level->counters.read_misses, level->counters.write_hits, level->counters.write_misses,
+            level->counters.evictions, level->counters.writebacks, level->counters.byte_accesses, level->counters.word_accesses);
+        if (PREFETCHING(level)) {
+            printf(" Prefetch %s, degree %u, distance %u: %lu prefetches | Useful: %lu | Late: %lu | Useless: %lu\n",
+                PrefetcherNames[config->prefetcher], config->degree, config->distance, level->counters.prefetches,
+                level->counters.useful_prefetches, level->counters.late_prefetches, level->counters.useless_prefetches);
         }
-       
-        else { // HIT me 
-            if (word_byte == WORD) { 
-                Bus(address, content, WR, WORD);
-                cache[found_index].cache_line.word = *content;
+        if (BUFFERING(level)) {
+            const CacheCounters* counters = &level->counters;
+
+            printf(" Write buffer, %u entries: %lu stores | Combined: %lu | Forwarded loads: %lu | Stalls: %lu (%lu cycles) | Occupancy: %.2f mean, %lu max\n",
+                config->write_buffer, counters->buffered_stores, counters->combined_stores, counters->forwarded_loads,
+                counters->buffer_stalls, counters->buffer_stall_cycles,
+                counters->buffered_stores ? (double)counters->buffer_occupancy / counters->buffered_stores : 0.0,
+                counters->max_buffer_occupancy);
+        }
+        for (int i = 0; i < count; i++) {
+            unsigned short word;
+
+            if (!LINE_BIT(level->lines.valid, i)) continue;
+            printf(" |CACHE LINE %4d SET %4d", i, i / config->ways);
+            printf(" | Address: 0x%04X ", level->lines.tag[i]);
+            printf(" | Rank: %02d ", ReplacementRank(&level->replacement, i));
+            printf(" | D: %s | Contents:", LINE_BIT(level->lines.dirty, i) ? "1" : "0");
+            for (unsigned int offset = 0; offset < config->line_size; offset += 2) {
+                memcpy(&word, &level->lines.data[i * config->line_size + offset], sizeof(word));
+                printf(" %04X", word);
             }
+            printf("\n");
+        }
+    }
 
-            else {
+    MissEntry table[MISS_TABLE_SIZE];
+    int count = TopMisses(m, table);
 
-                if (address % 2 == 0) {
-                    // If address is even, load high byte
-                    Bus(address, &cache[found_index].cache_line.byte[HI], WR, BYTE);
-                    cache[found_index].cache_line.byte[HI] = *content;
-                }
-                else {
-                    // If address is odd, load low byte
-                    Bus(address, &cache[found_index].cache_line.byte[HI], WR, BYTE);
-                    cache[found_index].cache_line.byte[HI] = *content;
-                }
-            }
+    if (count > 0) printf(" Most misses:   PC  | Fetch | Data\n");
+    for (int i = 0; i < count; i++) printf("              %04X | %5u | %5u\n", table[i].address, table[i].fetch, table[i].data);
+}
+
+/*
+*  purpose   : Function to write the counters of every cache level and the miss table as key=value lines
+*  parameters: out - File written to
+*              m - Machine
+*  return    : None
+*/
+void DumpCacheCounters(FILE* out, Machine* m) {
+    MissEntry table[MISS_TABLE_SIZE];
+    int count = TopMisses(m, table);
+
+    for (int level_id = 0; level_id < CACHE_LEVELS; level_id++) {
+        const CacheCounters* counters = &m->cache[level_id].counters;
+        const char* name = CacheLevelNames[level_id];
+
+        if (!LEVEL_ENABLED(&m->cache[level_id])) continue;
+        fprintf(out, "%s.hits=%lu\n%s.misses=%lu\n", name, CACHE_HITS(*counters), name, CACHE_MISSES(*counters));
+        fprintf(out, "%s.read_hits=%lu\n%s.read_misses=%lu\n", name, counters->read_hits, name, counters->read_misses);
+        fprintf(out, "%s.write_hits=%lu\n%s.write_misses=%lu\n", name, counters->write_hits, name, counters->write_misses);
+        fprintf(out, "%s.evictions=%lu\n%s.writebacks=%lu\n", name, counters->evictions, name, counters->writebacks);
+        fprintf(out, "%s.byte_accesses=%lu\n%s.word_accesses=%lu\n", name, counters->byte_accesses, name, counters->word_accesses);
+        if (PREFETCHING(&m->cache[level_id])) {
+            fprintf(out, "%s.prefetches=%lu\n%s.useful_prefetches=%lu\n", name, counters->prefetches, name, counters->useful_prefetches);
+            fprintf(out, "%s.late_prefetches=%lu\n%s.useless_prefetches=%lu\n", name, counters->late_prefetches, name, counters->useless_prefetches);
         }
-        found_index = FindInCache(address);
-        if (found_index == -1) {
-            printf(RED "\nError: CACHE LINE INCORRECTLY Read at address %04x filled with %04x \n"RESET, address, *content);
-            return 0;
+        if (BUFFERING(&m->cache[level_id])) {
+            fprintf(out, "%s.buffered_stores=%lu\n%s.combined_stores=%lu\n", name, counters->buffered_stores, name, counters->combined_stores);
+            fprintf(out, "%s.forwarded_loads=%lu\n%s.buffer_stalls=%lu\n", name, counters->forwarded_loads, name, counters->buffer_stalls);
+            fprintf(out, "%s.buffer_stall_cycles=%lu\n%s.buffer_occupancy=%lu\n", name, counters->buffer_stall_cycles, name, counters->buffer_occupancy);
+            fprintf(out, "%s.max_buffer_occupancy=%lu\n", name, counters->max_buffer_occupancy);
         }
-        DecrementAllExcept(found_index);
-#endif
+    }
+    for (int i = 0; i < count; i++)
+        fprintf(out, "miss.%d.pc=%04X\nmiss.%d.fetch=%u\nmiss.%d.data=%u\n", i, table[i].address, i, table[i].fetch, i, table[i].data);
+}
 
 
-#ifdef WRT_BACK
-        if (found_index == -1) { // MISS ME
-            UpdateCache(address, *content, word_byte);
-            found_index = FindInCache(address);
-            if (word_byte == WORD) { 
-                cache[found_index].dirty_hi = true;
-                cache[found_index].dirty_lo = true;
-            }
-            else {
-                if (address % 2 == 0) {
-                    // If address is even, load high byte
-                    cache[found_index].dirty_hi = true;
-                }
-                else {
-                    // If address is odd, load low byte
-                    cache[found_index].dirty_lo = true;
-                }
-            }
-        }
+/*
+*  purpose   : Function to manage the cache read and write operations of loads and stores.
+*              This function handles the logic of read/write operations in the data cache (the L1
+*              data cache, or the L2 when there is none), including miss/hit situations,
+*              with different behaviors for Write-through and Write-back.
+*              In Write-through, it simultaneously writes into cache and the level below.
+*              In Write-back, it delays the write to the level below until the CACHE line is evicted.
+*              If a cache miss occurs (when the cache does not contain the requested data),
+*              the function calls UpdateCache() to load the line, except for a store without write allocation,
+*              which goes straight to the level below.
+*              In case of a cache hit (when the requested data is found in cache),
+*              it tells the replacement policy about the hit.
+*              With no data cache at all, the access goes to the Bus.
+*              Reads give the same value Bus() would: a word from the even address, a byte zero extended.
+*              Shadow tag arrays, when enabled, see the same access, and so does the trace, when one
+*              is recorded, whether or not there is a cache. A miss is counted against the
+*              instruction making the access, the one before the PC. A prefetcher of the level is
+*              trained on the access once it is done; a miss may be served by its stream buffers.
+*              Stores sent down drain through the write buffer of the level when it has one, and a
+*              load that misses may be answered from it.
+*
+*  parameters: m - Machine whose cache and memory are accessed
+*              address - The memory address to be read/written
+*              content - Pointer to the content to be written or where the read content should be stored
+*              read_write - Symbol to determine if the operation is a read (R) or write (WR)
+*              word_byte - Symbol to determine if the operation is on a word or byte (WORD/BYTE)
+*
+*  return    : None
+*/
+
+void Cache(Machine* m, unsigned short address, unsigned short* content,
+    unsigned char read_write, unsigned char word_byte) {
 
-        else { // HIT me 
-            DecrementAllExcept(found_index);
-            found_index = FindInCache(address);
+    CacheLevel* level = m->data_level;
+    unsigned int line_size;
+    int found_index;
+    int event = PREFETCH_HIT;
+    unsigned char* data;
+    unsigned char byte;
+
+    if (m->trace != NULL) m->trace(m->trace_context, (read_write == R) ? TRACE_READ : TRACE_WRITE, address);
+    if (level == NULL) {
+        Bus(m, address, content, read_write, word_byte);
+        return;
+    }
+    line_size = level->config.line_size;
+    found_index = FindInCache(level, address);
 
-            if (word_byte == WORD) { // if we need to write a word
-                cache[found_index].cache_line.word = *content;
-                found_index = FindInCache(address);
-                cache[found_index].dirty_hi = true;
-                cache[found_index].dirty_lo = true;
+    if (m->shadows != NULL) ShadowAccess(m, address);
+    // Any store to an instruction word must be decoded again, wherever in the hierarchy it stays
+    if (read_write == WR) InvalidateDecoded(m, address);
 
-            }
+    CountAccess(level, read_write, found_index != -1);
+    if (word_byte == BYTE) level->counters.byte_accesses++;
+    else level->counters.word_accesses++;
+
+    if (found_index != -1) {
+        ReplacementHit(&level->replacement, found_index);
+        if (PREFETCHING(level) && PrefetchHit(m, level, found_index)) event = PREFETCH_USED;
+    }
+    else {
+        SNAPSHOT_WRITE(m, SNAPSHOT_DATA_MISSES, (unsigned short)(PC - 2));
+        m->data_misses[(unsigned short)(PC - 2) >> 1]++;
+        event = PREFETCH_MISS;
+        if (read_write == WR && !level->config.write_allocate) {
+            // No write allocation, the store goes around the cache
+            if (word_byte == WORD) StoreBelow(m, level, address & ~1, (unsigned char*)content, sizeof(*content));
             else {
-                if (address % 2 == 0) {
-                    // If address is even, load high byte
-                    cache[found_index].cache_line.byte[1] = *content;
-                    cache[found_index].dirty_hi = true;
-                }
-                else {
-                    // If address is odd, load low byte
-                    cache[found_index].cache_line.byte[0] = *content;
-                    cache[found_index].dirty_lo = true;
-                }
+                byte = (unsigned char)(*content & 0xFF);
+                StoreBelow(m, level, address, &byte, 1);
             }
-            
-
+            if (PREFETCHING(level)) Prefetch(m, level, (unsigned short)(PC - 2), address, read_write, event);
+            return;
         }
-        if (found_index == -1) {
-            printf(RED "\nError big oppssie: WE WROTE TO CACHE LINE  -1 !! trying to Write address %04X with content %04X\n"RESET, address, *content);
-            return 0;
+        if (read_write == R && BUFFERING(level) && BufferForward(m, level, address, content, word_byte)) {
+            // A store waiting in the write buffer holds the value, the load does not go down
+            if (PREFETCHING(level)) Prefetch(m, level, (unsigned short)(PC - 2), address, read_write, event);
+            return;
         }
-        
-#endif
-
+        if (PREFETCHING(level)) found_index = StreamFill(m, level, address);
+        if (found_index != -1) event = PREFETCH_USED;
+        // A word stored to a one-word line overwrites all of it, so the line is not read first
+        else found_index = UpdateCache(m, level, address, read_write == R || word_byte == BYTE || line_size > 2);
     }
-}
-
 
+    data = &level->lines.data[found_index * line_size + (address & (line_size - 1))];
+    if (read_write == R) {
+        if (word_byte == WORD) memcpy(content, data - (address & 1), sizeof(*content));
+        else *content = *data;
 
+#ifdef CacheDebug
+        printf("CACHE READ  %s  AT ADDRESS %04X FILLED WITH %04X \n", word_byte ? "BYTE" : "WORD", address, *content);
+#endif
+    }
+    else {
+        if (word_byte == WORD) memcpy(data - (address & 1), content, sizeof(*content));
+        else *data = (unsigned char)(*content & 0xFF);
 
+        if (level->config.write_back) SET_LINE_BIT(level->lines.dirty, found_index);
+        else if (word_byte == WORD) StoreBelow(m, level, address & ~1, data - (address & 1), sizeof(*content));
+        else StoreBelow(m, level, address, data, 1);
+    }
+    if (PREFETCHING(level)) Prefetch(m, level, (unsigned short)(PC - 2), address, read_write, event);
+}
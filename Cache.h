@@ -1,38 +1,158 @@
 /*
 * This is the header file for the cache memory system.
-* It defines the constants for memory size, cache size and maximum age.
-* It also defines the CacheLine struct and declares the functions used in the cache memory system.
+* The memory hierarchy has an L1 instruction cache, an L1 data cache and a unified L2 behind them.
+* It defines the memory size and the cache levels. The geometry (size, line size, associativity),
+* write policy and replacement policy of each level are set at run time with a CacheConfig.
+* It also defines the CacheLines struct, the lines as a structure of arrays so a tag search only
+* reads the tags and valid bits, and declares the functions used in the cache memory system.
+* Replacement policies are in Replacement.h, prefetchers in Prefetch.h, write buffers in WriteBuffer.h.
 */
+#include <stdio.h>
 #include <stdbool.h>
+#include "Replacement.h"
+#include "Prefetch.h"
+#include "WriteBuffer.h"
 
 #ifndef CACHE_H  
 #define CACHE_H
 
+// Defining constants
+#define MEM_SIZE 0x10000  // Size of the memory
+#define CACHE_SIZE 64  // Default size of the L1 data cache (bytes of data)
+#define CACHE_LINE_SIZE 2  // Default bytes per line of the L1 data cache, one word
+#define CACHE_WAYS 1  // Default lines per set of the L1 data cache: 1 is direct mapped
+#define L1I_LINE_SIZE 16  // Default bytes per line of the L1 instruction cache, off unless given a size
+#define L1I_WAYS 2  // Default lines per set of the L1 instruction cache
+#define L2_LINE_SIZE 32  // Default bytes per line of the L2, off unless given a size
+#define L2_WAYS 8  // Default lines per set of the L2
+#define CACHE_OFF 0  // Size of a level that is not there
+#define CACHE_FULLY_ASSOCIATIVE 0  // Ways of a cache with a single set
+#define MAX_LINE_SIZE 256  // Largest line, in bytes
+#define CACHE_CONFIG_LINE 128  // Longest line of a cache configuration file
+#define CACHE_BITS_WORD 64  // Lines per word of a valid or dirty bitmask
+#define L2_ACCESS_CYCLES 1  // Cycles of moving data between a level and the next, plus one per further word
+#define MISS_TABLE_SIZE 10  // Instruction addresses listed by the miss table, most misses first
+
+// Compares 8 tags per instruction with SSE2 (16 with AVX2) in sets of 8 ways or more.
+// Uncomment CACHE_SCALAR to search tags one at a time on any compiler.
+// #define CACHE_SCALAR
+#if !defined(CACHE_SCALAR) && (defined(__SSE2__) || defined(_M_X64))
+#define CACHE_SIMD
+#endif
 
+// Levels of the memory hierarchy, in the order of CacheLevelNames[]
+enum CacheLevelIds {
+    CACHE_L1I,  // L1 instruction cache, on the fetch path
+    CACHE_L1D,  // L1 data cache, used by every load and store
+    CACHE_L2,  // Unified L2 behind both L1 caches
+    CACHE_LEVELS
+};
 
+// CacheConfig struct definition, everything about one cache level that can be set at run time
+typedef struct CacheConfig {
+    unsigned int size;  // Bytes of data, a power of two up to MEM_SIZE, CACHE_OFF for no cache
+    unsigned int line_size;  // Bytes per line, a power of two from 2 to MAX_LINE_SIZE
+    unsigned int ways;  // Lines per set, a power of two, CACHE_FULLY_ASSOCIATIVE for one set
+    bool write_back;  // Stores stay in the line until it is evicted, otherwise they also go to the level below
+    bool write_allocate;  // A store that misses loads its line, otherwise it only goes to the level below
+    int policy;  // Replacement policy (enum ReplacementPolicyIds in Replacement.h)
+    unsigned int seed;  // Seed of the random and BRRIP policies
+    int prefetcher;  // Prefetcher (enum PrefetcherIds in Prefetch.h)
+    unsigned int degree;  // Lines a prefetcher asks for at once, 1 to PREFETCH_MAX_DEGREE
+    unsigned int distance;  // How far ahead it asks, in lines or strides, 1 to PREFETCH_MAX_DISTANCE
+    unsigned int write_buffer;  // Entries of the write buffer of stores sent down, 0 to WBUFFER_MAX_ENTRIES
+} CacheConfig;
 
+// CacheLines struct definition, the lines of a cache as a structure of arrays indexed by line
+typedef struct CacheLines {
+    unsigned short* tag;  // Address of the first byte of each line
+    unsigned long long* valid;  // One bit per line, CACHE_BITS_WORD lines per word
+    unsigned long long* dirty;  // One bit per line, written but not yet in the level below (write-back)
+    unsigned char* data;  // line_size bytes per line
+} CacheLines;
 
+// CacheCounters struct definition, what one cache level has seen since it was configured
+typedef struct CacheCounters {
+    unsigned long read_hits;  // Loads, fetches and fills from the level above that found their line
+    unsigned long read_misses;
+    unsigned long write_hits;  // Stores and write backs from the level above that found their line
+    unsigned long write_misses;
+    unsigned long evictions;  // Valid lines replaced by a miss
+    unsigned long writebacks;  // Dirty lines written to the level below
+    unsigned long byte_accesses;  // Byte loads and stores
+    unsigned long word_accesses;  // Word loads and stores, and instruction fetches
+    unsigned long prefetches;  // Lines brought in by the prefetcher
+    unsigned long useful_prefetches;  // Prefetched lines used after they arrived
+    unsigned long late_prefetches;  // Prefetched lines used before they arrived, the CPU waited
+    unsigned long useless_prefetches;  // Prefetched lines evicted or dropped before any use
+    unsigned long buffered_stores;  // Stores sent down through the write buffer
+    unsigned long combined_stores;  // Of them, stores combined into an entry already waiting
+    unsigned long forwarded_loads;  // Loads that missed and were answered from the write buffer
+    unsigned long buffer_stalls;  // Stores that found the write buffer full
+    unsigned long buffer_stall_cycles;  // Cycles the CPU waited for it to drain
+    unsigned long buffer_occupancy;  // Entries waiting, added up over every buffered store
+    unsigned long max_buffer_occupancy;  // Most entries a buffered store found waiting
+} CacheCounters;
 
-// Defining constants
-#define MEM_SIZE 0x10000  // Size of the memory
-#define CACHE_SIZE 32  // Size of the cache
-#define MAX_AGE 31  // Maximum age for a cache line
-
-// CacheLine struct definition
-typedef struct {
-    unsigned short address;  // Address of the cache line 0x000 to 0xFFFF
-    unsigned char contents;
-    unsigned __int8 age;    // Age of the cache line (__int8: 0 to 255)
-    unsigned char word_byte;
-    bool dirty;
-} CacheLine;
-
-extern void InitializeCache();
-extern int FindInCache(unsigned short address);
-extern int UpdateCache(unsigned short address, unsigned short content);
-extern void PrintCache();
-extern void DecrementAllExcept(int index);
-extern void Cache(unsigned short address, unsigned short* content,
+// Hits and misses of a level, reads and writes together
+#define CACHE_HITS(counters) ((counters).read_hits + (counters).write_hits)
+#define CACHE_MISSES(counters) ((counters).read_misses + (counters).write_misses)
+
+// CacheLevel struct definition, one cache of the hierarchy and its counters
+typedef struct CacheLevel {
+    CacheConfig config;  // Geometry and policies, ways resolved once configured
+    CacheLines lines;  // NULL arrays when the level is off
+    ReplacementState replacement;
+    struct CacheLevel* next;  // Level misses and write backs go to, NULL for memory
+    PrefetchState prefetch;  // Prefetcher of the accesses from the CPU, kind PREFETCH_NONE for none
+    WriteBuffer wbuffer;  // Write buffer of the stores sent down, no entries for none
+    CacheCounters counters;
+} CacheLevel;
+
+// MissEntry struct definition, one instruction address of the miss table
+typedef struct MissEntry {
+    unsigned short address;  // Address of the instruction
+    unsigned int fetch;  // Misses fetching it from the L1 instruction cache
+    unsigned int data;  // Misses of its loads and stores in the data cache
+} MissEntry;
+
+// Reading, setting and clearing the bit of a line in a valid or dirty bitmask
+#define LINE_BIT(bits, line) (((bits)[(line) / CACHE_BITS_WORD] >> ((line) % CACHE_BITS_WORD)) & 1)
+#define SET_LINE_BIT(bits, line) ((bits)[(line) / CACHE_BITS_WORD] |= 1ULL << ((line) % CACHE_BITS_WORD))
+#define CLEAR_LINE_BIT(bits, line) ((bits)[(line) / CACHE_BITS_WORD] &= ~(1ULL << ((line) % CACHE_BITS_WORD)))
+#define BITMASK_WORDS(lines) (((lines) + CACHE_BITS_WORD - 1) / CACHE_BITS_WORD)
+#define LEVEL_ENABLED(level) ((level)->lines.tag != NULL)
+
+typedef struct Machine Machine;
+
+extern const char* CacheLevelNames[CACHE_LEVELS];
+
+extern void DefaultCacheConfig(CacheConfig configs[CACHE_LEVELS]);
+extern const char* CheckCacheConfig(const CacheConfig configs[CACHE_LEVELS]);
+extern bool SetCacheOption(CacheConfig configs[CACHE_LEVELS], const char* key, const char* value);
+extern bool ParseCacheOptions(CacheConfig configs[CACHE_LEVELS], const char* options);
+extern bool ReadCacheConfig(CacheConfig configs[CACHE_LEVELS], const char* file_name);
+extern bool ConfigureCache(Machine* m, const CacheConfig configs[CACHE_LEVELS]);
+extern void ReleaseCache(Machine* m);
+extern bool SaveCache(const Machine* m, CacheLevel saved[CACHE_LEVELS]);
+extern bool RestoreCache(Machine* m, const CacheLevel saved[CACHE_LEVELS]);
+extern void ReleaseSavedCache(CacheLevel saved[CACHE_LEVELS]);
+extern void InitializeCache(Machine* m);
+extern void FlushCache(Machine* m);
+extern void CleanCacheRange(Machine* m, unsigned int address, unsigned int length);
+extern int InvalidateCacheRange(Machine* m, unsigned int address, unsigned int length);
+extern int CacheSet(const CacheLevel* level, unsigned short address);
+extern int FindTag(const unsigned short* tags, const unsigned long long* valid, int first, int ways, unsigned short tag);
+extern int FindInCache(const CacheLevel* level, unsigned short address);
+extern void ReadBelow(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length);
+extern void WriteBelow(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length);
+extern int UpdateCache(Machine* m, CacheLevel* level, unsigned short address, bool fill);
+extern unsigned long WorstAccessCycles(const CacheLevel* level);
+extern void InstructionFetch(Machine* m, unsigned short address);
+extern int TopMisses(const Machine* m, MissEntry table[MISS_TABLE_SIZE]);
+extern void PrintCache(Machine* m);
+extern void DumpCacheCounters(FILE* out, Machine* m);
+extern void Cache(Machine* m, unsigned short address, unsigned short* content,
                  unsigned char read_write, unsigned char word_byte);
 
 #endif
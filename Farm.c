@@ -0,0 +1,450 @@
+/**
+ * @file Farm.c
+ * @brief Batch Farm for the XM-23 Emulator
+ *
+ * This module runs many .xme images without the interactive Controller() prompt.
+ * Every image listed in the manifest runs on its own headless machine (CreateMachine()), so
+ * images never share registers, memory, cache or translated blocks. Images are dealt round robin
+ * into one queue per worker thread. A worker takes images from the back of its own queue and,
+ * once that is empty, steals from the front of the other queues, so a few long programs never
+ * leave the other cores idle. Results are written in manifest order once every image has run.
+ *
+ * Every machine gets the same cache configuration (ConfigureCache()) and runs on the same core
+ * (translated blocks or the threaded interpreter), and the hits and misses of each cache level are
+ * written with its results (0 for a level that is off).
+ *
+ * An image listed many times is loaded once per worker: the worker snapshots the machine just
+ * after loading it and restores the snapshot for the next run of the same image, copying back
+ * only the memory the run wrote (Snapshot.c). With a boot address the worker first runs the image
+ * up to that address (at most FARM_MAX_INSTR instructions) and takes the snapshot there, so the
+ * start-up code runs once per worker rather than once per run. Such a run starts from the machine
+ * the boot left: its clock and cache counters go on from the boot's, while its instructions and
+ * instruction limit count from the boot address. An image that halts before its boot address
+ * finishes as boot_failed.
+ *
+ * Manifest lines: <image.xme> [instruction limit] [stop address (hex)] [boot address (hex)]
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Worker threads are Win32 threads on Windows and POSIX threads on Unix hosts. With neither,
+// every image runs on the calling thread.
+#if defined(_WIN32)
+#define FARM_WIN32_THREADS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define FARM_POSIX_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "emulator.h"
+#include "Block.h"
+#include "Farm.h"
+#include "Snapshot.h"
+
+// The queue locks and worker threads of each host
+#if defined(FARM_WIN32_THREADS)
+typedef CRITICAL_SECTION FarmLock;
+typedef HANDLE FarmThread;
+#define LOCK_INIT(lock) InitializeCriticalSection(lock)
+#define LOCK(lock) EnterCriticalSection(lock)
+#define UNLOCK(lock) LeaveCriticalSection(lock)
+#define LOCK_DESTROY(lock) DeleteCriticalSection(lock)
+#elif defined(FARM_POSIX_THREADS)
+typedef pthread_mutex_t FarmLock;
+typedef pthread_t FarmThread;
+#define LOCK_INIT(lock) pthread_mutex_init(lock, NULL)
+#define LOCK(lock) pthread_mutex_lock(lock)
+#define UNLOCK(lock) pthread_mutex_unlock(lock)
+#define LOCK_DESTROY(lock) pthread_mutex_destroy(lock)
+#else
+// No threads: the only worker runs on the calling thread and needs no lock
+typedef int FarmLock;
+typedef int FarmThread;
+#define LOCK_INIT(lock) ((void)(lock))
+#define LOCK(lock) ((void)(lock))
+#define UNLOCK(lock) ((void)(lock))
+#define LOCK_DESTROY(lock) ((void)(lock))
+#endif
+
+// FarmQueue struct definition, the images dealt to one worker
+typedef struct FarmQueue {
+    FarmLock lock;
+    int* jobs;      // Indexes into the job list
+    int head;       // Next image stolen by other workers
+    int tail;       // One past the next image taken by the owner
+} FarmQueue;
+
+// FarmPool struct definition, shared by all workers of one RunFarm() call
+typedef struct FarmPool {
+    FarmJob* jobs;
+    FarmQueue* queues;
+    int threads;
+    const CacheConfig* cache;   // Cache configuration of every machine, CACHE_LEVELS levels
+    int core;                   // Core every machine runs on (enum RunCores)
+} FarmPool;
+
+// FarmWorker struct definition, the argument of each worker thread
+typedef struct FarmWorker {
+    FarmPool* pool;
+    int id;
+    Machine* machine;   // Machine with a snapshot taken at the boot address of image, NULL for none
+    const char* image;  // Image of that snapshot
+    unsigned short boot_address;    // Address it was taken at, NO_STOP_ADDRESS for just after loading
+    int bad_records;    // Invalid S-records found loading it
+} FarmWorker;
+
+static const char* farm_status_names[] = { "load_error", "no_memory", "boot_failed" };
+
+/*
+*  purpose   : Finds the number of worker threads to start, one per online processor
+*  parameters: None
+*  return    : Number of processors, at least 1
+*/
+int FarmThreads() {
+#if defined(FARM_WIN32_THREADS)
+    SYSTEM_INFO system;
+    long cpus;
+
+    GetSystemInfo(&system);
+    cpus = (long)system.dwNumberOfProcessors;
+#elif defined(FARM_POSIX_THREADS)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    long cpus = 1;
+#endif
+
+    if (cpus < 1) return 1;
+    return (cpus > FARM_MAX_THREADS) ? FARM_MAX_THREADS : (int)cpus;
+}
+
+/*
+*  purpose   : Runs a freshly loaded image up to its boot address
+*  parameters: m            - Headless machine the image is loaded in
+*              boot_address - Address to stop at
+*  return    : true if the PC reached the boot address within FARM_MAX_INSTR instructions
+*/
+static bool BootImage(Machine* m, unsigned short boot_address) {
+    HaltConditions boot = { FARM_MAX_INSTR, NO_LIMIT, boot_address };
+    unsigned long executed;
+
+    return RunToHalt(m, &boot, &executed) == HALT_BREAKPOINT;
+}
+
+/*
+*  purpose   : Loads and runs one image on a fresh headless machine and records its final state.
+*              Running stops at the stop address, at a BRA to itself or at the instruction limit (RunToHalt()).
+*              The worker keeps the machine of the last image it loaded, with a snapshot taken just
+*              after loading or at the boot address (Snapshot.c); the same image with the same boot
+*              address again is restored from it instead of loaded and booted.
+*  parameters: worker - Worker running the image, keeps the machine of its snapshot
+*              job    - Image to run, filled in with its results
+*  return    : None
+*/
+static void RunImage(FarmWorker* worker, FarmJob* job) {
+    Machine* m = worker->machine;
+
+    if (m != NULL && strcmp(worker->image, job->image) == 0 && worker->boot_address == job->boot_address && RestoreSnapshot(m))
+        job->bad_records = worker->bad_records;
+    else {
+        DestroyMachine(m);
+        worker->machine = NULL;
+        m = CreateMachine();
+        if (m == NULL || !ConfigureCache(m, worker->pool->cache)) {
+            DestroyMachine(m);
+            job->status = FARM_NO_MEMORY;
+            return;
+        }
+        m->headless = true;
+        m->core = worker->pool->core;
+        job->bad_records = LoadFile(m, job->image);
+        if (job->bad_records < 0) {
+            job->status = FARM_LOAD_ERROR;
+            DestroyMachine(m);
+            return;
+        }
+        if (job->boot_address != NO_STOP_ADDRESS && !BootImage(m, job->boot_address)) {
+            job->status = FARM_BOOT_FAILED;
+            DestroyMachine(m);
+            return;
+        }
+        if (TakeSnapshot(m)) {
+            worker->machine = m;
+            worker->image = job->image;
+            worker->boot_address = job->boot_address;
+            worker->bad_records = job->bad_records;
+        }
+    }
+
+    job->status = RunToHalt(m, &job->halt, &job->executed);
+    SyncPsw(m);
+    memcpy(job->regs, m->reg_file[REG], sizeof(job->regs));
+    job->psw = m->psw;
+    job->cpu_clock = m->cpu_clock;
+    for (int level = 0; level < CACHE_LEVELS; level++) {
+        job->cache_hits[level] = CACHE_HITS(m->cache[level].counters);
+        job->cache_misses[level] = CACHE_MISSES(m->cache[level].counters);
+    }
+    if (m != worker->machine) DestroyMachine(m);
+}
+
+/*
+*  purpose   : Takes the next image for a worker, from its own queue or stolen from another
+*  parameters: pool - Worker pool
+*              id   - Worker taking the image
+*  return    : Index of the image, -1 once every queue is empty
+*/
+static int NextJob(FarmPool* pool, int id) {
+    for (int i = 0; i < pool->threads; i++) {
+        FarmQueue* queue = &pool->queues[(id + i) % pool->threads];
+        int job = -1;
+
+        LOCK(&queue->lock);
+        if (queue->head < queue->tail) job = (i == 0) ? queue->jobs[--queue->tail] : queue->jobs[queue->head++];
+        UNLOCK(&queue->lock);
+        if (job >= 0) return job;
+    }
+    // No image is ever added once the workers start, so empty queues mean the farm is done
+    return -1;
+}
+
+/*
+*  purpose   : Worker thread, runs images until every queue is empty
+*  parameters: arg - The worker's FarmWorker
+*  return    : NULL
+*/
+static void* FarmWorkerMain(void* arg) {
+    FarmWorker* worker = arg;
+    int job;
+
+    while ((job = NextJob(worker->pool, worker->id)) >= 0) RunImage(worker, &worker->pool->jobs[job]);
+    DestroyMachine(worker->machine);
+    worker->machine = NULL;
+    return NULL;
+}
+
+#ifdef FARM_WIN32_THREADS
+/*
+*  purpose   : Win32 entry point of a worker thread, runs FarmWorkerMain()
+*  parameters: arg - The worker's FarmWorker
+*  return    : 0
+*/
+static DWORD WINAPI FarmWorkerThread(LPVOID arg) {
+    FarmWorkerMain(arg);
+    return 0;
+}
+#endif
+
+/*
+*  purpose   : Starts a worker thread
+*  parameters: thread - Set to the started thread
+*              worker - The worker's FarmWorker
+*  return    : true if the thread started, false if it did not or the host has no threads
+*/
+static bool StartWorker(FarmThread* thread, FarmWorker* worker) {
+#if defined(FARM_WIN32_THREADS)
+    *thread = CreateThread(NULL, 0, FarmWorkerThread, worker, 0, NULL);
+    return *thread != NULL;
+#elif defined(FARM_POSIX_THREADS)
+    return pthread_create(thread, NULL, FarmWorkerMain, worker) == 0;
+#else
+    (void)thread;
+    (void)worker;
+    return false;
+#endif
+}
+
+/*
+*  purpose   : Waits for a worker thread started by StartWorker() to finish
+*  parameters: thread - The thread
+*  return    : None
+*/
+static void JoinWorker(FarmThread thread) {
+#if defined(FARM_WIN32_THREADS)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#elif defined(FARM_POSIX_THREADS)
+    pthread_join(thread, NULL);
+#else
+    (void)thread;
+#endif
+}
+
+/*
+*  purpose   : Reads the manifest into a list of jobs
+*  parameters: manifest - Open manifest file
+*              count    - Set to the number of jobs read
+*  return    : The jobs (count entries), NULL if the list could not be allocated
+*/
+static FarmJob* ReadManifest(FILE* manifest, int* count) {
+    char line[FARM_LINE_SIZE];
+    FarmJob* jobs = NULL;
+    int size = 0;
+
+    *count = 0;
+    while (fgets(line, FARM_LINE_SIZE, manifest) != NULL) {
+        char image[FARM_LINE_SIZE];
+        unsigned long max_instr = FARM_MAX_INSTR;
+        unsigned int stop_address = NO_STOP_ADDRESS;
+        unsigned int boot_address = NO_STOP_ADDRESS;
+
+        if (sscanf(line, "%s %lu %x %x", image, &max_instr, &stop_address, &boot_address) < 1 || image[0] == '#') continue;
+        if (*count == size) {
+            FarmJob* grown = realloc(jobs, (size ? size * 2 : 64) * sizeof(FarmJob));
+
+            if (grown == NULL) break;
+            jobs = grown;
+            size = size ? size * 2 : 64;
+        }
+        FarmJob* job = &jobs[*count];
+        memset(job, 0, sizeof(FarmJob));
+        job->image = malloc(strlen(image) + 1);
+        if (job->image == NULL) break;
+        strcpy(job->image, image);
+        job->halt.max_instr = max_instr;
+        job->halt.max_cycles = NO_LIMIT;
+        job->halt.stop_address = (unsigned short)stop_address;
+        job->boot_address = (unsigned short)boot_address;
+        (*count)++;
+    }
+    return jobs;
+}
+
+/*
+*  purpose   : Writes one line per image, in manifest order
+*  parameters: results - Open results file
+*              jobs    - Finished jobs
+*              count   - Number of jobs
+*  return    : None
+*/
+static void WriteResults(FILE* results, const FarmJob* jobs, int count) {
+    fprintf(results, "# image\tstatus\tinstructions\tcpu_clock\tR0\tR1\tR2\tR3\tR4\tR5\tR6\tR7\tc\tz\tn\tv");
+    for (int level = 0; level < CACHE_LEVELS; level++)
+        fprintf(results, "\t%s_hits\t%s_misses", CacheLevelNames[level], CacheLevelNames[level]);
+    fprintf(results, "\tbad_records\n");
+    for (int i = 0; i < count; i++) {
+        const FarmJob* job = &jobs[i];
+        const char* status = (job->status < HALT_REASONS) ? HaltNames[job->status] : farm_status_names[job->status - HALT_REASONS];
+
+        fprintf(results, "%s\t%s\t%lu\t%llu", job->image, status, job->executed, job->cpu_clock);
+        for (int reg = 0; reg < NUM_REG; reg++) fprintf(results, "\t%04X", job->regs[reg]);
+        fprintf(results, "\t%u\t%u\t%u\t%u", job->psw.c, job->psw.z, job->psw.n, job->psw.v);
+        for (int level = 0; level < CACHE_LEVELS; level++)
+            fprintf(results, "\t%lu\t%lu", job->cache_hits[level], job->cache_misses[level]);
+        fprintf(results, "\t%d\n", job->bad_records < 0 ? 0 : job->bad_records);
+    }
+}
+
+/*
+*  purpose   : Frees the queues and the jobs of a pool
+*  parameters: pool   - Pool of the farm
+*              queues - Number of queues whose lock was initialized
+*              count  - Number of jobs
+*  return    : None
+*/
+static void ReleaseFarm(FarmPool* pool, int queues, int count) {
+    for (int i = 0; i < queues; i++) {
+        LOCK_DESTROY(&pool->queues[i].lock);
+        free(pool->queues[i].jobs);
+    }
+    free(pool->queues);
+    for (int i = 0; i < count; i++) free(pool->jobs[i].image);
+    free(pool->jobs);
+}
+
+/*
+*  Purpose   : Runs every image in a manifest on a pool of worker threads and writes their results.
+*              InitializeDecodeTable() must have been called before, the workers only read it.
+*
+*  Parameters:
+*              manifest_name - Manifest listing the images
+*              results_name  - File the results are written to
+*              threads       - Worker threads to start, 0 for one per processor
+*              cache         - Cache configuration of every machine, one per level, checked by CheckCacheConfig()
+*              core          - Core every machine runs on (enum RunCores)
+*
+*  Return    : 0 once the results are written, 1 if the manifest or results file failed or memory ran out
+*/
+int RunFarm(const char* manifest_name, const char* results_name, int threads, const CacheConfig cache[CACHE_LEVELS], int core) {
+    FILE* manifest = fopen(manifest_name, "r");
+    FILE* results;
+    FarmJob* jobs;
+    FarmPool pool;
+    FarmWorker workers[FARM_MAX_THREADS];
+    FarmThread handles[FARM_MAX_THREADS];
+    int count;
+    int started = 0;
+
+    if (manifest == NULL) {
+        printf("Error: could not open manifest %s\n", manifest_name);
+        return 1;
+    }
+    jobs = ReadManifest(manifest, &count);
+    fclose(manifest);
+    if (count == 0) {
+        printf("Error: no images listed in %s\n", manifest_name);
+        free(jobs);
+        return 1;
+    }
+
+    if (threads <= 0) threads = FarmThreads();
+#if !defined(FARM_WIN32_THREADS) && !defined(FARM_POSIX_THREADS)
+    threads = 1;
+#endif
+    if (threads > FARM_MAX_THREADS) threads = FARM_MAX_THREADS;
+    if (threads > count) threads = count;
+
+    // Deal the images round robin, every queue gets room for its share
+    pool.jobs = jobs;
+    pool.threads = threads;
+    pool.cache = cache;
+    pool.core = core;
+    pool.queues = calloc(threads, sizeof(FarmQueue));
+    if (pool.queues == NULL) {
+        printf("Error: not enough memory for %d threads\n", threads);
+        ReleaseFarm(&pool, 0, count);
+        return 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        LOCK_INIT(&pool.queues[i].lock);
+        pool.queues[i].jobs = malloc(((count + threads - 1) / threads) * sizeof(int));
+        if (pool.queues[i].jobs == NULL) {
+            printf("Error: not enough memory for %d threads\n", threads);
+            ReleaseFarm(&pool, i + 1, count);
+            return 1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        FarmQueue* queue = &pool.queues[i % threads];
+        queue->jobs[queue->tail++] = i;
+    }
+
+    printf("Farm: running %d images on %d threads\n", count, threads);
+    for (int i = 0; i < threads; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        workers[i].machine = NULL;
+        if (StartWorker(&handles[i], &workers[i])) started++;
+        else break;
+    }
+    // With no thread started the images still run, on this thread
+    if (started == 0) FarmWorkerMain(&workers[0]);
+    for (int i = 0; i < started; i++) JoinWorker(handles[i]);
+
+    results = fopen(results_name, "w");
+    if (results != NULL) {
+        WriteResults(results, jobs, count);
+        fclose(results);
+        printf("Farm: results written to %s\n", results_name);
+    }
+    else printf("Error: could not write results to %s\n", results_name);
+
+    ReleaseFarm(&pool, threads, count);
+    return (results != NULL) ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+/*
+* This is the header file for the batch farm.
+* The farm runs every .xme image listed in a manifest, each on its own headless machine, on a pool
+* of worker threads sized to the host, and writes the final state of every image to one results file.
+*/
+#ifndef FARM_H
+#define FARM_H
+
+#include "emulator.h"
+#include "Headless.h"
+
+// Defining constants
+#define FARM_MAX_INSTR 10000000UL   // Instructions an image may run when the manifest gives no limit
+#define FARM_MAX_THREADS 256        // Most worker threads started
+#define FARM_LINE_SIZE 512          // Longest manifest line
+
+// How an image finished, when it did not run to a halt condition (enum HaltReasons)
+enum FarmStatus {
+    FARM_LOAD_ERROR = HALT_REASONS,     // Image could not be opened
+    FARM_NO_MEMORY,                     // Machine could not be allocated
+    FARM_BOOT_FAILED                    // Image halted before reaching its boot address
+};
+
+// FarmJob struct definition, one per manifest line
+typedef struct FarmJob {
+    char* image;                        // Path of the .xme file
+    HaltConditions halt;                // Instruction limit and break point
+    unsigned short boot_address;        // Address the run starts from, NO_STOP_ADDRESS to start from the entry
+    int status;                         // How the image finished (enum HaltReasons or FarmStatus)
+    int bad_records;                    // Invalid S-records in the image
+    unsigned long executed;             // Instructions run
+    unsigned long long cpu_clock;       // Final CPU clock
+    unsigned short regs[NUM_REG];       // Final registers
+    psw_bits psw;                       // Final PSW
+    unsigned long cache_hits[CACHE_LEVELS];     // Cache statistics of the run, per level
+    unsigned long cache_misses[CACHE_LEVELS];
+} FarmJob;
+
+extern int FarmThreads();
+extern int RunFarm(const char* manifest_name, const char* results_name, int threads, const CacheConfig cache[CACHE_LEVELS], int core);
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * @file Headless.c
+ * @brief Headless Run Mode for the XM-23 Emulator
+ *
+ * This module runs an image with no Controller() prompt, for automated runs:
+ *
+ *     FauxProcessor -run <image.xme | image.xmb | -> [-i instructions] [-c cycles] [-s stop address] [-o dump file]
+ *                       [-p replacement policy] [-r seed] [-S] [-cache options] [-cachefile file]
+ *                       [-t trace file] [-core blocks|threaded] [-verify]
+ *
+ * The machine is headless, so nothing is printed while it runs. Translated blocks run in chunks,
+ * or with -core threaded the threaded interpreter (RunThreaded()) does:
+ * the instruction limit is exact (RunBlocks() cuts a block at it) and the cycle budget is checked
+ * between chunks sized to fit in it, never per instruction. There is no SIGINT handler. Once the run halts the
+ * final state is written as key=value lines (stdout unless -o is given) and the exit status
+ * tells how the run ended (enum HeadlessExit). -S adds a shadow tag array per replacement policy
+ * and dumps the hit rate each policy would have had on the same run. -cache and -cachefile set the
+ * cache configuration of every level (ParseCacheOptions(), ReadCacheConfig()); options apply in
+ * command line order. -p, -r and -S apply to the data cache. -t writes every fetch, load and store
+ * of the run to a din trace file, for the cache sweep (Sweep.c). "-" reads the image from stdin, and an
+ * image with invalid records is not run: they are listed on stderr.
+ * -verify is the differential check of the translated blocks and the JIT, or of the threaded core:
+ * a second machine starts from the same loaded state and runs the same number of instructions
+ * through Control(), the Fetch() and Decode() path, one at a time. Its registers, PSW, clock, cache
+ * counters and memory must match; the result is dumped as verify=match or verify=mismatch with
+ * what differed.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "Block.h"
+#include "Headless.h"
+#include "Image.h"
+#include "Sweep.h"
+
+const char* HaltNames[HALT_REASONS] = { "breakpoint", "halted", "instruction_limit", "cycle_limit" };
+const char* CoreNames[RUN_CORES] = { "blocks", "threaded" };
+
+/*
+*  purpose   : Finds an interpreter core by name (-core)
+*  parameters: name - Core name, as in CoreNames
+*  return    : The core (enum RunCores), -1 if there is none of that name
+*/
+int FindCore(const char* name) {
+    for (int core = 0; core < RUN_CORES; core++)
+        if (strcmp(name, CoreNames[core]) == 0) return core;
+    return -1;
+}
+
+/*
+*  purpose   : Runs the machine's core (m->core) from the PC until a halt condition. The stop
+*              address and a BRA to itself stop the run before that instruction and the
+*              instruction limit right at it. The cycle budget is checked between chunks sized to fit in what is left of
+*              it, so it is passed by at most the one instruction run when too little is left.
+*  parameters: m        - Headless machine to run (m->headless set)
+*              halt     - Halt conditions
+*              executed - Set to the number of instructions run
+*  return    : Reason the run stopped (enum HaltReasons)
+*/
+int RunToHalt(Machine* m, const HaltConditions* halt, unsigned long* executed) {
+    unsigned long long start_clock = m->cpu_clock;
+
+    *executed = 0;
+    for (;;) {
+        unsigned long chunk = (unsigned long)-1;
+
+        if (PC == halt->stop_address) return HALT_BREAKPOINT;
+        if (BranchesToSelf(&DecodeTable[m->memory.WordMem[PC >> 1]])) return HALT_SELF_BRANCH;
+
+        if (halt->max_instr != NO_LIMIT) {
+            if (*executed >= halt->max_instr) return HALT_INSTR_LIMIT;
+            chunk = halt->max_instr - *executed;
+        }
+        if (halt->max_cycles != NO_LIMIT) {
+            unsigned long long spent = m->cpu_clock - start_clock;
+
+            if (spent >= halt->max_cycles) return HALT_CYCLE_LIMIT;
+            // No instruction costs more than this (a fetch and a data access), so this many always fit in the budget
+            unsigned long long most = MAX_INSTR_CYCLES + WorstAccessCycles(m->fetch_level) + WorstAccessCycles(m->data_level);
+            unsigned long long fits = (halt->max_cycles - spent) / most;
+            if (fits == 0) fits = 1;
+            if (fits < chunk) chunk = (unsigned long)fits;
+        }
+
+        // RunBlocks() also returns early when a write drops the running block
+        if (m->core == CORE_THREADED) *executed += RunThreaded(m, halt->stop_address, chunk);
+        else *executed += RunBlocks(m, halt->stop_address, chunk);
+    }
+}
+
+/*
+*  purpose   : Writes the final state of a run as key=value lines
+*  parameters: out      - File written to
+*              m        - Machine that ran
+*              reason   - Reason the run stopped (enum HaltReasons)
+*              executed - Instructions run
+*  return    : None
+*/
+void DumpMachine(FILE* out, Machine* m, int reason, unsigned long executed) {
+    SyncPsw(m);
+    fprintf(out, "status=%s\n", HaltNames[reason]);
+    fprintf(out, "instructions=%lu\n", executed);
+    fprintf(out, "cpu_clock=%llu\n", m->cpu_clock);
+    for (int reg = 0; reg < NUM_REG; reg++) fprintf(out, "R%d=%04X\n", reg, m->reg_file[REG][reg]);
+    fprintf(out, "psw.c=%u\npsw.z=%u\npsw.n=%u\npsw.v=%u\n", m->psw.c, m->psw.z, m->psw.n, m->psw.v);
+    for (int level_id = 0; level_id < CACHE_LEVELS; level_id++) {
+        const CacheLevel* level = &m->cache[level_id];
+        const char* name = CacheLevelNames[level_id];
+
+        if (!LEVEL_ENABLED(level)) continue;
+        fprintf(out, "%s.size=%u\n%s.line=%u\n%s.ways=%u\n", name, level->config.size, name, level->config.line_size, name, level->config.ways);
+        fprintf(out, "%s.write=%s\n%s.allocate=%s\n", name, level->config.write_back ? "back" : "through", name, level->config.write_allocate ? "yes" : "no");
+        fprintf(out, "%s.policy=%s\n", name, ReplacementPolicies[level->config.policy].name);
+        fprintf(out, "%s.prefetch=%s\n", name, PrefetcherNames[level->config.prefetcher]);
+        if (PREFETCHING(level)) fprintf(out, "%s.degree=%u\n%s.distance=%u\n", name, level->config.degree, name, level->config.distance);
+        fprintf(out, "%s.wbuffer=%u\n", name, level->config.write_buffer);
+    }
+    DumpCacheCounters(out, m);
+    PrintShadows(out, m);
+}
+
+/*
+*  purpose   : Runs a copy of the starting state through Control() for as many instructions as a
+*              run made, and compares the machines (-verify)
+*  parameters: out       - File the result is written to
+*              m         - Machine that ran on translated blocks
+*              reference - Machine holding the state m started from, run here
+*              executed  - Instructions m ran
+*  return    : true if both machines reached the same state
+*/
+static bool VerifyRun(FILE* out, Machine* m, Machine* reference, unsigned long executed) {
+    bool same_cache = true;
+    bool same_memory;
+    bool same_regs;
+    bool same_psw;
+
+    for (unsigned long i = 0; i < executed; i++) Control(reference);
+    SyncPsw(m);
+    SyncPsw(reference);
+    FlushCache(m);
+    FlushCache(reference);
+    same_regs = memcmp(m->reg_file, reference->reg_file, sizeof(m->reg_file)) == 0;
+    same_psw = m->psw.c == reference->psw.c && m->psw.z == reference->psw.z && m->psw.n == reference->psw.n && m->psw.v == reference->psw.v;
+    same_memory = memcmp(m->memory.ByteMem, reference->memory.ByteMem, MEM_SIZE) == 0;
+    for (int level = 0; level < CACHE_LEVELS; level++)
+        same_cache = same_cache && memcmp(&m->cache[level].counters, &reference->cache[level].counters, sizeof(CacheCounters)) == 0;
+
+    if (same_regs && same_psw && same_memory && same_cache && m->cpu_clock == reference->cpu_clock) {
+        fprintf(out, "verify=match\n");
+        return true;
+    }
+    fprintf(out, "verify=mismatch%s%s%s%s%s\n", same_regs ? "" : " registers", same_psw ? "" : " psw",
+        m->cpu_clock == reference->cpu_clock ? "" : " clock", same_cache ? "" : " cache", same_memory ? "" : " memory");
+    fprintf(out, "verify.cpu_clock=%llu\n", reference->cpu_clock);
+    for (int reg = 0; reg < NUM_REG; reg++) fprintf(out, "verify.R%d=%04X\n", reg, reference->reg_file[REG][reg]);
+    return false;
+}
+
+/*
+*  purpose   : Prints the headless command line
+*  parameters: None
+*  return    : EXIT_USAGE
+*/
+static int Usage() {
+    fprintf(stderr, "usage: -run <image.xme | image.xmb | -> [-i instructions] [-c cycles] [-s stop address (hex)] [-o dump file]\n"
+        "            [-p lru|plru|fifo|random|srrip|brrip] [-r seed] [-S (shadow every policy)]\n"
+        "            [-cache [l1i.|l1d.|l2.]size=<bytes>,line=<bytes>,ways=<n>|full,write=back|through,allocate=yes|no,...]\n"
+        "            [-cachefile file] [-t trace file] [-core blocks|threaded] [-verify]\n");
+    return EXIT_USAGE;
+}
+
+/*
+*  Purpose   : Loads the image named on the command line, runs it to a halt condition and dumps
+*              the final state. InitializeDecodeTable() must have been called before.
+*
+*  Parameters:
+*              argc - number of strings pointed to by argv
+*              argv - command line, argv[1] is "-run"
+*
+*  Return    : Exit status (enum HeadlessExit)
+*/
+int RunHeadless(int argc, char* argv[]) {
+    HaltConditions halt = { NO_LIMIT, NO_LIMIT, NO_STOP_ADDRESS };
+    const char* image = NULL;
+    const char* dump_name = NULL;
+    const char* trace_name = NULL;
+    CacheConfig configs[CACHE_LEVELS];
+    const char* config_error;
+    bool shadows = false;
+    bool verify = false;
+    bool verified = true;
+    int core = CORE_BLOCKS;
+    Machine* reference = NULL;
+    unsigned long executed;
+    int reason;
+    Machine* m;
+    FILE* out = stdout;
+    FILE* trace = NULL;
+    LoadResult load;
+
+    DefaultCacheConfig(configs);
+    for (int i = 2; i < argc; i++) {
+        char* end;
+
+        if (argv[i][0] != '-' || strcmp(argv[i], STDIN_NAME) == 0) {
+            if (image != NULL) return Usage();
+            image = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "-S") == 0) {
+            shadows = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-verify") == 0) {
+            verify = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+            if (!ParseCacheOptions(configs, argv[++i])) return Usage();
+            continue;
+        }
+        if (strcmp(argv[i], "-cachefile") == 0 && i + 1 < argc) {
+            if (!ReadCacheConfig(configs, argv[++i])) {
+                fprintf(stderr, "Error: cache configuration %s could not be read\n", argv[i]);
+                return EXIT_USAGE;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-core") == 0 && i + 1 < argc) {
+            core = FindCore(argv[++i]);
+            if (core < 0) return Usage();
+            continue;
+        }
+        if (i + 1 == argc || argv[i][2] != '\0') return Usage();
+        switch (argv[i][1]) {
+        case 'i': halt.max_instr = strtoul(argv[++i], &end, 10); break;
+        case 'c': halt.max_cycles = strtoull(argv[++i], &end, 10); break;
+        case 's': halt.stop_address = (unsigned short)strtoul(argv[++i], &end, 16); break;
+        case 'o': dump_name = argv[++i]; continue;
+        case 't': trace_name = argv[++i]; continue;
+        case 'p':
+            if (!SetCacheOption(configs, "policy", argv[++i])) return Usage();
+            continue;
+        case 'r': configs[CACHE_L1D].seed = (unsigned int)strtoul(argv[++i], &end, 10); break;
+        default: return Usage();
+        }
+        if (*end != '\0') return Usage();
+    }
+    if (image == NULL) return Usage();
+    config_error = CheckCacheConfig(configs);
+    if (config_error != NULL) {
+        fprintf(stderr, "Error: invalid cache configuration, %s\n", config_error);
+        return EXIT_USAGE;
+    }
+    if (shadows && configs[CACHE_L1D].size == CACHE_OFF && configs[CACHE_L2].size == CACHE_OFF) {
+        fprintf(stderr, "Error: -S shadows the data cache, and there is none\n");
+        return EXIT_USAGE;
+    }
+
+    m = CreateMachine();
+    if (m == NULL) {
+        fprintf(stderr, "Error: not enough memory for the machine\n");
+        return EXIT_LOAD_ERROR;
+    }
+    m->headless = true;
+    m->core = core;
+    if (!ConfigureCache(m, configs) || (shadows && !EnableShadows(m, m->data_level->config.seed))) {
+        fprintf(stderr, "Error: not enough memory for the cache\n");
+        DestroyMachine(m);
+        return EXIT_LOAD_ERROR;
+    }
+    if (!LoadProgram(m, image, &load) || load.bad_records != 0) {
+        PrintLoadResult(stderr, image, &load);
+        fprintf(stderr, "Error: %s could not be loaded\n", image);
+        DestroyMachine(m);
+        return EXIT_LOAD_ERROR;
+    }
+    if (trace_name != NULL) {
+        trace = fopen(trace_name, "w");
+        if (trace == NULL) {
+            fprintf(stderr, "Error: could not write %s\n", trace_name);
+            DestroyMachine(m);
+            return EXIT_USAGE;
+        }
+        m->trace = WriteTraceRecord;
+        m->trace_context = trace;
+    }
+
+    if (verify) {
+        // The reference starts from the loaded state, with the same caches and nothing attached
+        reference = CreateMachine();
+        if (reference == NULL || !ConfigureCache(reference, configs)) {
+            fprintf(stderr, "Error: not enough memory for the machine\n");
+            DestroyMachine(reference);
+            DestroyMachine(m);
+            if (trace != NULL) fclose(trace);
+            return EXIT_LOAD_ERROR;
+        }
+        reference->headless = true;
+        memcpy(reference->memory.ByteMem, m->memory.ByteMem, MEM_SIZE);
+        memcpy(reference->reg_file, m->reg_file, sizeof(m->reg_file));
+        reference->origin_address = m->origin_address;
+    }
+
+    reason = RunToHalt(m, &halt, &executed);
+    if (trace != NULL) fclose(trace);
+
+    if (dump_name != NULL) out = fopen(dump_name, "w");
+    if (out == NULL) fprintf(stderr, "Error: could not write %s\n", dump_name);
+    else {
+        DumpMachine(out, m, reason, executed);
+        if (reference != NULL) verified = VerifyRun(out, m, reference, executed);
+        if (out != stdout) fclose(out);
+    }
+    DestroyMachine(reference);
+    DestroyMachine(m);
+
+    if (!verified) return EXIT_VERIFY_FAILED;
+    switch (reason) {
+    case HALT_INSTR_LIMIT: return EXIT_INSTR_LIMIT;
+    case HALT_CYCLE_LIMIT: return EXIT_CYCLE_LIMIT;
+    default: return EXIT_HALTED;
+    }
+}
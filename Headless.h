@@ -0,0 +1,60 @@
+/*
+* This is the header file for the headless run mode.
+* A headless run loads one image, runs it with no prompt until a halt condition, dumps the final
+* machine state as key=value lines and exits with a status code telling how the run ended.
+*/
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdio.h>
+#include "emulator.h"
+
+// Defining constants
+#define NO_STOP_ADDRESS 0xFFFF  // Stop address used when none is given (never fetched)
+#define NO_LIMIT 0              // Instruction or cycle limit that never halts the run
+#define MAX_INSTR_CYCLES 10     // Most cycles one instruction costs besides the memory accesses of
+                                // its fetch and data access (DADD); see WorstAccessCycles()
+
+// Why a run stopped, in the order the conditions are checked
+enum HaltReasons {
+    HALT_BREAKPOINT,    // Reached the stop address
+    HALT_SELF_BRANCH,   // Reached a BRA to itself (idle loop)
+    HALT_INSTR_LIMIT,   // Ran the instruction limit
+    HALT_CYCLE_LIMIT,   // Spent the cycle budget
+    HALT_REASONS
+};
+
+// Interpreter core RunToHalt() and BK run on (m->core)
+enum RunCores {
+    CORE_BLOCKS,        // Translated blocks and the JIT (Block.c), the default
+    CORE_THREADED,      // Threaded interpreter (Threaded.c)
+    RUN_CORES
+};
+
+// Exit status of a headless run
+enum HeadlessExit {
+    EXIT_HALTED = 0,        // Stopped at the stop address or at a BRA to itself
+    EXIT_USAGE = 1,         // Invalid command line
+    EXIT_LOAD_ERROR = 2,    // Image missing or with invalid records
+    EXIT_INSTR_LIMIT = 3,   // Instruction limit reached first
+    EXIT_CYCLE_LIMIT = 4,   // Cycle budget reached first
+    EXIT_VERIFY_FAILED = 5  // -verify: the interpreter did not reach the same state
+};
+
+// HaltConditions struct definition
+typedef struct HaltConditions {
+    unsigned long max_instr;            // Instructions to run, NO_LIMIT for no limit
+    unsigned long long max_cycles;      // Cycles to spend, NO_LIMIT for no limit
+    unsigned short stop_address;        // Break point, NO_STOP_ADDRESS for none
+} HaltConditions;
+
+extern const char* HaltNames[HALT_REASONS];
+extern const char* CoreNames[RUN_CORES];
+
+extern int FindCore(const char* name);
+
+extern int RunToHalt(Machine* m, const HaltConditions* halt, unsigned long* executed);
+extern void DumpMachine(FILE* out, Machine* m, int reason, unsigned long executed);
+extern int RunHeadless(int argc, char* argv[]);
+
+#endif
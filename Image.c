@@ -0,0 +1,570 @@
+/**
+ * @file Image.c
+ * @brief Binary Program Images for the XM-23 Emulator
+ *
+ * This module puts program images (Image.h) in a machine and keeps them as binary .xmb files.
+ * A .xmb holds the address ranges an S-record file loads, their bytes, the entry PC and the S0
+ * name, so loading one is a few memcpy() calls out of the mapped file with no text to parse:
+ *
+ *     FauxProcessor -convert <image.xme | -> [image.xmb]
+ *
+ * With IMAGE_CACHE defined (Image.h), LoadFile() keeps a .xmb beside every .xme it parses
+ * without invalid records, stamped with the size, modification time (to the nanosecond where the
+ * host keeps it) and inode of the .xme. Later loads of the .xme map the .xmb instead while all of
+ * them still match, so an edit in the same second, or a file replaced by another, is seen. The
+ * stamp is taken when the .xme is opened, before it is parsed, so an edit made during the parse
+ * leaves the side cache stale. The side cache is written to a temporary file named after the
+ * process and renamed, so machines loading the same image on other threads (Farm.c) or in other
+ * processes never map a half written one.
+ *
+ * A .xmb that is missing, stale, truncated or fails its checksum is never loaded, the machine is
+ * left as it was.
+ *
+ * ReloadImage() puts an image over the program already in a machine (NF): only the bytes that
+ * differ are written, and only the cache lines and decoded instructions of those bytes are dropped.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "emulator.h"
+#include "Headless.h"
+#include "Image.h"
+#include "Snapshot.h"
+
+#ifdef IMAGE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// FNV-1a, the checksum of a .xmb
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// Id of this process, for temporary file names
+#if defined(_WIN32)
+#include <process.h>
+#define PROCESS_ID() _getpid()
+#elif defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define PROCESS_ID() getpid()
+#else
+#define PROCESS_ID() 0
+#endif
+
+// Nanoseconds of the modification time in a struct stat, where the host keeps them
+#if defined(__APPLE__)
+#define STAT_NANOSECONDS(info) ((info).st_mtimespec.tv_nsec)
+#elif defined(__unix__)
+#define STAT_NANOSECONDS(info) ((info).st_mtim.tv_nsec)
+#else
+#define STAT_NANOSECONDS(info) 0
+#endif
+
+/*
+*  purpose   : Empties a program image: nothing loaded, no entry PC, no name
+*  parameters: image - Program image
+*  return    : None
+*/
+void ClearImage(ProgramImage* image) {
+    memset(image, 0, sizeof(*image));
+}
+
+/*
+*  purpose   : Finds the next range of consecutive addresses loaded by an image, skipping 8
+*              addresses at a time where none or all of them are loaded
+*  parameters: image - Program image
+*              address - First address looked at
+*              length - Set to the number of addresses in the range
+*  return    : First address of the range, -1 if no address from address on is loaded
+*/
+static int NextRange(const ProgramImage* image, int address, int* length) {
+    int end;
+
+    while (address < MEM_SIZE && !IMAGE_LOADED(image, address))
+        address += ((address & 7) == 0 && image->loaded[address >> 3] == 0) ? 8 : 1;
+    if (address >= MEM_SIZE) return -1;
+
+    end = address;
+    while (end < MEM_SIZE && IMAGE_LOADED(image, end))
+        end += ((end & 7) == 0 && image->loaded[end >> 3] == 0xFF) ? 8 : 1;
+    *length = end - address;
+    return address;
+}
+
+/*
+*  purpose   : Copies bytes into the memory of a machine and drops the decoded instructions of
+*              the words written, without going through the Bus (the CPU clock does not move).
+*              The pages written are saved in the snapshot of the machine first.
+*  parameters: m - Machine
+*              address - Address of the first byte, the bytes do not wrap past the last address
+*              data - Bytes copied
+*              length - Number of bytes
+*  return    : None
+*/
+static void CopyToMemory(Machine* m, unsigned int address, const unsigned char* data, unsigned int length) {
+    for (unsigned int word = address & ~1u; word < address + length; word += 2) {
+        InvalidateDecoded(m, (unsigned short)word);
+        SNAPSHOT_WRITE(m, SNAPSHOT_MEMORY, word);
+    }
+    memcpy(&m->memory.ByteMem[address], data, length);
+}
+
+/*
+*  purpose   : Puts a program image in a machine: writes every range it loads, sets the PC if it
+*              has an entry and the origin address. Addresses it does not load are left as they are.
+*  parameters: m - Machine
+*              image - Program image
+*  return    : None
+*/
+void ApplyImage(Machine* m, const ProgramImage* image) {
+    int length;
+
+    for (int address = NextRange(image, 0, &length); address >= 0; address = NextRange(image, address + length, &length))
+        CopyToMemory(m, address, &image->memory[address], length);
+    m->origin_address = image->origin_address;
+    if (image->has_entry) PC = image->entry;
+}
+
+/*
+*  purpose   : Adds bytes to an FNV-1a hash
+*  parameters: hash - Hash of the bytes before
+*              bytes - Bytes added
+*              length - Number of bytes
+*  return    : New hash
+*/
+static unsigned int HashBytes(unsigned int hash, const unsigned char* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * FNV_PRIME;
+    return hash;
+}
+
+/*
+*  purpose   : Fills a stamp with the size, modification time and inode of a file
+*  parameters: info - The file's status
+*              stamp - Stamp set
+*  return    : None
+*/
+static void FillStamp(const struct stat* info, SourceStamp* stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->size = (unsigned long long)info->st_size;
+    stamp->time = (long long)info->st_mtime;
+    stamp->nanoseconds = (long long)STAT_NANOSECONDS(*info);
+    stamp->inode = (unsigned long long)info->st_ino;
+}
+
+/*
+*  purpose   : Stamps an open .xme as it is when it is opened, before it is read, so an edit made
+*              while it is parsed leaves its side cache stale rather than stamped as current
+*  parameters: source - .xme just opened
+*              stamp - Stamp set
+*  return    : true if the file could be stamped
+*/
+bool StampSource(FILE* source, SourceStamp* stamp) {
+    struct stat info;
+
+    if (fstat(fileno(source), &info) != 0) return false;
+    FillStamp(&info, stamp);
+    return true;
+}
+
+/*
+*  purpose   : Writes a program image as a .xmb file. The file is written under a temporary name
+*              and renamed, so a reader never sees part of it.
+*              The temporary name holds the process id and the image's address, so processes and
+*              threads writing the same .xmb at once never share one.
+*  parameters: image - Program image
+*              file_name - .xmb written
+*              source - Stamp of the .xme the image was parsed from, taken when it was opened
+*                       (StampSource()) and kept in the header; NULL for none
+*  return    : true if the file was written
+*/
+bool WriteImage(const ProgramImage* image, const char* file_name, const SourceStamp* source) {
+    ImageHeader header;
+    ImageRange* ranges = malloc((MEM_SIZE / 2) * sizeof(ImageRange));
+    char* temporary_name = malloc(strlen(file_name) + 64);
+    FILE* out;
+    int length;
+    bool written;
+
+    if (ranges == NULL || temporary_name == NULL) {
+        free(ranges);
+        free(temporary_name);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.flags = image->has_entry ? IMAGE_HAS_ENTRY : 0;
+    header.entry = image->entry;
+    header.name_length = (unsigned short)image->name_length;
+    if (source != NULL) header.source = *source;
+    for (int address = NextRange(image, 0, &length); address >= 0; address = NextRange(image, address + length, &length)) {
+        ranges[header.range_count].address = (unsigned short)address;
+        ranges[header.range_count].reserved = 0;
+        ranges[header.range_count].length = length;
+        header.range_count++;
+        header.data_length += length;
+    }
+
+    // The checksum covers everything after the header, in file order
+    header.checksum = HashBytes(FNV_OFFSET, (const unsigned char*)ranges, header.range_count * sizeof(ImageRange));
+    header.checksum = HashBytes(header.checksum, (const unsigned char*)image->name, image->name_length);
+    for (unsigned int i = 0; i < header.range_count; i++)
+        header.checksum = HashBytes(header.checksum, &image->memory[ranges[i].address], ranges[i].length);
+
+    sprintf(temporary_name, "%s.%ld.%p", file_name, (long)PROCESS_ID(), (const void*)image);
+    out = fopen(temporary_name, "wb");
+    written = (out != NULL);
+    if (written) {
+        written = fwrite(&header, sizeof(header), 1, out) == 1;
+        written = written && fwrite(ranges, sizeof(ImageRange), header.range_count, out) == header.range_count;
+        written = written && fwrite(image->name, 1, image->name_length, out) == image->name_length;
+        for (unsigned int i = 0; written && i < header.range_count; i++)
+            written = fwrite(&image->memory[ranges[i].address], 1, ranges[i].length, out) == ranges[i].length;
+        written = (fclose(out) == 0) && written;
+    }
+    // rename() does not replace an existing file on Windows
+    if (written && rename(temporary_name, file_name) != 0) {
+        remove(file_name);
+        written = rename(temporary_name, file_name) == 0;
+    }
+    if (!written) remove(temporary_name);
+
+    free(ranges);
+    free(temporary_name);
+    return written;
+}
+
+/*
+*  purpose   : Maps a whole file to read it, or reads it into memory where mmap() is not available
+*  parameters: file_name - File
+*              size - Set to its size in bytes
+*  return    : Contents of the file, NULL if it could not be opened or is empty
+*/
+static unsigned char* MapImage(const char* file_name, size_t* size) {
+#ifdef IMAGE_MMAP
+    int file = open(file_name, O_RDONLY);
+    struct stat info;
+    void* contents;
+
+    if (file < 0) return NULL;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        close(file);
+        return NULL;
+    }
+    contents = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (contents == MAP_FAILED) return NULL;
+    *size = info.st_size;
+    return contents;
+#else
+    FILE* in = fopen(file_name, "rb");
+    unsigned char* contents = NULL;
+    long length;
+
+    if (in == NULL) return NULL;
+    if (fseek(in, 0, SEEK_END) == 0 && (length = ftell(in)) > 0 && fseek(in, 0, SEEK_SET) == 0) {
+        contents = malloc(length);
+        if (contents != NULL && fread(contents, 1, length, in) != (size_t)length) {
+            free(contents);
+            contents = NULL;
+        }
+        *size = length;
+    }
+    fclose(in);
+    return contents;
+#endif
+}
+
+/*
+*  purpose   : Releases the contents returned by MapImage()
+*  parameters: contents - Contents of the file
+*              size - Its size in bytes
+*  return    : None
+*/
+static void UnmapImage(unsigned char* contents, size_t size) {
+#ifdef IMAGE_MMAP
+    munmap(contents, size);
+#else
+    (void)size;
+    free(contents);
+#endif
+}
+
+/*
+*  purpose   : Checks the contents of a .xmb: header, sizes, ranges and checksum
+*  parameters: contents - Contents of the file
+*              size - Its size in bytes
+*              header - Set to its header
+*  return    : true if it is a valid image
+*/
+static bool CheckImage(const unsigned char* contents, size_t size, ImageHeader* header) {
+    const unsigned char* ranges = contents + sizeof(ImageHeader);
+    unsigned long long total = 0;
+    unsigned int checksum;
+
+    if (size < sizeof(ImageHeader)) return false;
+    memcpy(header, contents, sizeof(ImageHeader));
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != IMAGE_VERSION) return false;
+    if (header->range_count > MEM_SIZE / 2 || header->data_length > MEM_SIZE) return false;
+    if (size != sizeof(ImageHeader) + header->range_count * sizeof(ImageRange) + header->name_length + header->data_length) return false;
+
+    for (unsigned int i = 0; i < header->range_count; i++) {
+        ImageRange range;
+
+        memcpy(&range, &ranges[i * sizeof(ImageRange)], sizeof(range));
+        if (range.address + (unsigned long long)range.length > MEM_SIZE) return false;
+        total += range.length;
+    }
+    if (total != header->data_length) return false;
+
+    checksum = HashBytes(FNV_OFFSET, ranges, size - sizeof(ImageHeader));
+    return checksum == header->checksum;
+}
+
+/*
+*  purpose   : Checks that a .xme is still the file a side cache was stamped with
+*  parameters: source_name - .xme
+*              stamp - Stamp kept in the side cache
+*  return    : true if its size, modification time and inode all match
+*/
+static bool SameSource(const char* source_name, const SourceStamp* stamp) {
+    struct stat info;
+    SourceStamp now;
+
+    if (stat(source_name, &info) != 0) return false;
+    FillStamp(&info, &now);
+    return now.size == stamp->size && now.time == stamp->time && now.nanoseconds == stamp->nanoseconds && now.inode == stamp->inode;
+}
+
+/*
+*  purpose   : Maps a .xmb and checks it: the whole file must be valid and, when it is the side
+*              cache of a .xme, made from the .xme as it is now
+*  parameters: file_name - .xmb
+*              source_name - .xme the .xmb must have been made from, NULL for any
+*              size - Set to the size of the file
+*              header - Set to its header
+*  return    : Contents of the file (UnmapImage() releases them), NULL if it is missing, invalid or stale
+*/
+static unsigned char* OpenImage(const char* file_name, const char* source_name, size_t* size, ImageHeader* header) {
+    unsigned char* contents = MapImage(file_name, size);
+
+    if (contents == NULL) return NULL;
+    if (!CheckImage(contents, *size, header) || (source_name != NULL && !SameSource(source_name, &header->source))) {
+        UnmapImage(contents, *size);
+        return NULL;
+    }
+    return contents;
+}
+
+/*
+*  purpose   : Loads a .xmb into a machine. Nothing is changed unless the whole file is valid
+*              and, when it is the side cache of a .xme, was made from the .xme as it is now.
+*  parameters: m - Machine
+*              file_name - .xmb loaded
+*              source_name - .xme the .xmb must have been made from, NULL for any
+*  return    : 0 if it was loaded, -1 if it is missing, invalid or stale
+*/
+int LoadImageFile(Machine* m, const char* file_name, const char* source_name) {
+    size_t size;
+    ImageHeader header;
+    unsigned char* contents = OpenImage(file_name, source_name, &size, &header);
+    const unsigned char* ranges;
+    const unsigned char* data;
+
+    if (contents == NULL) return -1;
+    ranges = contents + sizeof(ImageHeader);
+    data = ranges + header.range_count * sizeof(ImageRange) + header.name_length;
+    if (!m->headless && header.name_length > 0)
+        printf("FILE NAME: %.*s\n", header.name_length, (const char*)(ranges + header.range_count * sizeof(ImageRange)));
+    for (unsigned int i = 0; i < header.range_count; i++) {
+        ImageRange range;
+
+        memcpy(&range, &ranges[i * sizeof(ImageRange)], sizeof(range));
+        CopyToMemory(m, range.address, data, range.length);
+        m->origin_address = range.address;
+        data += range.length;
+    }
+    if (header.flags & IMAGE_HAS_ENTRY) {
+        PC = header.entry;
+        m->origin_address = header.entry;
+    }
+    UnmapImage(contents, size);
+    return 0;
+}
+
+/*
+*  purpose   : Reads a .xmb into a program image, under the same checks as LoadImageFile()
+*  parameters: image - Program image, cleared first
+*              file_name - .xmb read
+*              source_name - .xme the .xmb must have been made from, NULL for any
+*  return    : 0 if it was read, -1 if it is missing, invalid or stale (the image is left empty)
+*/
+int ReadImageFile(ProgramImage* image, const char* file_name, const char* source_name) {
+    size_t size;
+    ImageHeader header;
+    unsigned char* contents = OpenImage(file_name, source_name, &size, &header);
+    const unsigned char* ranges;
+    const unsigned char* data;
+
+    ClearImage(image);
+    if (contents == NULL) return -1;
+    ranges = contents + sizeof(ImageHeader);
+    data = ranges + header.range_count * sizeof(ImageRange) + header.name_length;
+    image->name_length = header.name_length < MAXBufSize ? header.name_length : MAXBufSize;
+    memcpy(image->name, ranges + header.range_count * sizeof(ImageRange), image->name_length);
+    for (unsigned int i = 0; i < header.range_count; i++) {
+        ImageRange range;
+
+        memcpy(&range, &ranges[i * sizeof(ImageRange)], sizeof(range));
+        memcpy(&image->memory[range.address], data, range.length);
+        for (unsigned int address = range.address; address < range.address + range.length; address++)
+            image->loaded[address >> 3] |= 1 << (address & 7);
+        image->origin_address = range.address;
+        data += range.length;
+    }
+    if (header.flags & IMAGE_HAS_ENTRY) {
+        image->has_entry = true;
+        image->entry = header.entry;
+        image->origin_address = header.entry;
+    }
+    UnmapImage(contents, size);
+    return 0;
+}
+
+/*
+*  purpose   : Puts a program image in a machine that already holds a program, changing only what
+*              differs. The dirty cache lines of the addresses it loads are written back first, so
+*              memory holds what the program wrote; then each run of bytes that differs from the
+*              image is written, and only the cache lines, stream and write buffer copies and
+*              decoded or translated instructions of those bytes are dropped. Nothing is done
+*              through the Bus: the CPU clock does not move.
+*  parameters: m - Machine
+*              image - Program image
+*              keep_state - true to keep the registers, PSW, clock and counters (the PC too), false
+*                           to reset them (ResetMachineState()) and set the PC to the entry of the image
+*              summary - Set to what was changed
+*  return    : None
+*/
+void ReloadImage(Machine* m, const ProgramImage* image, bool keep_state, ReloadSummary* summary) {
+    int length;
+
+    memset(summary, 0, sizeof(*summary));
+    for (int address = NextRange(image, 0, &length); address >= 0; address = NextRange(image, address + length, &length))
+        CleanCacheRange(m, address, length);
+
+    for (int address = NextRange(image, 0, &length); address >= 0; address = NextRange(image, address + length, &length)) {
+        int end = address + length;
+        int run = address;
+
+        while (run < end) {
+            int changed;
+            int same = 0;
+
+            // Equal blocks are skipped with memcmp(), then the run is found byte by byte. A run
+            // ends at RELOAD_BLOCK equal bytes, so a few equal bytes do not split it.
+            while (run + RELOAD_BLOCK <= end && memcmp(&m->memory.ByteMem[run], &image->memory[run], RELOAD_BLOCK) == 0) run += RELOAD_BLOCK;
+            while (run < end && m->memory.ByteMem[run] == image->memory[run]) run++;
+            if (run == end) break;
+            for (changed = run + 1; changed + same < end && same < RELOAD_BLOCK; ) {
+                if (m->memory.ByteMem[changed + same] == image->memory[changed + same]) same++;
+                else {
+                    changed += same + 1;
+                    same = 0;
+                }
+            }
+
+            CopyToMemory(m, run, &image->memory[run], changed - run);
+            summary->lines += InvalidateCacheRange(m, run, changed - run);
+            summary->ranges++;
+            summary->bytes += changed - run;
+            run = changed;
+        }
+    }
+
+    if (!keep_state) {
+        ResetMachineState(m);
+        if (image->has_entry) PC = image->entry;
+    }
+    m->origin_address = image->origin_address;
+}
+
+/*
+*  purpose   : Tells whether a file name is one LoadFile() can load, a .xme or a .xmb
+*  parameters: file_name - File name
+*  return    : true for a .xme or .xmb name
+*/
+bool IsProgramName(const char* file_name) {
+    size_t length = strlen(file_name);
+
+    if (length < 5) return false;
+    return strcmp(&file_name[length - 4], SRECORD_EXTENSION) == 0 || strcmp(&file_name[length - 4], IMAGE_EXTENSION) == 0;
+}
+
+/*
+*  purpose   : Converts a .xme into a .xmb, the same name with .xmb unless one is given
+*              Usage: -convert <image.xme | -> [image.xmb], "-" reads stdin and needs the .xmb name
+*  parameters: argc - Number of arguments
+*              argv - Arguments, argv[1] is "-convert"
+*  return    : Exit status (enum HeadlessExit)
+*/
+int ConvertImage(int argc, char* argv[]) {
+    ProgramImage* image;
+    bool from_stdin;
+    FILE* in_file;
+    char* out_name;
+    SourceStamp source;
+    bool stamped;
+    bool written;
+
+    if (argc < 3 || argc > 4 || (strcmp(argv[2], STDIN_NAME) == 0 && argc != 4)) {
+        fprintf(stderr, "usage: -convert <image.xme | -> [image.xmb]\n");
+        return EXIT_USAGE;
+    }
+    from_stdin = strcmp(argv[2], STDIN_NAME) == 0;
+    in_file = from_stdin ? stdin : fopen(argv[2], "rb");
+    if (in_file == NULL) {
+        fprintf(stderr, "Error: %s could not be opened\n", argv[2]);
+        return EXIT_LOAD_ERROR;
+    }
+    image = malloc(sizeof(ProgramImage));
+    // The output is named on the command line, or is the input name with the image extension
+    out_name = malloc(strlen(argv[argc - 1]) + sizeof(IMAGE_EXTENSION));
+    if (image == NULL || out_name == NULL) {
+        fprintf(stderr, "Error: not enough memory for the image\n");
+        if (!from_stdin) fclose(in_file);
+        free(image);
+        free(out_name);
+        return EXIT_LOAD_ERROR;
+    }
+
+    stamped = !from_stdin && StampSource(in_file, &source);
+    ClearImage(image);
+    ReadRecords(image, in_file);
+    if (!from_stdin) fclose(in_file);
+    if (argc == 4) strcpy(out_name, argv[3]);
+    else {
+        char* extension;
+
+        strcpy(out_name, argv[2]);
+        extension = strrchr(out_name, '.');
+        if (extension != NULL && strcmp(extension, SRECORD_EXTENSION) == 0) *extension = '\0';
+        strcat(out_name, IMAGE_EXTENSION);
+    }
+
+    if (image->result.status != LOAD_LOADED || image->result.bad_records != 0) {
+        PrintLoadResult(stderr, argv[2], &image->result);
+        written = false;
+    }
+    else {
+        written = WriteImage(image, out_name, stamped ? &source : NULL);
+        if (!written) fprintf(stderr, "Error: could not write %s\n", out_name);
+    }
+    free(image);
+    free(out_name);
+    return written ? EXIT_HALTED : EXIT_LOAD_ERROR;
+}
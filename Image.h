@@ -0,0 +1,149 @@
+/*
+* This is the header file for program images.
+* A program image is what loading a file puts in a machine: the bytes its records load, the entry
+* PC of its S7, S8 or S9 record and the name of its S0 record. S-record files (.xme, or stdin) are
+* parsed into one by the loader (Loader.c), which reports each invalid record in a LoadResult;
+* binary images (.xmb) hold one ready to copy, with no text to parse. A .xmb is written by
+* -convert, and beside every .xme loaded (the side cache) so it is parsed only once.
+*/
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "emulator.h"
+
+// Keeps a .xmb beside each .xme loaded and loads it instead while the .xme is unchanged.
+// Comment out to parse every .xme each time it is loaded.
+#define IMAGE_CACHE
+
+// Binary images are mapped instead of read where mmap() is available
+#if defined(__unix__) || defined(__APPLE__)
+#define IMAGE_MMAP
+#endif
+
+// Defining constants
+#define IMAGE_MAGIC "XM23IMG"       // First 8 bytes of a .xmb, with the terminating 0
+#define IMAGE_VERSION 2
+#define IMAGE_EXTENSION ".xmb"
+#define SRECORD_EXTENSION ".xme"
+#define IMAGE_HAS_ENTRY 0x0001      // ImageHeader.flags: the image sets the PC
+#define STDIN_NAME "-"              // File name that reads the S-records from stdin
+#define SRECORD_MAX_LENGTH (4 + 2 * 255)    // Longest S-record: type, count and 255 bytes
+#define LOAD_CHUNK_SIZE 65536       // Bytes read from an S-record file at a time
+#define LOAD_MAX_PROBLEMS 16        // Problems kept for one load, the first ones found
+#define RELOAD_BLOCK 64             // Bytes compared at once by a reload, and equal bytes that end a changed run
+
+// What is wrong with a record, in the order of LoadErrorMessages[]
+enum LoadErrors {
+    LOAD_NOT_RECORD,        // Line does not start with S
+    LOAD_UNSUPPORTED,       // S4, or not a record type
+    LOAD_MALFORMED,         // Not hex digits, shorter than its count or count too small for its address
+    LOAD_TOO_LONG,          // Longer than any record (SRECORD_MAX_LENGTH)
+    LOAD_BAD_CHECKSUM,      // Checksum does not match; the record is still used
+    LOAD_OUT_OF_RANGE,      // S2, S3, S7 or S8 address past the 64 KiB memory; the record is not used
+    LOAD_COUNT_MISMATCH,    // S5 or S6 count differs from the data records read before it
+    LOAD_ERRORS
+};
+
+// How a load ended
+enum LoadStatus {
+    LOAD_LOADED,            // Loaded, possibly with invalid records
+    LOAD_NOT_OPENED,        // File could not be opened
+    LOAD_NO_MEMORY,         // No memory to read it
+    LOAD_INVALID_IMAGE      // .xmb truncated, of another version or failing its checksum
+};
+
+// LoadProblem struct definition, one invalid record
+typedef struct LoadProblem {
+    unsigned long line;     // Line of the record, from 1
+    char type;              // Character after the S, '?' if there is none
+    unsigned char error;    // enum LoadErrors
+} LoadProblem;
+
+// LoadResult struct definition, what loading a file found
+typedef struct LoadResult {
+    int status;                             // enum LoadStatus
+    unsigned long records;                  // Lines read
+    unsigned long data_records;             // S1, S2 and S3 records used
+    int bad_records;                        // Invalid records, each counted once
+    unsigned long bad_line;                 // Line of the last one counted
+    int problem_count;                      // Problems kept, at most LOAD_MAX_PROBLEMS
+    LoadProblem problems[LOAD_MAX_PROBLEMS];
+} LoadResult;
+
+// ProgramImage struct definition, a file parsed before it is put in a machine
+typedef struct ProgramImage {
+    unsigned char memory[MEM_SIZE];         // Bytes loaded, at their addresses
+    unsigned char loaded[MEM_SIZE / 8];     // One bit per address, set if a record loaded it
+    char name[MAXBufSize];                  // S0 name, not terminated
+    unsigned int name_length;
+    unsigned short entry;                   // PC of the S9 record, if has_entry
+    bool has_entry;
+    unsigned short origin_address;          // Address of the last record
+    LoadResult result;                      // Records read and the invalid ones
+} ProgramImage;
+
+// ReloadSummary struct definition, what a reload (ReloadImage()) changed
+typedef struct ReloadSummary {
+    unsigned int ranges;                    // Runs of bytes written
+    unsigned int bytes;                     // Bytes in those runs
+    int lines;                              // Cache lines dropped, in every level
+} ReloadSummary;
+
+// SourceStamp struct definition, what tells whether the .xme a side cache was made from has changed
+typedef struct SourceStamp {
+    unsigned long long size;            // Size of the .xme,
+    long long time;                     // its modification time in seconds
+    long long nanoseconds;              // and nanoseconds (0 where the host has none)
+    unsigned long long inode;           // and its inode (0 where the host has none)
+} SourceStamp;
+
+/*
+* Layout of a .xmb file, in host byte order (little-endian, as the XM-23 memory):
+*   ImageHeader
+*   range_count ImageRange, by increasing address
+*   name_length bytes of S0 name
+*   data_length bytes, the bytes of every range one after the other
+* checksum is the FNV-1a hash of everything after the header.
+*/
+typedef struct ImageHeader {
+    char magic[8];                      // IMAGE_MAGIC
+    unsigned short version;             // IMAGE_VERSION
+    unsigned short flags;               // IMAGE_HAS_ENTRY
+    unsigned short entry;               // PC set by the image
+    unsigned short name_length;
+    unsigned int range_count;
+    unsigned int data_length;
+    unsigned int checksum;
+    unsigned int reserved;
+    SourceStamp source;                 // .xme it was made from, all 0 if unknown
+} ImageHeader;
+
+// ImageRange struct definition, consecutive addresses loaded
+typedef struct ImageRange {
+    unsigned short address;
+    unsigned short reserved;
+    unsigned int length;
+} ImageRange;
+
+#define IMAGE_LOADED(image, address) (((image)->loaded[(address) >> 3] >> ((address) & 7)) & 1)
+
+extern void ClearImage(ProgramImage* image);
+extern void ApplyImage(Machine* m, const ProgramImage* image);
+extern bool StampSource(FILE* source, SourceStamp* stamp);
+extern bool WriteImage(const ProgramImage* image, const char* file_name, const SourceStamp* source);
+extern int LoadImageFile(Machine* m, const char* file_name, const char* source_name);
+extern int ReadImageFile(ProgramImage* image, const char* file_name, const char* source_name);
+extern void ReloadImage(Machine* m, const ProgramImage* image, bool keep_state, ReloadSummary* summary);
+extern bool IsProgramName(const char* file_name);
+extern int ConvertImage(int argc, char* argv[]);
+
+/* Loader.c */
+extern const char* LoadErrorMessages[LOAD_ERRORS];
+extern int ReadRecords(ProgramImage* image, FILE* in_file);
+extern bool LoadProgram(Machine* m, const char* file_name, LoadResult* result);
+extern bool ReloadProgram(Machine* m, const char* file_name, bool keep_state, LoadResult* result, ReloadSummary* summary);
+extern void PrintLoadResult(FILE* out, const char* file_name, const LoadResult* result);
+
+#endif
@@ -0,0 +1,520 @@
+/**
+ * @file Jit.c
+ * @brief x86-64 JIT Backend for Hot XM-23 Blocks
+ *
+ * Once a translated block (Block.c) has run JIT_THRESHOLD times, its runs of register-only
+ * instructions are compiled into native x86-64 segments. A segment loads the XM-23 registers
+ * it uses into host registers r8 to r14, runs the instructions with the matching host
+ * instructions, stores the registers it wrote back to RegFile and saves the host flags only
+ * after the last instruction that writes each PSW flag. Every other instruction (memory
+ * accesses through Bus() and Cache(), branches, byte arithmetic, ADDC/SUBC/DADD, XOR/AND,
+ * anything touching R7) is left to the interpreter.
+ *
+ * Defining JIT_VERIFY (Jit.h) checks every native segment against the interpreter.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "Block.h"
+#include "Jit.h"
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+#define PC_REG 7
+#define HOST(reg) (8 + (reg))   // XM-23 register lives in host register r8 + reg
+#define RAX 0                   // Scratch host register
+
+// x86 encodings used by the emitter
+#define OP_ADD 0x01
+#define OP_OR 0x09
+#define OP_MOV 0x89
+#define OP_XCHG 0x87
+#define EXT_ADD 0
+#define EXT_OR 1
+#define EXT_AND 4
+#define EXT_NOT 2
+#define EXT_NEG 3
+#define MOVZX_8 0xB6
+#define MOVSX_8 0xBE
+
+// Host EFLAGS bits
+#define HOST_CF 0x0001
+#define HOST_ZF 0x0040
+#define HOST_SF 0x0080
+#define HOST_OF 0x0800
+
+/*
+*  purpose   : Releases all native segments. Called when the block cache is flushed.
+*  parameters: m - Machine whose segments are released
+*  return    : None
+*/
+void JitReset(Machine* m) {
+    if (m->jit == NULL) return;
+    m->jit->used = 0;
+    m->jit->segments_used = 0;
+}
+
+/*
+*  purpose   : Unmaps the executable memory and frees the JIT state of a machine
+*  parameters: m - Machine being destroyed
+*  return    : None
+*/
+void JitRelease(Machine* m) {
+    if (m->jit == NULL) return;
+#ifdef JIT_SUPPORTED
+    if (m->jit->code != NULL) munmap(m->jit->code, JIT_CODE_SIZE);
+#endif
+    free(m->jit);
+    m->jit = NULL;
+}
+
+/* ************************************ Code emitter ************************************ */
+
+static void EmitByte(JitState* jit, unsigned char value) {
+    jit->code[jit->used++] = value;
+}
+
+static void Imm16(JitState* jit, unsigned short value) {
+    EmitByte(jit, value & 0xFF);
+    EmitByte(jit, value >> 8);
+}
+
+// REX prefix for a reg / rm pair, left out when no extended register is used
+static void Rex(JitState* jit, int reg, int rm) {
+    unsigned char rex = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40) EmitByte(jit, rex);
+}
+
+// 16-bit "op rm, reg"
+static void OpRR(JitState* jit, unsigned char opcode, int reg, int rm) {
+    EmitByte(jit, 0x66);
+    Rex(jit, reg, rm);
+    EmitByte(jit, opcode);
+    EmitByte(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// 16-bit "op rm, imm16" from the 0x81 group
+static void OpRI(JitState* jit, int ext, int rm, unsigned short imm) {
+    EmitByte(jit, 0x66);
+    Rex(jit, 0, rm);
+    EmitByte(jit, 0x81);
+    EmitByte(jit, 0xC0 | ext << 3 | (rm & 7));
+    Imm16(jit, imm);
+}
+
+static void MovRI(JitState* jit, int rm, unsigned short imm) {
+    EmitByte(jit, 0x66);
+    Rex(jit, 0, rm);
+    EmitByte(jit, 0xB8 | (rm & 7));
+    Imm16(jit, imm);
+}
+
+// 16-bit "not rm" / "neg rm"
+static void Unary(JitState* jit, int ext, int rm) {
+    EmitByte(jit, 0x66);
+    Rex(jit, 0, rm);
+    EmitByte(jit, 0xF7);
+    EmitByte(jit, 0xC0 | ext << 3 | (rm & 7));
+}
+
+// 16-bit "rol rm, 8" (swap bytes)
+static void SwapBytes(JitState* jit, int rm) {
+    EmitByte(jit, 0x66);
+    Rex(jit, 0, rm);
+    EmitByte(jit, 0xC1);
+    EmitByte(jit, 0xC0 | (rm & 7));
+    EmitByte(jit, 8);
+}
+
+// 16-bit "movzx / movsx reg, rm8"
+static void Extend(JitState* jit, unsigned char opcode, int reg, int rm) {
+    EmitByte(jit, 0x66);
+    Rex(jit, reg, rm);
+    EmitByte(jit, 0x0F);
+    EmitByte(jit, opcode);
+    EmitByte(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// movzx reg32, word [rdi + 2 * xm_reg]
+static void LoadReg(JitState* jit, int xm_reg) {
+    Rex(jit, HOST(xm_reg), 0);
+    EmitByte(jit, 0x0F);
+    EmitByte(jit, 0xB7);
+    EmitByte(jit, 0x47 | (HOST(xm_reg) & 7) << 3);
+    EmitByte(jit, 2 * xm_reg);
+}
+
+// mov word [rdi + 2 * xm_reg], reg16
+static void StoreReg(JitState* jit, int xm_reg) {
+    EmitByte(jit, 0x66);
+    Rex(jit, HOST(xm_reg), 0);
+    EmitByte(jit, OP_MOV);
+    EmitByte(jit, 0x47 | (HOST(xm_reg) & 7) << 3);
+    EmitByte(jit, 2 * xm_reg);
+}
+
+// push / pop of a callee saved host register
+static void Push(JitState* jit, int reg) {
+    Rex(jit, 0, reg);
+    EmitByte(jit, 0x50 | (reg & 7));
+}
+
+static void Pop(JitState* jit, int reg) {
+    Rex(jit, 0, reg);
+    EmitByte(jit, 0x58 | (reg & 7));
+}
+
+// pushfq; pop rax; mov [rsi + 8 * slot], rax
+static void CaptureFlags(JitState* jit, int slot) {
+    EmitByte(jit, 0x9C);
+    EmitByte(jit, 0x58);
+    EmitByte(jit, 0x48);
+    EmitByte(jit, 0x89);
+    EmitByte(jit, 0x46);
+    EmitByte(jit, 8 * slot);
+}
+
+/* ************************************ Compiler ************************************ */
+
+/*
+*  purpose   : Checks if the JIT can compile an instruction. R7 is never compiled since its value
+*              depends on where the instruction is.
+*  parameters: instr - Decoded instruction
+*  return    : true if EmitInstruction() handles it
+*/
+static bool JitSupported(const DecodedInstr* instr) {
+    if (instr->dst == PC_REG) return false;
+
+    if (instr->handler == Movs || instr->handler == SwapPB) return true;
+    if (instr->handler == SignChange) return instr->op == SXT || instr->word_byte == WORD;
+    if (instr->handler == Mov_SWAP) return instr->src != PC_REG;
+    if (instr->handler == Arithmetic) {
+        if (instr->word_byte != WORD || (instr->reg_const == REG && instr->src == PC_REG)) return false;
+        return instr->op == ADD || instr->op == SUB || instr->op == CMP || instr->op == OR;
+    }
+    return false;
+}
+
+// Arithmetic instructions that also call Addc() and set C and V
+static bool SetsCarry(const DecodedInstr* instr) {
+    return instr->handler == Arithmetic && instr->op != OR;
+}
+
+static bool SetsZero(const DecodedInstr* instr) {
+    return instr->handler == Arithmetic;
+}
+
+/*
+*  purpose   : Emits the host instructions for one supported XM-23 instruction
+*  parameters: m - Machine the instructions run on
+*              instr - Decoded instruction
+*  return    : None
+*/
+static void EmitInstruction(Machine* m, const DecodedInstr* instr) {
+    JitState* jit = m->jit;
+    int dst = HOST(instr->dst);
+    int src = HOST(instr->src);
+    unsigned short constant = m->reg_file[1][instr->src];
+
+    if (instr->handler == Movs) {
+        switch (instr->op) {
+        case MOVL:
+            OpRI(jit, EXT_AND, dst, SET_HI);
+            if (instr->offset) OpRI(jit, EXT_OR, dst, instr->offset);
+            break;
+        case MOVLZ:
+            MovRI(jit, dst, instr->offset);
+            break;
+        case MOVLS:
+            MovRI(jit, dst, SET_HI | instr->offset);
+            break;
+        case MOVH:
+            OpRI(jit, EXT_AND, dst, SET_LOW);
+            if (instr->offset) OpRI(jit, EXT_OR, dst, instr->offset);
+            break;
+        }
+    }
+    else if (instr->handler == Mov_SWAP) {
+        if (instr->op == SWAP) {
+            if (src != dst) OpRR(jit, OP_XCHG, src, dst);
+        }
+        else if (instr->word_byte == BYTE) Extend(jit, MOVZX_8, dst, src);
+        else if (src != dst) OpRR(jit, OP_MOV, src, dst);
+    }
+    else if (instr->handler == SwapPB) {
+        SwapBytes(jit, dst);
+    }
+    else if (instr->handler == SignChange) {
+        if (instr->op == SXT) Extend(jit, MOVSX_8, dst, dst);
+        else Unary(jit, EXT_NOT, dst);
+    }
+    else {
+        /*
+        * SUB and CMP are emulated as dst + (-src), the same sum update_psw() gets its carry
+        * and overflow from, so the host CF and OF match the PSW tables.
+        */
+        switch (instr->op) {
+        case ADD:
+            if (instr->reg_const) OpRI(jit, EXT_ADD, dst, constant);
+            else OpRR(jit, OP_ADD, src, dst);
+            break;
+        case SUB:
+            if (instr->reg_const) OpRI(jit, EXT_ADD, dst, -constant);
+            else {
+                OpRR(jit, OP_MOV, src, RAX);
+                Unary(jit, EXT_NEG, RAX);
+                OpRR(jit, OP_ADD, RAX, dst);
+            }
+            break;
+        case CMP:
+            if (instr->reg_const) {
+                OpRR(jit, OP_MOV, dst, RAX);
+                OpRI(jit, EXT_ADD, RAX, -constant);
+            }
+            else {
+                OpRR(jit, OP_MOV, src, RAX);
+                Unary(jit, EXT_NEG, RAX);
+                OpRR(jit, OP_ADD, dst, RAX);
+            }
+            break;
+        case OR:
+            if (instr->reg_const) OpRI(jit, EXT_OR, dst, constant);
+            else OpRR(jit, OP_OR, src, dst);
+            break;
+        }
+    }
+}
+
+/*
+*  purpose   : Marks the XM-23 registers an instruction reads (or writes) in a bit mask
+*  parameters: instr - Decoded instruction
+*              writes - true for the registers written, false for the registers read
+*  return    : Register bit mask
+*/
+static unsigned RegisterMask(const DecodedInstr* instr, bool writes) {
+    unsigned dst = 1u << instr->dst;
+    unsigned src = 1u << instr->src;
+
+    if (instr->handler == Mov_SWAP) {
+        if (instr->op == SWAP) return src | dst;
+        return writes ? dst : src;
+    }
+    if (instr->handler == Arithmetic) {
+        if (writes) return (instr->op == CMP) ? 0 : dst;
+        return instr->reg_const ? dst : src | dst;
+    }
+    return dst;
+}
+
+/*
+*  purpose   : Compiles instructions first .. first + count - 1 of a block into a native segment
+*  parameters: m - Machine the instructions run on
+*              block - Block the instructions belong to
+*              first - Index of the first instruction
+*              count - Number of instructions
+*  return    : The new segment, NULL when the code or segment space is used up
+*/
+static JitSegment* EmitSegment(Machine* m, Block* block, int first, int count) {
+    JitState* jit = m->jit;
+    const DecodedInstr* const* ops = &block->ops[first];
+    unsigned used = 0, written = 0;
+    int last_carry = -1, last_zero = -1;
+    JitSegment* segment;
+
+    // Longest host sequence per instruction is 12 bytes, plus loads, stores and flag captures
+    if (jit->segments_used == JIT_MAX_SEGMENTS || jit->used + 16 * count + 128 > JIT_CODE_SIZE) return NULL;
+    segment = &jit->segments[jit->segments_used++];
+    segment->code = (JitCode)&jit->code[jit->used];
+    segment->ops = ops;
+    segment->first = first;
+    segment->count = count;
+    segment->captures = 0;
+    segment->cycles = 0;
+    segment->next = NULL;
+
+    for (int i = 0; i < count; i++) {
+        used |= RegisterMask(ops[i], false) | RegisterMask(ops[i], true);
+        written |= RegisterMask(ops[i], true);
+        if (SetsCarry(ops[i])) last_carry = i;
+        if (SetsZero(ops[i])) last_zero = i;
+
+        // Fetch (Bus + 1), handler, decode; Addc() adds one more
+        segment->cycles += 5 + 1 + (SetsCarry(ops[i]) ? 1 : 0);
+    }
+
+    // Prologue: r12 to r14 are callee saved
+    for (int reg = 4; reg < PC_REG; reg++) {
+        if (used & (1u << reg)) Push(jit, HOST(reg));
+    }
+    for (int reg = 0; reg < PC_REG; reg++) {
+        if (used & (1u << reg)) LoadReg(jit, reg);
+    }
+
+    for (int i = 0; i < count; i++) {
+        unsigned char flags = 0;
+
+        EmitInstruction(m, ops[i]);
+        // Only the last writer of each flag can be read after the segment
+        if (i == last_carry) flags |= JIT_C | JIT_V;
+        if (i == last_zero) flags |= JIT_Z | JIT_N;
+        if (flags) {
+            CaptureFlags(jit, segment->captures);
+            segment->capture_flags[segment->captures++] = flags;
+        }
+    }
+
+    // Epilogue
+    for (int reg = 0; reg < PC_REG; reg++) {
+        if (written & (1u << reg)) StoreReg(jit, reg);
+    }
+    for (int reg = PC_REG - 1; reg >= 4; reg--) {
+        if (used & (1u << reg)) Pop(jit, HOST(reg));
+    }
+    EmitByte(jit, 0xC3);
+
+    return segment;
+}
+
+/*
+*  purpose   : Allocates the JIT state and maps the executable memory of a machine on first use
+*  parameters: m - Machine compiling a block
+*  return    : true if native code can be emitted
+*/
+static bool JitAvailable(Machine* m) {
+#ifdef JIT_SUPPORTED
+    JitState* jit = m->jit;
+
+    if (jit == NULL) {
+        jit = m->jit = calloc(1, sizeof(JitState));
+        if (jit == NULL) return false;
+    }
+    if (jit->code == NULL && !jit->failed) {
+        void* memory = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (memory == MAP_FAILED) {
+            if (!m->headless) printf(YELLOW "Warning: JIT disabled, executable memory could not be mapped\n" RESET);
+            jit->failed = true;
+        }
+        else jit->code = memory;
+    }
+    return jit->code != NULL;
+#else
+    return false;
+#endif
+}
+
+/*
+*  purpose   : Compiles every run of at least JIT_MIN_SEGMENT supported instructions in a block.
+*              The segments are linked from block->native in instruction order. Segments charge
+*              flat fetch cycles and do not trace their fetches, so nothing is compiled while an L1
+*              instruction cache times fetches or a trace records them.
+*  parameters: m - Machine the block belongs to
+*              block - Hot block
+*  return    : None
+*/
+void JitCompileBlock(Machine* m, Block* block) {
+    JitSegment** tail = &block->native;
+    int i = 0;
+
+    if (m->fetch_level != NULL || m->trace != NULL || !JitAvailable(m)) return;
+
+    while (i < block->length) {
+        int count = 0;
+
+        while (i + count < block->length && JitSupported(block->ops[i + count])) count++;
+        if (count >= JIT_MIN_SEGMENT) {
+            JitSegment* segment = EmitSegment(m, block, i, count);
+
+            if (segment == NULL) return;
+            *tail = segment;
+            tail = &segment->next;
+        }
+        i += (count > 0) ? count : 1;
+    }
+}
+
+/*
+*  purpose   : Copies the captured host flags into a PSW
+*  parameters: segment - Segment that ran
+*              host_flags - Captured EFLAGS values
+*              status - PSW to update
+*  return    : None
+*/
+static void ApplyFlags(const JitSegment* segment, const unsigned long long* host_flags, psw_bits* status) {
+    for (int i = 0; i < segment->captures; i++) {
+        unsigned char flags = segment->capture_flags[i];
+
+        if (flags & JIT_C) status->c = (host_flags[i] & HOST_CF) != 0;
+        if (flags & JIT_Z) status->z = (host_flags[i] & HOST_ZF) != 0;
+        if (flags & JIT_N) status->n = (host_flags[i] & HOST_SF) != 0;
+        if (flags & JIT_V) status->v = (host_flags[i] & HOST_OF) != 0;
+    }
+}
+
+/*
+*  purpose   : Runs the instructions of a segment on the interpreter, as Control() would
+*  parameters: m - Machine the instructions run on
+*              segment - Segment to interpret
+*  return    : None
+*/
+static void InterpretSegment(Machine* m, const JitSegment* segment) {
+    for (int i = 0; i < segment->count; i++) {
+        m->instr_reg = segment->ops[i]->word;
+        FETCH_MEMORY(m, PC);
+        PC = PC + 2;
+        m->cpu_clock += 2;
+        segment->ops[i]->handler(m, segment->ops[i]);
+    }
+}
+
+/*
+*  purpose   : Runs a native segment and charges the cycles, PC and instruction register the
+*              interpreter would have. With JIT_VERIFY the interpreter runs too, and a segment
+*              whose results differ is reported and disabled.
+*  parameters: m - Machine the instructions run on
+*              segment - Segment to run
+*  return    : None
+*/
+void JitRunSegment(Machine* m, JitSegment* segment) {
+    unsigned long long host_flags[2];
+
+    if (segment->code == NULL) {
+        InterpretSegment(m, segment);
+        return;
+    }
+#ifdef JIT_VERIFY
+    unsigned short native_regs[NUM_REG];
+    psw_bits native_psw;
+    unsigned long long clock = m->cpu_clock;
+
+    SyncPsw(m);
+    native_psw = m->psw;
+
+    memcpy(native_regs, m->reg_file[REG], sizeof(native_regs));
+    segment->code(native_regs, host_flags);
+    ApplyFlags(segment, host_flags, &native_psw);
+    native_regs[PC_REG] += 2 * segment->count;
+    InterpretSegment(m, segment);
+    SyncPsw(m);
+
+    if (memcmp(native_regs, m->reg_file[REG], sizeof(native_regs)) != 0 || m->cpu_clock - clock != segment->cycles || native_psw.c != m->psw.c ||
+        native_psw.z != m->psw.z || native_psw.n != m->psw.n || native_psw.v != m->psw.v) {
+        printf(RED "JIT mismatch: segment of %d instructions ending at %04X, segment disabled\n" RESET, segment->count, PC);
+        segment->code = NULL;
+    }
+#else
+    segment->code(m->reg_file[REG], host_flags);
+    if (segment->captures) {
+        SyncPsw(m);
+        ApplyFlags(segment, host_flags, &m->psw);
+    }
+    PC = PC + 2 * segment->count;
+    m->cpu_clock += segment->cycles;
+    m->instr_reg = segment->ops[segment->count - 1]->word;
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+* This is the header file for the x86-64 JIT backend.
+* Hot blocks are scanned for runs of register-only instructions, and each run is compiled into a
+* native segment. XM-23 registers R0 to R6 live in host registers r8 to r14 while a segment runs,
+* and the PSW is taken from the host flags of the last instruction that writes each flag.
+* Anything else (memory accesses, branches, byte arithmetic, R7) stays on the interpreter.
+*/
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "emulator.h"
+
+// Uncomment to run every native segment side by side with the interpreter and compare the results
+// #define JIT_VERIFY
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+// Defining constants
+#define JIT_THRESHOLD 64          // Block runs before it is compiled
+#define JIT_MIN_SEGMENT 2         // Shortest run of instructions worth compiling
+#define JIT_CODE_SIZE (1 << 20)   // Bytes of executable memory
+#define JIT_MAX_SEGMENTS 16384    // Segments kept before the block cache is flushed
+
+// PSW flags a flag capture provides
+#define JIT_C 0x01
+#define JIT_Z 0x02
+#define JIT_N 0x04
+#define JIT_V 0x08
+
+struct Block;
+
+typedef void (*JitCode)(unsigned short* regs, unsigned long long* host_flags);
+
+// JitSegment struct definition
+typedef struct JitSegment {
+    JitCode code;                       // Native code, NULL once disabled by JIT_VERIFY
+    const DecodedInstr* const* ops;     // Instructions the segment replaces
+    unsigned char first;                // Index of the first instruction in the block
+    unsigned char count;                // Number of instructions
+    unsigned char captures;             // Host flag captures written by the code
+    unsigned char capture_flags[2];     // PSW flags (JIT_C ...) taken from each capture
+    unsigned int cycles;                // Clock cycles charged for the whole segment
+    struct JitSegment* next;            // Next segment in the same block
+} JitSegment;
+
+// JitState struct definition, allocated the first time a block of a machine is compiled (m->jit)
+typedef struct JitState {
+    unsigned char* code;                        // Executable memory, NULL until first needed
+    size_t used;                                // Bytes of code handed out
+    bool failed;                                // Executable memory could not be mapped
+    JitSegment segments[JIT_MAX_SEGMENTS];
+    int segments_used;
+} JitState;
+
+extern void JitReset(Machine* m);
+extern void JitRelease(Machine* m);
+extern void JitCompileBlock(Machine* m, struct Block* block);
+extern void JitRunSegment(Machine* m, JitSegment* segment);
+
+#endif
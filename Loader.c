@@ -7,34 +7,61 @@
  * data length, address and data. This information is used to populate
  * memory and setup the initial program counter (PC) for the emulator.
  *
- * Note: Only S0, S1, and S9 records are supported.
+ * Supported records: S0 (name), S1, S2 and S3 (data, 16, 24 and 32-bit addresses), S5 and S6
+ * (count of the data records before them) and S7, S8 and S9 (entry PC). The XM-23 has 64 KiB
+ * of memory, so S2, S3, S7 and S8 addresses must be below 0x10000.
+ *
+ * The file is read in chunks of LOAD_CHUNK_SIZE bytes and split into lines as it streams, so it
+ * can be a pipe or stdin ("-") and lines of any length are read: a line longer than any record
+ * is reported and skipped. Each record is decoded with a table of hex digits, its checksum is
+ * added up over the decoded bytes and its payload is copied at once. Invalid records are kept in a
+ * LoadResult (line, type, what is wrong) instead of being printed; PrintLoadResult() prints them.
+ *
+ * Records are read into a program image (Image.h) first, then put in the machine. Binary
+ * images (.xmb) and the side cache kept beside each .xme are in Image.c. Loading goes straight to
+ * memory, not through the Bus, so it does not advance the CPU clock.
  *
  * This is part of the coursework for ECED3403 - Computer Architecture, Assignment 1.
  *
  * @author Omar Hameed
  * @date Last updated on June 16, 2023
  *
- * 
+ *
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "emulator.h"
+#include "Image.h"
+
+#define STRINGIFY(x) #x
+#define FIELD_WIDTH(x) STRINGIFY(x)
 
-unsigned char testing_input[MAXBufSize]; // Define testing_input variable
+const char* LoadErrorMessages[LOAD_ERRORS] = {
+    "not an S-record", "unsupported record type", "malformed record", "line longer than any record",
+    "invalid checksum", "address outside the 64 KiB memory", "record count does not match"
+};
+
+// Bytes of the address field of each record type, 0 for S4 and anything that is not a type
+static const unsigned char AddressBytes[256] = {
+    ['0'] = 2, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['5'] = 2, ['6'] = 3, ['7'] = 4, ['8'] = 3, ['9'] = 2
+};
 
 /*
  *   Purpose:
- *          Opens a .XME file and loads it into memory. If no file is provided via command-line
- *          arguments, it prompts the user for a file name. If the file fails to open, it allows
- *          for retry up to three times. It calls ReadFile() function for reading the file content.
+ *          Opens a .XME (or binary .XMB) file and loads it into memory. If no file is provided via command-line
+ *          arguments, it prompts the user for a file name and allows for retry up to three times.
+ *          A name given on the command line is not asked for again. "-" reads the records from stdin.
+ *          It calls LoadFile() function for reading the file content.
  *  Parameters:
+ *          Machine* m: machine whose memory the file is loaded into.
  *          int argc: number of strings pointed to by argv.
  *          char* argv[]: command-line arguments.
  */
-int OpenLoadF(int argc, char* argv[]) {
+int OpenLoadF(Machine* m, int argc, char* argv[]) {
     char* file_name;
-    char buffer[MAX_FILE_NAME];
-    FILE* in_file = NULL;
+    char buffer[MAX_FILE_NAME + 1];
     int max_trials = 3;
     int trials = 0;
 
@@ -43,131 +70,437 @@ int OpenLoadF(int argc, char* argv[]) {
             file_name = argv[1];
         }
         else {
-            printf("Enter the name of the .XME file to read: ");
-            scanf("%s", buffer);
+            printf("Enter the name of the .XME file to read (- for standard input): ");
+            if (scanf(" %" FIELD_WIDTH(MAX_FILE_NAME) "[^\n]", buffer) != 1) break;
             file_name = buffer;
         }
-        size_t name_length = strlen(file_name);
-
-        // Check if the file has the correct extension
-        if (name_length < 5 || strcmp(&file_name[name_length - 4], ".xme") != 0) {
-            printf("Error: Invalid file extension. The file should have a .xme extension, try again \n");
 
-            trials++;
-            continue;  // Continue to the next iteration of the loop
-        }
-        in_file = fopen(file_name, "r");
-        if (in_file != NULL) {
+        if (LoadFile(m, file_name) >= 0) {
             printf("XME File read successfully\n");
-            break;  // Exit the loop since the file was successfully opened
+            return 0;  // Return success
         }
-        else {
-            printf("Failed to open the file, try again\n");
-            trials++;
+        if (argc >= 2) {
+            return 1;
         }
+        printf("Try again\n");
+        trials++;
     }
 
-    if (trials == max_trials) {
-        printf("Maximum number of trials reached.\n Exiting the program.\n");
-        return 1;  // Return an error code
-    }
-    ReadFile(in_file);
+    printf("Maximum number of trials reached.\n Exiting the program.\n");
+    return 1;  // Return an error code
+}
+/*
+ *   Purpose:
+ *          Loads a .XME or .XMB file without prompting or retrying, for runs with no console
+ *          (batch farm). Messages are printed only if the machine is not headless.
+ *  Parameters:
+ *          Machine* m: machine whose memory the file is loaded into.
+ *          const char* file_name: name of the .XME or .XMB file, "-" for stdin.
+ *  Returns:
+ *          Number of invalid records read, -1 if the file could not be loaded.
+ */
+int LoadFile(Machine* m, const char* file_name) {
+    LoadResult result;
+    bool loaded = LoadProgram(m, file_name, &result);
 
+    if (!m->headless) PrintLoadResult(stdout, file_name, &result);
+    return loaded ? result.bad_records : -1;
+}
+
+/*
+ *   Purpose:
+ *          Tells whether a file name ends with an extension.
+ *  Parameters:
+ *          const char* file_name: file name.
+ *          const char* extension: extension, with its dot.
+ */
+static bool HasExtension(const char* file_name, const char* extension) {
+    size_t name_length = strlen(file_name);
+    size_t extension_length = strlen(extension);
 
-    return 0;  // Return success
+    return name_length > extension_length && strcmp(&file_name[name_length - extension_length], extension) == 0;
 }
+
 /*
  *   Purpose:
- *              Read an S-record file.
- *              It reads the file line by line and depending on the record type,
- *              it performs different operations like writing to memory or setting the PC.
- *   Parameters:
- *              FILE* in_file: Pointer to the file object of the file to be read.
+ *          Gives the name of the side cache of a .XME, the same name with .XMB.
+ *  Parameters:
+ *          const char* file_name: name of the .XME.
+ *  Returns:
+ *          Name allocated with malloc(), NULL if there is no memory for it.
  */
-void ReadFile(FILE* in_file) {
-    unsigned int number_of_s1s = 0;
-    
-    while (fgets(testing_input, MAXBufSize, in_file) != NULL) {
-        unsigned char CheckSum = 0;
-        unsigned int address_lo;
-        unsigned int address_hi;
-        int length;
-        if (testing_input[0] != 'S') {
-            printf("ERROR: %s IS Not a valid S-record \n", testing_input);
+static char* SideCacheName(const char* file_name) {
+    size_t name_length = strlen(file_name);
+    char* cache_name = malloc(name_length + sizeof(IMAGE_EXTENSION));
+
+    if (cache_name == NULL) return NULL;
+    strcpy(cache_name, file_name);
+    strcpy(&cache_name[name_length - strlen(SRECORD_EXTENSION)], IMAGE_EXTENSION);
+    return cache_name;
+}
+
+/*
+ *   Purpose:
+ *          Parses an S-record file into a program image, and writes its side cache when it has
+ *          no invalid records.
+ *  Parameters:
+ *          ProgramImage* image: program image filled, cleared first.
+ *          const char* file_name: name of the file, "-" for stdin.
+ *          const char* cache_name: side cache written, NULL for none.
+ *          LoadResult* result: set to the status of the load and its invalid records.
+ *  Returns:
+ *          true if the file was read, possibly with invalid records.
+ */
+static bool ParseProgram(ProgramImage* image, const char* file_name, const char* cache_name, LoadResult* result) {
+    bool from_stdin = strcmp(file_name, STDIN_NAME) == 0;
+    FILE* in_file = from_stdin ? stdin : fopen(file_name, "rb");
+    SourceStamp source;
+
+    if (in_file == NULL) {
+        result->status = LOAD_NOT_OPENED;
+        return false;
+    }
+    // Stamped before reading: an edit made while parsing leaves the side cache stale
+    if (cache_name != NULL && (from_stdin || !StampSource(in_file, &source))) cache_name = NULL;
+    ClearImage(image);
+    ReadRecords(image, in_file);
+    if (!from_stdin) fclose(in_file);
+    *result = image->result;
+    if (cache_name != NULL && result->status == LOAD_LOADED && result->bad_records == 0) WriteImage(image, cache_name, &source);
+    return result->status == LOAD_LOADED;
+}
+
+/*
+ *   Purpose:
+ *          Loads a file into a machine and says what was found, printing nothing but the S0 name
+ *          (when the machine is not headless).
+ *          A .XMB is mapped and copied (Image.c). Anything else is read as S-records, "-" from
+ *          stdin. With IMAGE_CACHE, a .XME is loaded from the .XMB beside it while that is up to
+ *          date, and one is written after parsing it otherwise.
+ *  Parameters:
+ *          Machine* m: machine whose memory the file is loaded into.
+ *          const char* file_name: name of the file, "-" for stdin.
+ *          LoadResult* result: set to the status of the load and its invalid records.
+ *  Returns:
+ *          true if the file was loaded, possibly with invalid records.
+ */
+bool LoadProgram(Machine* m, const char* file_name, LoadResult* result) {
+    char* cache_name = NULL;
+    ProgramImage* image;
+
+    memset(result, 0, sizeof(*result));
+    if (HasExtension(file_name, IMAGE_EXTENSION)) {
+        if (LoadImageFile(m, file_name, NULL) != 0) result->status = LOAD_INVALID_IMAGE;
+        return result->status == LOAD_LOADED;
+    }
+
+#ifdef IMAGE_CACHE
+    if (HasExtension(file_name, SRECORD_EXTENSION)) {
+        cache_name = SideCacheName(file_name);
+        if (cache_name == NULL) {
+            result->status = LOAD_NO_MEMORY;
+            return false;
         }
-        else if (testing_input[1] != '0' && testing_input[1] != '1' && testing_input[1] != '9') {
-            printf("ERROR: %s IS Not a supported S-record only S0, S1, S9\n", testing_input);
+        if (LoadImageFile(m, cache_name, file_name) == 0) {
+            free(cache_name);
+            return true;
         }
+    }
+#endif
 
-        sscanf(&testing_input[2], "%2x", &length);
-        sscanf(&testing_input[4], "%2x%2x", &address_hi, &address_lo);
+    image = malloc(sizeof(ProgramImage));
+    if (image == NULL) result->status = LOAD_NO_MEMORY;
+    else if (ParseProgram(image, file_name, cache_name, result)) {
+        ApplyImage(m, image);
+        if (!m->headless && image->name_length > 0) printf("FILE NAME: %.*s\n", (int)image->name_length, image->name);
+    }
+    free(image);
+    free(cache_name);
+    return result->status == LOAD_LOADED;
+}
 
-        origin_address = (address_hi << 8) | address_lo;
-        int data_length = (length * 2);
-        CheckSum = (unsigned char)address_lo + (unsigned char)address_hi + (unsigned char)length;
+/*
+ *   Purpose:
+ *          Loads a file again into a machine that already holds a program (the NF command),
+ *          writing only the bytes that changed and dropping only the cache lines and decoded
+ *          instructions of those bytes (ReloadImage()). The file is read as LoadProgram() reads
+ *          it, .XMB, side cache or S-records. Nothing is changed if it cannot be read.
+ *  Parameters:
+ *          Machine* m: machine whose memory the file is loaded into.
+ *          const char* file_name: name of the file, "-" for stdin.
+ *          bool keep_state: true to keep the registers, PSW, clock and counters, false to start
+ *                           over from the entry of the new program.
+ *          LoadResult* result: set to the status of the load and its invalid records.
+ *          ReloadSummary* summary: set to what was changed.
+ *  Returns:
+ *          true if the file was loaded, possibly with invalid records.
+ */
+bool ReloadProgram(Machine* m, const char* file_name, bool keep_state, LoadResult* result, ReloadSummary* summary) {
+    ProgramImage* image = malloc(sizeof(ProgramImage));
+    char* cache_name = NULL;
+    bool read;
 
-#ifdef DEBUG
-        printf("Payload Length: %i bytes \n", data_length);
+    memset(result, 0, sizeof(*result));
+    memset(summary, 0, sizeof(*summary));
+    if (image == NULL) {
+        result->status = LOAD_NO_MEMORY;
+        return false;
+    }
+
+    if (HasExtension(file_name, IMAGE_EXTENSION)) {
+        read = ReadImageFile(image, file_name, NULL) == 0;
+        if (!read) result->status = LOAD_INVALID_IMAGE;
+    }
+    else {
+#ifdef IMAGE_CACHE
+        if (HasExtension(file_name, SRECORD_EXTENSION)) cache_name = SideCacheName(file_name);
 #endif
+        read = (cache_name != NULL && ReadImageFile(image, cache_name, file_name) == 0)
+            || ParseProgram(image, file_name, cache_name, result);
+    }
 
-        if (testing_input[1] == '0') {
-            // Display File Nom
-            unsigned int filename;
-            int test = 0;
-            printf("FILE NAME: ");
-            for (int i = 8; i < data_length + 2; i += 2) {
-                sscanf(&testing_input[i], "%02x", &filename);
-                printf("%c", filename);
-                CheckSum += filename;
-            }
-            printf("\n");
+    if (read) {
+        if (!m->headless && image->name_length > 0) printf("FILE NAME: %.*s\n", (int)image->name_length, image->name);
+        ReloadImage(m, image, keep_state, summary);
+    }
+    free(image);
+    free(cache_name);
+    return read;
+}
 
+/*
+ *   Purpose:
+ *          Prints why a file could not be loaded, or its invalid records.
+ *  Parameters:
+ *          FILE* out: file printed to.
+ *          const char* file_name: name of the file loaded.
+ *          const LoadResult* result: what LoadProgram() found.
+ */
+void PrintLoadResult(FILE* out, const char* file_name, const LoadResult* result) {
+    switch (result->status) {
+    case LOAD_NOT_OPENED: fprintf(out, "Failed to open %s\n", file_name); return;
+    case LOAD_NO_MEMORY: fprintf(out, "Not enough memory to load %s\n", file_name); return;
+    case LOAD_INVALID_IMAGE: fprintf(out, "Failed to load %s, it is not a valid binary image\n", file_name); return;
+    }
+    int listed = 0; // Records with a problem printed
+    for (int i = 0; i < result->problem_count; i++) {
+        const LoadProblem* problem = &result->problems[i];
 
+        if (i == 0 || problem->line != result->problems[i - 1].line) listed++;
 
-        }
+        if (problem->type == '?') fprintf(out, "ERROR: %s line %lu: %s\n", file_name, problem->line, LoadErrorMessages[problem->error]);
+        else fprintf(out, "ERROR: %s line %lu (S%c): %s\n", file_name, problem->line, problem->type, LoadErrorMessages[problem->error]);
+    }
+    if (result->bad_records > listed)
+        fprintf(out, "ERROR: %s: %d more invalid records\n", file_name, result->bad_records - listed);
+}
 
-        else if (testing_input[1] == '1') {
-            /*The program must extract the address of the first byte in the record. Subsequent
-            data bytes are stored in contiguous locations. If there is already a value in a memory location, it must
-            be overwritten.
-            */
-            unsigned short byte;
-            int loop_end = data_length + 2;
-            int iter_adr = origin_address;
-#ifdef DEBUG
-            int data_starting_adress = origin_address;
-                printf("data starting address for S1");
-#endif
-            for (int i = DataStart; i < loop_end; i += 2) {
-                // Writing to address one byte at a time 
-                sscanf(&testing_input[i], "%2hx", &byte);
-                Bus(iter_adr, &byte, 1, 1);
-                CheckSum = (unsigned int)byte + CheckSum;
-                iter_adr += 1;
-            }
+// Value of each hex digit plus one, 0 for every character that is not a hex digit
+static const unsigned char HexDigits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+/*
+ *   Purpose:
+ *              Decodes pairs of hex digits into bytes with one table lookup per digit.
+ *              Every pair is decoded and the invalid digits are only checked once at the end.
+ *   Parameters:
+ *              const char* text: Hex digits, 2 per byte.
+ *              unsigned char* bytes: Decoded bytes.
+ *              int count: Number of bytes.
+ *   Returns:
+ *              true if every character was a hex digit.
+ */
+static bool DecodeHex(const char* text, unsigned char* bytes, int count) {
+    unsigned char invalid = 0;
+
+    for (int i = 0; i < count; i++) {
+        unsigned char high = HexDigits[(unsigned char)text[2 * i]];
+        unsigned char low = HexDigits[(unsigned char)text[2 * i + 1]];
+
+        invalid |= (high == 0) | (low == 0);
+        bytes[i] = (unsigned char)((((high - 1) & 0x0F) << 4) | ((low - 1) & 0x0F));
+    }
+    return !invalid;
+}
+
+/*
+ *   Purpose:
+ *              Copies the payload of a data record into the image in one operation (two if an
+ *              S1 record wraps past the last address) and marks its addresses loaded.
+ *   Parameters:
+ *              ProgramImage* image: image written.
+ *              unsigned short address: Address of the first byte.
+ *              const unsigned char* data: Payload.
+ *              int length: Number of bytes.
+ */
+static void StoreRecord(ProgramImage* image, unsigned short address, const unsigned char* data, int length) {
+    int first = (MEM_SIZE - address < length) ? MEM_SIZE - address : length;
+
+    memcpy(&image->memory[address], data, first);
+    memcpy(image->memory, &data[first], length - first);
+    for (int i = 0; i < length; i++) {
+        unsigned short byte_address = (unsigned short)(address + i);
+
+        image->loaded[byte_address >> 3] |= (unsigned char)(1 << (byte_address & 7));
+    }
+}
+
+/*
+ *   Purpose:
+ *              Counts an invalid record and keeps it while fewer than LOAD_MAX_PROBLEMS are kept.
+ *   Parameters:
+ *              LoadResult* result: result of the load.
+ *              const char* line: the record.
+ *              int error: what is wrong (enum LoadErrors).
+ */
+static void AddProblem(LoadResult* result, const char* line, int error) {
+    // A record can have more than one problem, it is still one invalid record
+    if (result->bad_line != result->records) {
+        result->bad_records++;
+        result->bad_line = result->records;
+    }
+    if (result->problem_count == LOAD_MAX_PROBLEMS) return;
+    result->problems[result->problem_count].line = result->records;
+    result->problems[result->problem_count].type = (line[0] == 'S' && line[1] != '\0') ? line[1] : '?';
+    result->problems[result->problem_count].error = (unsigned char)error;
+    result->problem_count++;
+}
 
+/*
+ *   Purpose:
+ *              Decodes one record at once (count, address, data and checksum) and depending on
+ *              the record type, it performs different operations like loading data or setting
+ *              the entry PC.
+ *   Parameters:
+ *              ProgramImage* image: image the record is loaded into.
+ *              const char* line: the record, terminated, without its end of line.
+ *              size_t line_length: its length.
+ */
+static void ReadRecord(ProgramImage* image, const char* line, size_t line_length) {
+    unsigned char record[SRECORD_MAX_LENGTH / 2]; // Count, address, data and checksum of a record
+    unsigned char CheckSum = 0;
+    unsigned int address_bytes;
+    unsigned long address = 0;
+    int length;
+
+    image->result.records++;
+    if (line[0] != 'S') {
+        AddProblem(&image->result, line, LOAD_NOT_RECORD);
+        return;
+    }
+    address_bytes = AddressBytes[(unsigned char)line[1]];
+    if (address_bytes == 0) {
+        AddProblem(&image->result, line, LOAD_UNSUPPORTED);
+        return;
+    }
+
+    // The count covers the address, the data and the checksum
+    if (line_length < 4 || !DecodeHex(&line[2], record, 1) || record[0] < address_bytes + 1
+        || line_length < 4 + 2 * (size_t)record[0] || !DecodeHex(&line[4], &record[1], record[0])) {
+        AddProblem(&image->result, line, LOAD_MALFORMED);
+        return;
+    }
+    length = record[0];
+    for (int i = 0; i <= length; i++) CheckSum += record[i];
+    for (unsigned int i = 1; i <= address_bytes; i++) address = (address << 8) | record[i];
+    if (CheckSum != 255) AddProblem(&image->result, line, LOAD_BAD_CHECKSUM);
 
+    switch (line[1]) {
+    case '0':
+        // Display File Nom
+        image->name_length = length - 3;
+        memcpy(image->name, &record[3], image->name_length);
+        break;
+    case '1':
+    case '2':
+    case '3':
+        /*The program must extract the address of the first byte in the record. Subsequent
+        data bytes are stored in contiguous locations. If there is already a value in a memory location, it must
+        be overwritten. Only S1 addresses wrap past the last byte of memory.
+        */
+        if (line[1] != '1' && address + (length - address_bytes - 1) > MEM_SIZE) {
+            AddProblem(&image->result, line, LOAD_OUT_OF_RANGE);
+            return;
         }
-        else if (testing_input[1] == '9') {
-            PC = origin_address;
-            //sscanf(&origin_address, "%0hhx", &PC);
+        StoreRecord(image, (unsigned short)address, &record[1 + address_bytes], length - address_bytes - 1);
+        image->result.data_records++;
+        break;
+    case '5':
+    case '6':
+        if (address != image->result.data_records) AddProblem(&image->result, line, LOAD_COUNT_MISMATCH);
+        break;
+    default:
+        if (address >= MEM_SIZE) {
+            AddProblem(&image->result, line, LOAD_OUT_OF_RANGE);
+            return;
+        }
+        image->entry = (unsigned short)address;
+        image->has_entry = true;
 #ifdef DEBUG
-            printf("Adress of PC = %2X\n", PC);
+        printf("Adress of PC = %2X\n", image->entry);
 #endif
+        break;
+    }
+    image->origin_address = (unsigned short)address;
+}
 
+/*
+ *   Purpose:
+ *              Read an S-record file into a program image, reading LOAD_CHUNK_SIZE bytes at a
+ *              time and splitting them into lines as they come, so the file can be a pipe.
+ *              A line longer than SRECORD_MAX_LENGTH is skipped up to its end and reported.
+ *   Parameters:
+ *              ProgramImage* image: image the records are loaded into, its result set.
+ *              FILE* in_file: Pointer to the file object of the file to be read, left open.
+ *   Returns:
+ *              Number of invalid records (unsupported type, malformed or bad checksum).
+ */
+int ReadRecords(ProgramImage* image, FILE* in_file) {
+    char* chunk = malloc(LOAD_CHUNK_SIZE);
+    char testing_input[SRECORD_MAX_LENGTH + 2]; // Line being read, a record and its \r
+    size_t line_length = 0;
+    bool too_long = false;
+    size_t read;
 
-        }
+    if (chunk == NULL) {
+        image->result.status = LOAD_NO_MEMORY;
+        return 0;
+    }
+    do {
+        size_t start = 0;
 
-        int number_of_digits = (length * 2) + 4; // SumOfDigits = (length*2) + header (2) + Count (2)
-        int checksum_postion = data_length + 2;
-        unsigned int checksum_read = 0;
-        sscanf(&testing_input[checksum_postion], "%02x", &checksum_read);
+        read = fread(chunk, 1, LOAD_CHUNK_SIZE, in_file);
+        while (start < read || (read == 0 && (line_length > 0 || too_long))) {
+            const char* newline = memchr(&chunk[start], '\n', read - start);
+            size_t end = (newline != NULL) ? (size_t)(newline - chunk) : read;
+            size_t piece = end - start;
 
-        CheckSum = CheckSum + checksum_read;
-        if (CheckSum != 255) printf("Error: Invalid Checksum\n");
-    }
-    fclose(in_file);
+            // Keep what fits of the line, a longer one is never a record
+            if (piece > sizeof(testing_input) - 1 - line_length) {
+                piece = sizeof(testing_input) - 1 - line_length;
+                too_long = true;
+            }
+            memcpy(&testing_input[line_length], &chunk[start], piece);
+            line_length += piece;
+            start = end + 1;
+            if (newline == NULL && read != 0) break;
 
+            // A whole line, or the last one of the file without its \n
+            if (line_length > 0 && testing_input[line_length - 1] == '\r') line_length--;
+            testing_input[line_length] = '\0';
+            if (too_long || line_length > SRECORD_MAX_LENGTH) {
+                image->result.records++;
+                AddProblem(&image->result, testing_input, LOAD_TOO_LONG);
+            }
+            else ReadRecord(image, testing_input, line_length);
+            line_length = 0;
+            too_long = false;
+        }
+    } while (read != 0);
 
+    free(chunk);
+    return image->result.bad_records;
 }
-
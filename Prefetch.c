@@ -0,0 +1,355 @@
+/**
+ * @file Prefetch.c
+ * @brief Hardware Prefetcher Models for the XM-23 Emulator
+ *
+ * This module holds the prefetchers a cache level (Cache.c) can have, chosen at run time with the
+ * prefetch, degree and distance options:
+ *
+ *  - next:   tagged next-line. A miss, or the first use of a line a prefetch brought, asks for the
+ *            degree lines starting distance lines after it.
+ *  - stride: a reference prediction table indexed by the PC of the load or store. Once an
+ *            instruction has moved by the same stride RPT_CONFIDENT times in a row, each of its
+ *            accesses asks for the degree addresses starting distance strides ahead. LD Rs+ walks
+ *            are found after three accesses.
+ *  - stream: STREAM_BUFFERS stream buffers of degree lines each. A miss no buffer holds
+ *            reallocates the least recently used buffer to the lines starting distance lines after
+ *            it; a miss on the head of a buffer takes the line from it, and the buffer fetches one
+ *            more. Buffered lines stay outside the cache until used, so they never evict anything.
+ *
+ * A prefetch moves its line through the hierarchy as a miss would (Cache.c), but in the
+ * background: the cycles it takes are not charged, they only tell when the line has arrived. The
+ * CPU waits for a line it uses before then. The counters of the level (CacheCounters) count the
+ * prefetches, the useful ones (used after they arrived), the late ones (used before) and the
+ * useless ones (evicted or dropped unused).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "Prefetch.h"
+
+// Names of the prefetchers, the values of the prefetch option
+const char* PrefetcherNames[PREFETCH_COUNT] = { "none", "next", "stride", "stream" };
+
+/*
+*  purpose   : Finds a prefetcher by name
+*  parameters: name - Name, as in PrefetcherNames[]
+*  return    : Prefetcher (enum PrefetcherIds), -1 if there is none by that name
+*/
+int FindPrefetcher(const char* name) {
+    for (int kind = 0; kind < PREFETCH_COUNT; kind++) {
+        if (strcmp(name, PrefetcherNames[kind]) == 0) return kind;
+    }
+    return -1;
+}
+
+/*
+*  purpose   : Allocates the state of a level's prefetcher, empty
+*  parameters: state     - Prefetcher state
+*              kind      - Prefetcher (enum PrefetcherIds), PREFETCH_NONE allocates nothing
+*              degree    - Lines asked for at once, 1 to PREFETCH_MAX_DEGREE
+*              distance  - How far ahead, 1 to PREFETCH_MAX_DISTANCE
+*              lines     - Lines of the level
+*              line_size - Bytes per line of the level
+*  return    : true if it could be allocated, the state is left released otherwise
+*/
+bool InitializePrefetch(PrefetchState* state, int kind, unsigned int degree, unsigned int distance, int lines, unsigned int line_size) {
+    memset(state, 0, sizeof(*state));
+    state->kind = kind;
+    state->degree = degree;
+    state->distance = distance;
+    if (kind == PREFETCH_NONE) return true;
+
+    state->prefetched = calloc(BITMASK_WORDS(lines), sizeof(unsigned long long));
+    state->ready = calloc(lines, sizeof(unsigned long long));
+    if (kind == PREFETCH_STRIDE) state->table = calloc(RPT_ENTRIES, sizeof(RptEntry));
+    if (kind == PREFETCH_STREAM) {
+        state->buffers = calloc(STREAM_BUFFERS, sizeof(StreamBuffer));
+        for (int i = 0; state->buffers != NULL && i < STREAM_BUFFERS; i++) {
+            state->buffers[i].data = malloc(degree * line_size);
+            if (state->buffers[i].data == NULL) {
+                ReleasePrefetch(state);
+                return false;
+            }
+        }
+    }
+    if (state->prefetched == NULL || state->ready == NULL || (kind == PREFETCH_STRIDE && state->table == NULL) ||
+        (kind == PREFETCH_STREAM && state->buffers == NULL)) {
+        ReleasePrefetch(state);
+        return false;
+    }
+    return true;
+}
+
+/*
+*  purpose   : Empties a prefetcher, as for an empty cache
+*  parameters: state - Prefetcher state
+*              lines - Lines of the level
+*  return    : None
+*/
+void ResetPrefetch(PrefetchState* state, int lines) {
+    if (state->kind == PREFETCH_NONE) return;
+    memset(state->prefetched, 0, BITMASK_WORDS(lines) * sizeof(unsigned long long));
+    if (state->table != NULL) memset(state->table, 0, RPT_ENTRIES * sizeof(RptEntry));
+    for (int i = 0; state->buffers != NULL && i < STREAM_BUFFERS; i++) {
+        state->buffers[i].count = 0;
+        state->buffers[i].used = 0;
+    }
+}
+
+/*
+*  purpose   : Makes every prefetch asked for so far count as arrived, for a clock set back to 0
+*              (ResetMachineState()). The prefetched lines, stream buffers and training are kept.
+*  parameters: state - Prefetcher state
+*              lines - Lines of the level
+*  return    : None
+*/
+void ClearPrefetchTimes(PrefetchState* state, int lines) {
+    if (state->kind == PREFETCH_NONE) return;
+    memset(state->ready, 0, lines * sizeof(unsigned long long));
+    for (int i = 0; state->buffers != NULL && i < STREAM_BUFFERS; i++) {
+        memset(state->buffers[i].ready, 0, sizeof(state->buffers[i].ready));
+        state->buffers[i].used = 0;
+    }
+}
+
+/*
+*  purpose   : Frees the state of a prefetcher, leaving none
+*  parameters: state - Prefetcher state
+*  return    : None
+*/
+void ReleasePrefetch(PrefetchState* state) {
+    free(state->prefetched);
+    free(state->ready);
+    free(state->table);
+    for (int i = 0; state->buffers != NULL && i < STREAM_BUFFERS; i++) free(state->buffers[i].data);
+    free(state->buffers);
+    memset(state, 0, sizeof(*state));
+}
+
+/*
+*  purpose   : Copies the state of a prefetcher into another of the same kind and degree
+*  parameters: to        - Prefetcher state overwritten
+*              from      - Prefetcher state copied
+*              lines     - Lines of the level
+*              line_size - Bytes per line of the level
+*  return    : None
+*/
+void CopyPrefetch(PrefetchState* to, const PrefetchState* from, int lines, unsigned int line_size) {
+    if (from->kind == PREFETCH_NONE) return;
+    memcpy(to->prefetched, from->prefetched, BITMASK_WORDS(lines) * sizeof(unsigned long long));
+    memcpy(to->ready, from->ready, lines * sizeof(unsigned long long));
+    if (from->table != NULL) memcpy(to->table, from->table, RPT_ENTRIES * sizeof(RptEntry));
+    for (int i = 0; from->buffers != NULL && i < STREAM_BUFFERS; i++) {
+        unsigned char* data = to->buffers[i].data;
+
+        to->buffers[i] = from->buffers[i];
+        to->buffers[i].data = data;
+        memcpy(data, from->buffers[i].data, from->degree * line_size);
+    }
+}
+
+/*
+*  purpose   : Tells the prefetcher of a level about a demand hit. The first use of a prefetched
+*              line counts it as useful, or late when it has not arrived yet; the CPU waits for it.
+*  parameters: m     - Machine whose clock waits
+*              level - Level with a prefetcher
+*              index - Line hit
+*  return    : true if a prefetch brought the line and this is its first use
+*/
+bool PrefetchHit(Machine* m, CacheLevel* level, int index) {
+    PrefetchState* state = &level->prefetch;
+
+    if (!LINE_BIT(state->prefetched, index)) return false;
+    CLEAR_LINE_BIT(state->prefetched, index);
+    if (state->ready[index] > m->cpu_clock) {
+        level->counters.late_prefetches++;
+        m->cpu_clock = state->ready[index];
+    }
+    else level->counters.useful_prefetches++;
+    return true;
+}
+
+/*
+*  purpose   : Prefetches one line into a level in the background: the line is loaded as a miss
+*              would load it, then the clock is put back and the line marked with the clock it
+*              arrives by. A line already in the level is not asked for again.
+*  parameters: level   - Level with a prefetcher
+*              address - Any address of the line
+*  return    : None
+*/
+static void PrefetchLine(Machine* m, CacheLevel* level, unsigned short address) {
+    unsigned long long start = m->cpu_clock;
+    int index;
+
+    if (FindInCache(level, address) != -1) return;
+    index = UpdateCache(m, level, address, true);
+    level->counters.prefetches++;
+    SET_LINE_BIT(level->prefetch.prefetched, index);
+    level->prefetch.ready[index] = m->cpu_clock;
+    m->cpu_clock = start;
+}
+
+/*
+*  purpose   : Fetches the next line of a stream buffer into its tail, in the background. A line
+*              the level holds is copied from it, since it may be newer than the level below.
+*  parameters: level  - Level with a stream prefetcher
+*              buffer - Buffer with room for one more line
+*  return    : None
+*/
+static void StreamFetch(Machine* m, CacheLevel* level, StreamBuffer* buffer) {
+    unsigned int line_size = level->config.line_size;
+    unsigned long long start = m->cpu_clock;
+    unsigned char* data = &buffer->data[buffer->count * line_size];
+    int index = FindInCache(level, buffer->next);
+
+    if (index != -1) memcpy(data, &level->lines.data[index * line_size], line_size);
+    else ReadBelow(m, level, buffer->next, data, line_size);
+    buffer->line[buffer->count] = buffer->next;
+    buffer->ready[buffer->count] = m->cpu_clock;
+    buffer->count++;
+    buffer->next += line_size;
+    level->counters.prefetches++;
+    m->cpu_clock = start;
+}
+
+/*
+*  purpose   : Removes one line of a stream buffer, moving the lines after it up
+*  parameters: buffer    - Buffer
+*              entry     - Line removed
+*              line_size - Bytes per line
+*  return    : None
+*/
+static void StreamRemove(StreamBuffer* buffer, int entry, unsigned int line_size) {
+    buffer->count--;
+    memmove(&buffer->line[entry], &buffer->line[entry + 1], (buffer->count - entry) * sizeof(buffer->line[0]));
+    memmove(&buffer->ready[entry], &buffer->ready[entry + 1], (buffer->count - entry) * sizeof(buffer->ready[0]));
+    memmove(&buffer->data[entry * line_size], &buffer->data[(entry + 1) * line_size], (buffer->count - entry) * line_size);
+}
+
+/*
+*  purpose   : Looks a demand miss up in the heads of the stream buffers. A buffer holding the line
+*              gives it to the level, counted useful or late (the CPU waits for it), and fetches
+*              one more line.
+*  parameters: m       - Machine
+*              level   - Level that missed
+*              address - Address accessed
+*  return    : Index of the line loaded into the level, -1 if no stream buffer held it
+*/
+int StreamFill(Machine* m, CacheLevel* level, unsigned short address) {
+    PrefetchState* state = &level->prefetch;
+    unsigned int line_size = level->config.line_size;
+    unsigned short base = address & ~(line_size - 1);
+
+    if (state->kind != PREFETCH_STREAM) return -1;
+    for (int i = 0; i < STREAM_BUFFERS; i++) {
+        StreamBuffer* buffer = &state->buffers[i];
+        int index;
+
+        if (buffer->count == 0 || buffer->line[0] != base) continue;
+        if (buffer->ready[0] > m->cpu_clock) {
+            level->counters.late_prefetches++;
+            m->cpu_clock = buffer->ready[0];
+        }
+        else level->counters.useful_prefetches++;
+
+        index = UpdateCache(m, level, address, false);
+        memcpy(&level->lines.data[index * line_size], buffer->data, line_size);
+        StreamRemove(buffer, 0, line_size);
+        buffer->used = m->cpu_clock;
+        StreamFetch(m, level, buffer);
+        return index;
+    }
+    return -1;
+}
+
+/*
+*  purpose   : Removes a line from every stream buffer, so a store (or a reload of the memory
+*              under it) never leaves a stale copy there. The line is counted useless.
+*  parameters: level - Level with a stream prefetcher
+*              base  - Address of the first byte of the line
+*  return    : None
+*/
+void StreamInvalidate(CacheLevel* level, unsigned short base) {
+    unsigned int line_size = level->config.line_size;
+
+    for (int i = 0; i < STREAM_BUFFERS; i++) {
+        StreamBuffer* buffer = &level->prefetch.buffers[i];
+
+        for (int entry = 0; entry < buffer->count; entry++) {
+            if (buffer->line[entry] != base) continue;
+            level->counters.useless_prefetches++;
+            StreamRemove(buffer, entry, line_size);
+            break;
+        }
+    }
+}
+
+/*
+*  purpose   : Trains the prefetcher of a level on a demand access and issues the prefetches it
+*              predicts, after the access is done
+*  parameters: m          - Machine
+*              level      - Level accessed, with a prefetcher
+*              pc         - Address of the instruction making the access
+*              address    - Address accessed
+*              read_write - R or WR
+*              event      - What the access found (enum PrefetchEvents)
+*  return    : None
+*/
+void Prefetch(Machine* m, CacheLevel* level, unsigned short pc, unsigned short address, int read_write, int event) {
+    PrefetchState* state = &level->prefetch;
+    unsigned int line_size = level->config.line_size;
+    unsigned short base = address & ~(line_size - 1);
+
+    switch (state->kind) {
+    case PREFETCH_NEXT_LINE:
+        if (event == PREFETCH_HIT) return;
+        for (unsigned int i = 0; i < state->degree; i++) PrefetchLine(m, level, base + (state->distance + i) * line_size);
+        break;
+
+    case PREFETCH_STRIDE: {
+        RptEntry* entry = &state->table[(pc >> 1) & (RPT_ENTRIES - 1)];
+        short stride = (short)(address - entry->last);
+
+        if (!entry->valid || entry->pc != pc) {
+            entry->valid = true;
+            entry->pc = pc;
+            entry->stride = 0;
+            entry->confidence = 0;
+        }
+        else if (stride == entry->stride && stride != 0) {
+            if (entry->confidence < RPT_MAX_CONFIDENCE) entry->confidence++;
+        }
+        else if (entry->confidence > 0) entry->confidence--;
+        else entry->stride = stride;
+        entry->last = address;
+
+        if (entry->confidence < RPT_CONFIDENT) return;
+        for (unsigned int i = 0; i < state->degree; i++) {
+            unsigned short target = address + entry->stride * (int)(state->distance + i);
+
+            if ((target & ~(line_size - 1)) != base) PrefetchLine(m, level, target);
+        }
+        break;
+    }
+
+    case PREFETCH_STREAM: {
+        StreamBuffer* oldest = &state->buffers[0];
+
+        if (read_write == WR) StreamInvalidate(level, base);
+        if (event != PREFETCH_MISS) return;
+        for (int i = 1; i < STREAM_BUFFERS; i++) {
+            if (state->buffers[i].used < oldest->used) oldest = &state->buffers[i];
+        }
+        // The lines left in the buffer were never used
+        level->counters.useless_prefetches += oldest->count;
+        oldest->count = 0;
+        oldest->next = base + state->distance * line_size;
+        oldest->used = m->cpu_clock;
+        for (unsigned int i = 0; i < state->degree; i++) StreamFetch(m, level, oldest);
+        break;
+    }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+* This is the header file for the hardware prefetchers.
+* A prefetcher watches the accesses the CPU makes to one cache level (loads and stores to the data
+* cache, fetches to the instruction cache) and brings in the lines it predicts will be used next:
+* the next lines (next-line), lines a fixed stride apart for each load or store instruction
+* (stride, a reference prediction table indexed by the PC) or the lines after a miss, held in
+* stream buffers outside the cache (stream). Prefetches are filled in the background: they cost
+* the CPU nothing unless it uses the line before the fill would have finished.
+*/
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+
+// Defining constants
+#define PREFETCH_MAX_DEGREE 8       // Most lines asked for at once, and lines of a stream buffer
+#define PREFETCH_MAX_DISTANCE 64    // Farthest ahead a prefetch goes, in lines or strides
+#define RPT_ENTRIES 64              // Entries of the reference prediction table, direct mapped by PC
+#define RPT_CONFIDENT 2             // Times in a row a stride is seen before it is prefetched
+#define RPT_MAX_CONFIDENCE 3        // Saturation of the confidence counter
+#define STREAM_BUFFERS 4            // Stream buffers of the stream prefetcher
+
+// Prefetchers, in the order of PrefetcherNames[]
+enum PrefetcherIds {
+    PREFETCH_NONE,      // No prefetching, the default
+    PREFETCH_NEXT_LINE, // The lines after a miss or after the first use of a prefetched line (tagged)
+    PREFETCH_STRIDE,    // Lines a fixed stride apart, per load and store instruction
+    PREFETCH_STREAM,    // Stream buffers filled with the lines after a miss
+    PREFETCH_COUNT
+};
+
+// What happened to a demand access, for the prefetcher to learn from
+enum PrefetchEvents {
+    PREFETCH_HIT,       // Found its line
+    PREFETCH_MISS,      // Missed, and no stream buffer held the line
+    PREFETCH_USED       // Found a line a prefetch brought, used for the first time
+};
+
+// RptEntry struct definition, the stride of one load or store instruction
+typedef struct RptEntry {
+    unsigned short pc;              // Address of the instruction
+    unsigned short last;            // Address it accessed last
+    short stride;                   // Difference between its last two addresses
+    unsigned char confidence;       // Times in a row the stride was seen, up to RPT_MAX_CONFIDENCE
+    bool valid;
+} RptEntry;
+
+// StreamBuffer struct definition, the lines after a miss, oldest first
+typedef struct StreamBuffer {
+    int count;                                      // Lines held, from entry 0 (the head)
+    unsigned short line[PREFETCH_MAX_DEGREE];       // Address of the first byte of each line
+    unsigned long long ready[PREFETCH_MAX_DEGREE];  // Clock each line has arrived by
+    unsigned char* data;                            // line_size bytes per line
+    unsigned short next;                            // Line fetched when the head is used
+    unsigned long long used;                        // Clock of the last use, the least recent is reallocated
+} StreamBuffer;
+
+// PrefetchState struct definition, the prefetcher of one cache level
+typedef struct PrefetchState {
+    int kind;                       // enum PrefetcherIds
+    unsigned int degree;            // Lines asked for at once, lines of a stream buffer
+    unsigned int distance;          // How far ahead, in lines (next-line, stream) or strides (stride)
+    unsigned long long* prefetched; // One bit per line of the level, brought by a prefetch and not used yet
+    unsigned long long* ready;      // Clock each prefetched line of the level has arrived by
+    RptEntry* table;                // PREFETCH_STRIDE: RPT_ENTRIES entries
+    StreamBuffer* buffers;          // PREFETCH_STREAM: STREAM_BUFFERS buffers
+} PrefetchState;
+
+typedef struct Machine Machine;
+typedef struct CacheLevel CacheLevel;
+
+extern const char* PrefetcherNames[PREFETCH_COUNT];
+
+// Set when a level has a prefetcher
+#define PREFETCHING(level) ((level)->prefetch.kind != PREFETCH_NONE)
+
+extern int FindPrefetcher(const char* name);
+extern bool InitializePrefetch(PrefetchState* state, int kind, unsigned int degree, unsigned int distance, int lines, unsigned int line_size);
+extern void ResetPrefetch(PrefetchState* state, int lines);
+extern void ClearPrefetchTimes(PrefetchState* state, int lines);
+extern void ReleasePrefetch(PrefetchState* state);
+extern void CopyPrefetch(PrefetchState* to, const PrefetchState* from, int lines, unsigned int line_size);
+extern bool PrefetchHit(Machine* m, CacheLevel* level, int index);
+extern int StreamFill(Machine* m, CacheLevel* level, unsigned short address);
+extern void StreamInvalidate(CacheLevel* level, unsigned short base);
+extern void Prefetch(Machine* m, CacheLevel* level, unsigned short pc, unsigned short address, int read_write, int event);
+
+#endif
@@ -0,0 +1,444 @@
+/**
+ * @file Replacement.c
+ * @brief Cache Replacement Policies for the XM-23 Emulator
+ *
+ * This module holds the replacement policies of the cache (Cache.c): LRU, tree pseudo-LRU, FIFO,
+ * seeded random, SRRIP and BRRIP. Each policy is a set of operations in ReplacementPolicies[]
+ * working on a ReplacementState, so the same code drives the cache itself and the shadow tag
+ * arrays. Every operation only touches the set of the line or address concerned. The geometry
+ * (sets and ways) is set at run time, with the cache's (ConfigureCache()).
+ *
+ * Shadow tag arrays (EnableShadows()) see every cache access. They keep the tags the cache
+ * would hold under each policy and count their hits and misses, without changing the run.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "Replacement.h"
+
+/*
+*  purpose   : Steps the xorshift generator of a tag array, the same seed always gives the same lines
+*  parameters: state - Policy state
+*  return    : Next random number
+*/
+static unsigned int NextRandom(ReplacementState* state) {
+    unsigned int x = state->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state->random = x;
+    return x;
+}
+
+/* ******************************** LRU ****************************************** */
+
+/*
+*  purpose   : Lists the lines of every set by index, so lines never used are replaced from the
+*              highest index down (the order the old age counters gave)
+*/
+static void LruReset(ReplacementState* state) {
+    int ways = state->ways;
+
+    for (int i = 0; i < state->sets * ways; i++) {
+        int way = i % ways;
+
+        state->newer[i] = (way == 0) ? -1 : i - 1;
+        state->older[i] = (way == ways - 1) ? -1 : i + 1;
+    }
+    for (int set = 0; set < state->sets; set++) {
+        state->mru[set] = set * ways;
+        state->lru[set] = set * ways + ways - 1;
+    }
+}
+
+/*
+*  purpose   : Moves a line to the front of its set's list
+*/
+static void LruUse(ReplacementState* state, int line) {
+    int set = line / state->ways;
+
+    if (state->mru[set] == line) return;
+
+    // Unlink, the line is not the most recently used so it has a newer neighbour
+    state->older[state->newer[line]] = state->older[line];
+    if (state->older[line] != -1) state->newer[state->older[line]] = state->newer[line];
+    else state->lru[set] = state->newer[line];
+
+    state->newer[line] = -1;
+    state->older[line] = state->mru[set];
+    state->newer[state->mru[set]] = line;
+    state->mru[set] = line;
+}
+
+static int LruVictim(ReplacementState* state, int set) {
+    return state->lru[set];
+}
+
+/* ******************************** Tree pseudo-LRU ****************************************** */
+
+static void PlruReset(ReplacementState* state) {
+    memset(state->tree, 0, state->sets * state->ways);
+}
+
+/*
+*  purpose   : Points every node on the path to a line away from it
+*/
+static void PlruUse(ReplacementState* state, int line) {
+    unsigned char* tree = &state->tree[line - line % state->ways];
+    int way = line % state->ways;
+    int node = 1;
+
+    for (int half = state->ways / 2; half > 0; half /= 2) {
+        int right = (way & half) != 0;
+
+        tree[node] = !right;
+        node = 2 * node + right;
+    }
+}
+
+/*
+*  purpose   : Follows the tree bits from the root to the pseudo least recently used line
+*/
+static int PlruVictim(ReplacementState* state, int set) {
+    unsigned char* tree = &state->tree[set * state->ways];
+    int node = 1;
+
+    while (node < state->ways) node = 2 * node + tree[node];
+    return set * state->ways + node - state->ways;
+}
+
+/* ******************************** FIFO ****************************************** */
+
+static void FifoReset(ReplacementState* state) {
+    memset(state->next, 0, state->sets * sizeof(unsigned short));
+}
+
+/*
+*  purpose   : Leaves the order alone, FIFO and random replacement ignore hits (random also fills)
+*/
+static void FifoHit(ReplacementState* state, int line) {
+    (void)state;
+    (void)line;
+}
+
+static void FifoFill(ReplacementState* state, int line) {
+    state->next[line / state->ways] = (line % state->ways + 1) % state->ways;
+}
+
+static int FifoVictim(ReplacementState* state, int set) {
+    return set * state->ways + state->next[set];
+}
+
+/* ******************************** Random ****************************************** */
+
+/*
+*  purpose   : Nothing to clear, ResetReplacement() has already reseeded the generator
+*/
+static void RandomReset(ReplacementState* state) {
+    (void)state;
+}
+
+static int RandomVictim(ReplacementState* state, int set) {
+    return set * state->ways + NextRandom(state) % state->ways;
+}
+
+/* ******************************** SRRIP / BRRIP ****************************************** */
+
+/*
+*  purpose   : Predicts every line re-referenced in the distant future, so empty lines go first
+*/
+static void RripReset(ReplacementState* state) {
+    memset(state->rrpv, RRPV_MAX, state->sets * state->ways);
+}
+
+static void RripHit(ReplacementState* state, int line) {
+    state->rrpv[line] = 0;
+}
+
+static void SrripFill(ReplacementState* state, int line) {
+    state->rrpv[line] = RRPV_MAX - 1;
+}
+
+/*
+*  purpose   : Inserts with a distant prediction, and with a long one once in BRRIP_LONG_FILLS fills
+*/
+static void BrripFill(ReplacementState* state, int line) {
+    state->rrpv[line] = (NextRandom(state) % BRRIP_LONG_FILLS == 0) ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+/*
+*  purpose   : Replaces the first line predicted in the distant future, ageing the set until one is
+*/
+static int RripVictim(ReplacementState* state, int set) {
+    unsigned char* rrpv = &state->rrpv[set * state->ways];
+    unsigned char oldest = 0;
+
+    for (int way = 0; way < state->ways; way++) {
+        if (rrpv[way] > oldest) oldest = rrpv[way];
+    }
+    if (oldest < RRPV_MAX) {
+        for (int way = 0; way < state->ways; way++) rrpv[way] += RRPV_MAX - oldest;
+    }
+    for (int way = 0; ; way++) {
+        if (rrpv[way] == RRPV_MAX) return set * state->ways + way;
+    }
+}
+
+const ReplacementPolicy ReplacementPolicies[POLICY_COUNT] = {
+    [POLICY_LRU] = { "lru", LruReset, LruUse, LruUse, LruVictim },
+    [POLICY_PLRU] = { "plru", PlruReset, PlruUse, PlruUse, PlruVictim },
+    [POLICY_FIFO] = { "fifo", FifoReset, FifoHit, FifoFill, FifoVictim },
+    [POLICY_RANDOM] = { "random", RandomReset, FifoHit, FifoHit, RandomVictim },
+    [POLICY_SRRIP] = { "srrip", RripReset, RripHit, SrripFill, RripVictim },
+    [POLICY_BRRIP] = { "brrip", RripReset, RripHit, BrripFill, RripVictim },
+};
+
+/*
+*  purpose   : Finds a policy by name
+*  parameters: name - Policy name (lru, plru, fifo, random, srrip, brrip)
+*  return    : The policy (enum ReplacementPolicyIds), -1 if there is none of that name
+*/
+int FindPolicy(const char* name) {
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (strcmp(ReplacementPolicies[policy].name, name) == 0) return policy;
+    }
+    return -1;
+}
+
+/*
+*  purpose   : Selects a policy and geometry for a tag array and resets its state, as for an empty cache.
+*              The state must be zeroed or previously initialized.
+*  parameters: state  - Policy state
+*              policy - enum ReplacementPolicyIds
+*              seed   - Seed of the random generator (random and BRRIP)
+*              sets   - Number of sets
+*              ways   - Lines per set, a power of two
+*  return    : true if the state could be allocated
+*/
+bool InitializeReplacement(ReplacementState* state, int policy, unsigned int seed, int sets, int ways) {
+    int lines = sets * ways;
+
+    ReleaseReplacement(state);
+    state->newer = malloc(lines * sizeof(short));
+    state->older = malloc(lines * sizeof(short));
+    state->mru = malloc(sets * sizeof(short));
+    state->lru = malloc(sets * sizeof(short));
+    state->tree = malloc(lines);
+    state->next = malloc(sets * sizeof(unsigned short));
+    state->rrpv = malloc(lines);
+    if (!state->newer || !state->older || !state->mru || !state->lru || !state->tree || !state->next || !state->rrpv) {
+        ReleaseReplacement(state);
+        return false;
+    }
+    state->policy = policy;
+    state->seed = seed;
+    state->sets = sets;
+    state->ways = ways;
+    ResetReplacement(state);
+    return true;
+}
+
+/*
+*  purpose   : Resets the state of a tag array's policy, as for an empty cache
+*  parameters: state - Policy state
+*  return    : None
+*/
+void ResetReplacement(ReplacementState* state) {
+    state->random = (state->seed != 0) ? state->seed : 1;
+    ReplacementPolicies[state->policy].reset(state);
+}
+
+/*
+*  purpose   : Frees the arrays of a policy state
+*  parameters: state - Policy state
+*  return    : None
+*/
+void ReleaseReplacement(ReplacementState* state) {
+    free(state->newer);
+    free(state->older);
+    free(state->mru);
+    free(state->lru);
+    free(state->tree);
+    free(state->next);
+    free(state->rrpv);
+    state->newer = state->older = state->mru = state->lru = NULL;
+    state->tree = state->rrpv = NULL;
+    state->next = NULL;
+}
+
+/*
+*  purpose   : Copies the state of a policy into another of the same policy, sets and ways
+*  parameters: to   - Policy state overwritten
+*              from - Policy state copied
+*  return    : None
+*/
+void CopyReplacement(ReplacementState* to, const ReplacementState* from) {
+    int lines = from->sets * from->ways;
+
+    to->random = from->random;
+    memcpy(to->newer, from->newer, lines * sizeof(short));
+    memcpy(to->older, from->older, lines * sizeof(short));
+    memcpy(to->mru, from->mru, from->sets * sizeof(short));
+    memcpy(to->lru, from->lru, from->sets * sizeof(short));
+    memcpy(to->tree, from->tree, lines);
+    memcpy(to->next, from->next, from->sets * sizeof(unsigned short));
+    memcpy(to->rrpv, from->rrpv, lines);
+}
+
+/*
+*  purpose   : Gives a line's standing under its policy, for PrintCache()
+*  parameters: state - Policy state
+*              line  - Cache line
+*  return    : LRU position (0 most recent), FIFO fills until it is replaced, RRPV, or 0
+*/
+int ReplacementRank(const ReplacementState* state, int line) {
+    int set = line / state->ways;
+    int rank = 0;
+
+    switch (state->policy) {
+    case POLICY_LRU:
+        for (int i = state->mru[set]; i != line; i = state->older[i]) rank++;
+        return rank;
+    case POLICY_FIFO:
+        return (line % state->ways - state->next[set] + state->ways) % state->ways;
+    case POLICY_SRRIP:
+    case POLICY_BRRIP:
+        return state->rrpv[line];
+    default:
+        return 0;
+    }
+}
+
+/*
+*  purpose   : Allocates one empty shadow tag array
+*  parameters: shadow - Shadow initialized
+*              policy - Replacement policy (enum ReplacementPolicyIds)
+*              seed   - Seed of the random and BRRIP policies
+*              sets   - Number of sets
+*              ways   - Lines per set, a power of two
+*  return    : true if it could be allocated, it is left released otherwise
+*/
+bool InitializeShadow(ShadowCache* shadow, int policy, unsigned int seed, int sets, int ways) {
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->tag = calloc(sets * ways, sizeof(unsigned short));
+    shadow->valid = calloc(BITMASK_WORDS(sets * ways), sizeof(unsigned long long));
+    if (shadow->tag == NULL || shadow->valid == NULL || !InitializeReplacement(&shadow->replacement, policy, seed, sets, ways)) {
+        ReleaseShadow(shadow);
+        return false;
+    }
+    return true;
+}
+
+/*
+*  purpose   : Frees one shadow tag array
+*  parameters: shadow - Shadow released
+*  return    : None
+*/
+void ReleaseShadow(ShadowCache* shadow) {
+    free(shadow->tag);
+    free(shadow->valid);
+    ReleaseReplacement(&shadow->replacement);
+    memset(shadow, 0, sizeof(*shadow));
+}
+
+/*
+*  purpose   : Looks a line up in one set of a shadow tag array, counting a hit or a miss. A miss
+*              replaces the line its policy picks.
+*  parameters: shadow - Shadow accessed
+*              set    - Set of the line
+*              base   - Address of the first byte of the line
+*  return    : None
+*/
+void ShadowLookup(ShadowCache* shadow, int set, unsigned short base) {
+    int ways = shadow->replacement.ways;
+    int line = FindTag(shadow->tag, shadow->valid, set * ways, ways, base);
+
+    if (line != -1) {
+        shadow->hits++;
+        ReplacementHit(&shadow->replacement, line);
+    }
+    else {
+        shadow->misses++;
+        line = ReplacementVictim(&shadow->replacement, set);
+        shadow->tag[line] = base;
+        SET_LINE_BIT(shadow->valid, line);
+        ReplacementFill(&shadow->replacement, line);
+    }
+}
+
+/*
+*  purpose   : Starts one shadow tag array per policy on a machine, all empty, with the geometry
+*              of the machine's data cache. ConfigureCache() drops them, so they are enabled after it.
+*  parameters: m    - Machine whose data cache accesses are shadowed
+*              seed - Seed of the random and BRRIP shadows
+*  return    : true if the shadows could be allocated, false also when the machine has no data cache
+*/
+bool EnableShadows(Machine* m, unsigned int seed) {
+    const CacheLevel* level = m->data_level;
+    int lines;
+
+    ReleaseShadows(m);
+    if (level == NULL) return false;
+    lines = level->config.size / level->config.line_size;
+    m->shadows = calloc(POLICY_COUNT, sizeof(ShadowCache));
+    if (m->shadows == NULL) return false;
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (!InitializeShadow(&m->shadows[policy], policy, seed, lines / level->config.ways, level->config.ways)) {
+            ReleaseShadows(m);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+*  purpose   : Frees the shadow tag arrays of a machine, if any
+*  parameters: m - Machine
+*  return    : None
+*/
+void ReleaseShadows(Machine* m) {
+    if (m->shadows == NULL) return;
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) ReleaseShadow(&m->shadows[policy]);
+    free(m->shadows);
+    m->shadows = NULL;
+}
+
+/*
+*  purpose   : Looks an address up in every shadow tag array, as Cache() looks it up in the data cache
+*  parameters: m       - Machine with shadows enabled
+*              address - Address accessed
+*  return    : None
+*/
+void ShadowAccess(Machine* m, unsigned short address) {
+    const CacheLevel* level = m->data_level;
+    unsigned short base = address & ~(level->config.line_size - 1);
+    int set = CacheSet(level, address);
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) ShadowLookup(&m->shadows[policy], set, base);
+}
+
+/*
+*  purpose   : Writes the hits, misses and hit rate of every shadow as key=value lines
+*  parameters: out - File written to
+*              m   - Machine with shadows enabled
+*  return    : None
+*/
+void PrintShadows(FILE* out, Machine* m) {
+    if (m->shadows == NULL) return;
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        const ShadowCache* shadow = &m->shadows[policy];
+        unsigned long accesses = shadow->hits + shadow->misses;
+        const char* name = ReplacementPolicies[policy].name;
+
+        fprintf(out, "shadow.%s.hits=%lu\n", name, shadow->hits);
+        fprintf(out, "shadow.%s.misses=%lu\n", name, shadow->misses);
+        fprintf(out, "shadow.%s.hit_rate=%.4f\n", name, accesses ? (double)shadow->hits / accesses : 0.0);
+    }
+}
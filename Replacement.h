@@ -0,0 +1,86 @@
+/*
+* This is the header file for the cache replacement policies.
+* A policy keeps its own state for one tag array (the cache or a shadow tag array), is told about
+* every hit and fill, and picks the line a miss replaces. Policies are chosen at run time by name.
+* Shadow tag arrays track the tags the cache would hold under every policy at once, so one run
+* gives the hit rate of each policy.
+*/
+#ifndef REPLACEMENT_H
+#define REPLACEMENT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Defining constants
+#define RRPV_MAX 3              // Re-reference prediction values are 2 bits (SRRIP/BRRIP)
+#define BRRIP_LONG_FILLS 32     // BRRIP inserts one fill in this many with a long prediction
+
+// Replacement policies, in the order of ReplacementPolicies[]
+enum ReplacementPolicyIds {
+    POLICY_LRU,     // Least recently used, the default
+    POLICY_PLRU,    // Tree pseudo-LRU
+    POLICY_FIFO,    // First in, first out
+    POLICY_RANDOM,  // Random line, from a seeded generator
+    POLICY_SRRIP,   // Static re-reference interval prediction
+    POLICY_BRRIP,   // Bimodal re-reference interval prediction
+    POLICY_COUNT
+};
+
+// ReplacementState struct definition, the policy state of one tag array of sets * ways lines
+typedef struct ReplacementState {
+    int policy;                     // enum ReplacementPolicyIds
+    unsigned int seed;              // Seed of the random generator, 0 is taken as 1
+    unsigned int random;            // Random generator state (POLICY_RANDOM, POLICY_BRRIP)
+    int sets;                       // Number of sets
+    int ways;                       // Lines per set, a power of two
+    short* newer;                   // LRU: line used just after this one, -1 for the most recent
+    short* older;                   // LRU: line used just before this one, -1 for the least recent
+    short* mru;                     // LRU: most recently used line of each set
+    short* lru;                     // LRU: least recently used line of each set
+    unsigned char* tree;            // PLRU: ways - 1 tree bits per set (node 0 unused)
+    unsigned short* next;           // FIFO: way of each set replaced next
+    unsigned char* rrpv;            // SRRIP/BRRIP: re-reference prediction value of each line
+} ReplacementState;
+
+// ReplacementPolicy struct definition, the operations of one policy
+typedef struct ReplacementPolicy {
+    const char* name;
+    void (*reset)(ReplacementState* state);
+    void (*hit)(ReplacementState* state, int line);
+    void (*fill)(ReplacementState* state, int line);
+    int (*victim)(ReplacementState* state, int set);
+} ReplacementPolicy;
+
+// ShadowCache struct definition, the tags the cache would hold under one policy
+typedef struct ShadowCache {
+    unsigned short* tag;            // Address of the first byte of each line
+    unsigned long long* valid;      // One bit per line
+    ReplacementState replacement;
+    unsigned long hits;
+    unsigned long misses;
+} ShadowCache;
+
+typedef struct Machine Machine;
+
+extern const ReplacementPolicy ReplacementPolicies[POLICY_COUNT];
+
+extern int FindPolicy(const char* name);
+extern bool InitializeReplacement(ReplacementState* state, int policy, unsigned int seed, int sets, int ways);
+extern void ResetReplacement(ReplacementState* state);
+extern void ReleaseReplacement(ReplacementState* state);
+extern void CopyReplacement(ReplacementState* to, const ReplacementState* from);
+extern int ReplacementRank(const ReplacementState* state, int line);
+extern bool InitializeShadow(ShadowCache* shadow, int policy, unsigned int seed, int sets, int ways);
+extern void ReleaseShadow(ShadowCache* shadow);
+extern void ShadowLookup(ShadowCache* shadow, int set, unsigned short base);
+extern bool EnableShadows(Machine* m, unsigned int seed);
+extern void ReleaseShadows(Machine* m);
+extern void ShadowAccess(Machine* m, unsigned short address);
+extern void PrintShadows(FILE* out, Machine* m);
+
+// A hit or fill of a line, and the line a miss in a set replaces
+#define ReplacementHit(state, line) ReplacementPolicies[(state)->policy].hit((state), (line))
+#define ReplacementFill(state, line) ReplacementPolicies[(state)->policy].fill((state), (line))
+#define ReplacementVictim(state, set) ReplacementPolicies[(state)->policy].victim((state), (set))
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file Snapshot.c
+ * @brief Copy-on-Write Machine Snapshots for the XM-23 Emulator
+ *
+ * This module keeps one snapshot per machine (Snapshot.h) and puts the machine back to it, so a
+ * program booted once can be run from the same point many times without loading and booting it
+ * again (the batch farm restores each image from the snapshot taken after loading it).
+ *
+ *  - The registers, PSW, clock and caches (every level: lines, policy, prefetcher, write buffer and
+ *    counters) are copied whole when the snapshot is taken and when it is restored; they are small.
+ *  - Memory and the per-instruction miss tables are copied on write, SNAPSHOT_PAGE_SIZE addresses
+ *    a page. Every write to memory (Bus(), BusBurst(), loading) and every miss counted goes through
+ *    SNAPSHOT_WRITE, which saves the page the first time it is written after the snapshot and marks
+ *    it written. A restore copies back only the marked pages and drops the decoded and translated
+ *    instructions of the memory it puts back.
+ *
+ * A saved page always holds the contents at the snapshot, so after a restore a page written again
+ * is only marked, not saved again. Shadow tag arrays, the trace callback and the headless flag
+ * are tools attached to the machine, not its state, and are left as they are. Restoring fails if
+ * the caches were configured with another geometry after the snapshot was taken.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "Snapshot.h"
+
+/*
+*  purpose   : Gives the start of a region of a machine and the bytes of each of its pages
+*  parameters: m         - Machine
+*              region    - enum SnapshotRegions
+*              page_size - Set to the bytes per page
+*  return    : First byte of the region
+*/
+static unsigned char* RegionBase(Machine* m, int region, size_t* page_size) {
+    switch (region) {
+    case SNAPSHOT_MEMORY:
+        *page_size = SNAPSHOT_PAGE_SIZE;
+        return m->memory.ByteMem;
+    case SNAPSHOT_FETCH_MISSES:
+        *page_size = SNAPSHOT_PAGE_SIZE / 2 * sizeof(m->fetch_misses[0]);
+        return (unsigned char*)m->fetch_misses;
+    default:
+        *page_size = SNAPSHOT_PAGE_SIZE / 2 * sizeof(m->data_misses[0]);
+        return (unsigned char*)m->data_misses;
+    }
+}
+
+/*
+*  purpose   : Marks the page of an address written, saving its contents first unless the snapshot
+*              already holds them. Called through SNAPSHOT_WRITE before the write.
+*  parameters: m       - Machine with a snapshot
+*              region  - enum SnapshotRegions
+*              address - Address written, or of the instruction whose miss is counted
+*  return    : None
+*/
+void SnapshotWrite(Machine* m, int region, unsigned short address) {
+    Snapshot* snapshot = m->snapshot;
+    int page = SNAPSHOT_PAGE(address);
+    size_t page_size;
+    unsigned char* base = RegionBase(m, region, &page_size);
+
+    if (snapshot->pages[region][page] == NULL) {
+        snapshot->pages[region][page] = malloc(page_size);
+        // Without memory for the page the snapshot cannot be restored any more
+        if (snapshot->pages[region][page] == NULL) {
+            ReleaseSnapshot(m);
+            return;
+        }
+        memcpy(snapshot->pages[region][page], &base[page * page_size], page_size);
+    }
+    snapshot->written[region][page / 64] |= 1ULL << (page % 64);
+}
+
+/*
+*  purpose   : Takes a snapshot of a machine, replacing the one it had. Only the registers, PSW,
+*              clock and caches are copied; memory and the miss tables are saved as they are written.
+*  parameters: m - Machine
+*  return    : true if the snapshot was taken, false if there was no memory for it (the machine
+*              is left with none)
+*/
+bool TakeSnapshot(Machine* m) {
+    Snapshot* snapshot;
+
+    ReleaseSnapshot(m);
+    snapshot = calloc(1, sizeof(Snapshot));
+    if (snapshot == NULL) return false;
+    if (!SaveCache(m, snapshot->cache)) {
+        free(snapshot);
+        return false;
+    }
+    memcpy(snapshot->reg_file, m->reg_file, sizeof(snapshot->reg_file));
+    snapshot->psw = m->psw;
+    snapshot->lazy_psw = m->lazy_psw;
+    snapshot->instr_reg = m->instr_reg;
+    snapshot->cpu_clock = m->cpu_clock;
+    snapshot->origin_address = m->origin_address;
+    m->snapshot = snapshot;
+    return true;
+}
+
+/*
+*  purpose   : Puts a machine back as it was when its snapshot was taken. Only the pages of memory
+*              and miss tables written since the snapshot or the last restore are copied; the
+*              snapshot is kept, to be restored again.
+*  parameters: m - Machine with a snapshot
+*  return    : true if it was restored, false if it has no snapshot or its caches were configured
+*              with another geometry since (nothing is changed)
+*/
+bool RestoreSnapshot(Machine* m) {
+    Snapshot* snapshot = m->snapshot;
+
+    if (snapshot == NULL || !RestoreCache(m, snapshot->cache)) return false;
+
+    for (int region = 0; region < SNAPSHOT_REGIONS; region++) {
+        size_t page_size;
+        unsigned char* base = RegionBase(m, region, &page_size);
+
+        for (int page = 0; page < SNAPSHOT_PAGES; page++) {
+            // Pages not written are skipped 64 at a time
+            if (snapshot->written[region][page / 64] == 0) {
+                page += 63;
+                continue;
+            }
+            if (SNAPSHOT_WRITTEN(snapshot, region, page)) {
+                if (region == SNAPSHOT_MEMORY) {
+                    for (int address = page * SNAPSHOT_PAGE_SIZE; address < (page + 1) * SNAPSHOT_PAGE_SIZE; address += 2)
+                        InvalidateDecoded(m, (unsigned short)address);
+                }
+                memcpy(&base[page * page_size], snapshot->pages[region][page], page_size);
+            }
+        }
+        memset(snapshot->written[region], 0, sizeof(snapshot->written[region]));
+    }
+
+    memcpy(m->reg_file, snapshot->reg_file, sizeof(m->reg_file));
+    m->psw = snapshot->psw;
+    m->lazy_psw = snapshot->lazy_psw;
+    m->instr_reg = snapshot->instr_reg;
+    m->cpu_clock = snapshot->cpu_clock;
+    m->origin_address = snapshot->origin_address;
+    return true;
+}
+
+/*
+*  purpose   : Frees the snapshot of a machine, leaving none
+*  parameters: m - Machine
+*  return    : None
+*/
+void ReleaseSnapshot(Machine* m) {
+    Snapshot* snapshot = m->snapshot;
+
+    if (snapshot == NULL) return;
+    m->snapshot = NULL;
+    ReleaseSavedCache(snapshot->cache);
+    for (int region = 0; region < SNAPSHOT_REGIONS; region++) {
+        for (int page = 0; page < SNAPSHOT_PAGES; page++) free(snapshot->pages[region][page]);
+    }
+    free(snapshot);
+}
@@ -0,0 +1,55 @@
+/*
+* This is the header file for machine snapshots.
+* A snapshot keeps the state of a machine at one moment: registers, PSW, clock, caches and memory,
+* so the machine can be put back to it any number of times. Memory and the per-instruction miss
+* tables are copied on write a page at a time: taking a snapshot copies none of them, the first
+* write to a page after it saves that page, and restoring copies back only the pages written since.
+*/
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include "emulator.h"
+
+// Defining constants
+#define SNAPSHOT_PAGE_SIZE 256                          // Bytes of memory per copy-on-write page
+#define SNAPSHOT_PAGES (MEM_SIZE / SNAPSHOT_PAGE_SIZE)
+#define SNAPSHOT_PAGE(address) ((address) / SNAPSHOT_PAGE_SIZE)
+
+// Arrays of a machine copied on write, each split into SNAPSHOT_PAGES pages by address
+enum SnapshotRegions {
+    SNAPSHOT_MEMORY,        // memory, SNAPSHOT_PAGE_SIZE bytes per page
+    SNAPSHOT_FETCH_MISSES,  // fetch_misses, the words of the same addresses
+    SNAPSHOT_DATA_MISSES,   // data_misses
+    SNAPSHOT_REGIONS
+};
+
+// Snapshot struct definition, a machine as it was when TakeSnapshot() ran
+typedef struct Snapshot {
+    unsigned short reg_file[REG_CONS][NUM_REG];
+    psw_bits psw;
+    lazy_psw_state lazy_psw;
+    unsigned short instr_reg;
+    unsigned long long cpu_clock;
+    unsigned short origin_address;
+    CacheLevel cache[CACHE_LEVELS];                     // Copy of every level (SaveCache())
+    unsigned char* pages[SNAPSHOT_REGIONS][SNAPSHOT_PAGES];         // Contents of each page at the snapshot, NULL until it is first written
+    unsigned long long written[SNAPSHOT_REGIONS][SNAPSHOT_PAGES / 64];  // One bit per page written since the snapshot or the last restore
+} Snapshot;
+
+// Set when a page of a region has been written since the snapshot or the last restore
+#define SNAPSHOT_WRITTEN(snapshot, region, page) (((snapshot)->written[region][(page) / 64] >> ((page) % 64)) & 1)
+
+// Saves the page of an address of a region before the machine "m" first writes it, when it has a snapshot
+#define SNAPSHOT_WRITE(m, region, address) \
+    do { \
+        if ((m)->snapshot != NULL && !SNAPSHOT_WRITTEN((m)->snapshot, (region), SNAPSHOT_PAGE(address))) \
+            SnapshotWrite((m), (region), (address)); \
+    } while (0)
+
+extern void SnapshotWrite(Machine* m, int region, unsigned short address);
+extern bool TakeSnapshot(Machine* m);
+extern bool RestoreSnapshot(Machine* m);
+extern void ReleaseSnapshot(Machine* m);
+
+#endif
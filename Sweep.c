@@ -0,0 +1,400 @@
+/**
+ * @file Sweep.c
+ * @brief Trace-Driven Cache Design-Space Sweep for the XM-23 Emulator
+ *
+ * This module gives the miss rate of many cache configurations from one pass over a stream of
+ * memory accesses, instead of one emulator run per configuration:
+ *
+ *     FauxProcessor -sweep <trace.din | - | image.xme> [-l line size] [-m max size] [-p policy]...
+ *                          [-r seed] [-i instructions] [-c cycles] [-s stop address] [-o table file]
+ *                          [-core blocks|threaded]
+ *
+ * The accesses come from a trace file in the Dinero din format ("-" reads stdin), or live from an
+ * .xme (or .xmb) image run headless, every fetch, load and store going to SweepAccess() through the
+ * machine's trace hook (Machine.trace). A headless run records the same stream to a file with -t.
+ *
+ * Every configuration has the same line size. LRU has the inclusion property: a cache of W ways
+ * holds the W lines of a set used most recently, so an access hits in every cache with more ways
+ * than its stack distance (the number of other lines of its set used since its line was last
+ * used). One LRU stack per set, for every number of sets, gives the LRU miss rate of every size and
+ * associativity at once (Mattson et al.). The other policies have no such property, so each of
+ * their configurations gets its own shadow tag array (Replacement.c) fed the same accesses.
+ * Every access allocates its line, as with write allocation; writes and fetches count as reads.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "Headless.h"
+#include "Image.h"
+#include "Sweep.h"
+
+/*
+*  purpose   : Gives the base two logarithm of a power of two
+*  parameters: value - Power of two
+*  return    : Logarithm
+*/
+static int Log2(unsigned int value) {
+    int bits = 0;
+
+    while (value > 1) {
+        value >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+/*
+*  purpose   : Gives the ways of a column of the table for a cache of a number of lines
+*  parameters: column - Column, SWEEP_WAY_COLUMNS for the fully associative one
+*              lines  - Lines of the cache
+*  return    : Ways, 0 when the cache has fewer lines than the column has ways
+*/
+static unsigned int ColumnWays(int column, unsigned int lines) {
+    unsigned int ways = (column == SWEEP_WAY_COLUMNS) ? lines : 1u << column;
+
+    return (ways <= lines) ? ways : 0;
+}
+
+/*
+*  purpose   : Starts an empty sweep: the LRU stacks of every number of sets, and a shadow tag array
+*              for every configuration of every other policy asked for. Fully associative caches of
+*              more than SWEEP_FULL_SHADOW_LINES lines are only given for LRU.
+*  parameters: sweep     - Sweep initialized
+*              line_size - Bytes per line, a power of two from 2 to MAX_LINE_SIZE
+*              max_size  - Largest cache, a power of two from line_size to MEM_SIZE
+*              policies  - Policies given a table, LRU always is
+*              seed      - Seed of the random and BRRIP policies
+*  return    : true if everything could be allocated, the sweep is left released otherwise
+*/
+bool InitializeSweep(Sweep* sweep, unsigned int line_size, unsigned int max_size, const bool policies[POLICY_COUNT], unsigned int seed) {
+    unsigned int max_lines = max_size / line_size;
+
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->line_size = line_size;
+    sweep->max_size = max_size;
+    memcpy(sweep->policies, policies, sizeof(sweep->policies));
+    sweep->policies[POLICY_LRU] = true;
+
+    for (int bits = 0; (1u << bits) <= max_lines; bits++) {
+        StackSets* stack = &sweep->stacks[bits];
+
+        // One set holds every line of the fully associative caches, more sets only need the widest column
+        stack->sets = 1 << bits;
+        stack->depth = (bits == 0) ? max_lines : (max_lines >> bits < SWEEP_MAX_WAYS) ? max_lines >> bits : SWEEP_MAX_WAYS;
+        stack->tags = malloc(stack->sets * stack->depth * sizeof(unsigned short));
+        stack->used = calloc(stack->sets, sizeof(unsigned short));
+        stack->distances = calloc(stack->depth, sizeof(unsigned long));
+        sweep->stack_count = bits + 1;
+        if (stack->tags == NULL || stack->used == NULL || stack->distances == NULL) {
+            ReleaseSweep(sweep);
+            return false;
+        }
+    }
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (policy == POLICY_LRU || !sweep->policies[policy]) continue;
+        for (int size_bits = Log2(line_size); (1u << size_bits) <= max_size; size_bits++) {
+            unsigned int lines = (1u << size_bits) / line_size;
+
+            for (int column = 0; column < SWEEP_COLUMNS; column++) {
+                unsigned int ways = ColumnWays(column, lines);
+
+                if (ways == 0 || (column == SWEEP_WAY_COLUMNS && lines > SWEEP_FULL_SHADOW_LINES)) continue;
+                if (!InitializeShadow(&sweep->shadows[policy][size_bits][column], policy, seed, lines / ways, ways)) {
+                    ReleaseSweep(sweep);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+*  purpose   : Frees the stacks and shadow tag arrays of a sweep
+*  parameters: sweep - Sweep released
+*  return    : None
+*/
+void ReleaseSweep(Sweep* sweep) {
+    for (int bits = 0; bits < sweep->stack_count; bits++) {
+        free(sweep->stacks[bits].tags);
+        free(sweep->stacks[bits].used);
+        free(sweep->stacks[bits].distances);
+    }
+    sweep->stack_count = 0;
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        for (int size_bits = 0; size_bits < SWEEP_SIZES; size_bits++) {
+            for (int column = 0; column < SWEEP_COLUMNS; column++) {
+                if (sweep->shadows[policy][size_bits][column].tag != NULL) ReleaseShadow(&sweep->shadows[policy][size_bits][column]);
+            }
+        }
+    }
+}
+
+/*
+*  purpose   : Gives one access to every configuration of a sweep. In each LRU stack the access
+*              counts its stack distance and its line moves to the top; a line not found is pushed
+*              on top, dropping the bottom one when the stack is full. A TraceFunction.
+*  parameters: context - Sweep
+*              kind    - Kind of access (enum TraceKinds)
+*              address - Address accessed
+*  return    : None
+*/
+void SweepAccess(void* context, int kind, unsigned short address) {
+    Sweep* sweep = context;
+    unsigned short base = address & ~(sweep->line_size - 1);
+    unsigned int line = address / sweep->line_size;
+
+    sweep->accesses[kind]++;
+    for (int bits = 0; bits < sweep->stack_count; bits++) {
+        StackSets* stack = &sweep->stacks[bits];
+        int set = line & (stack->sets - 1);
+        unsigned short* tags = &stack->tags[set * stack->depth];
+        int used = stack->used[set];
+        int distance = 0;
+
+        while (distance < used && tags[distance] != base) distance++;
+        if (distance < used) stack->distances[distance]++;
+        else if (used < stack->depth) stack->used[set]++;
+        else distance = used - 1;
+        memmove(&tags[1], tags, distance * sizeof(unsigned short));
+        tags[0] = base;
+    }
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (policy == POLICY_LRU || !sweep->policies[policy]) continue;
+        for (int size_bits = 0; size_bits < SWEEP_SIZES; size_bits++) {
+            for (int column = 0; column < SWEEP_COLUMNS; column++) {
+                ShadowCache* shadow = &sweep->shadows[policy][size_bits][column];
+
+                if (shadow->tag != NULL) ShadowLookup(shadow, line & (shadow->replacement.sets - 1), base);
+            }
+        }
+    }
+}
+
+/*
+*  purpose   : Gives every access of a din trace to a sweep. Each line is "<kind> <hex address>",
+*              kind 0 a read, 1 a write, 2 an instruction fetch; further fields are ignored, and
+*              blank lines and lines starting with '#' are skipped.
+*  parameters: sweep - Sweep fed
+*              in    - Trace read
+*              name  - Name of the trace, for the error message
+*  return    : true if every record was valid
+*/
+bool ReadTrace(Sweep* sweep, FILE* in, const char* name) {
+    char line[TRACE_LINE];
+    int line_number = 0;
+
+    while (fgets(line, TRACE_LINE, in) != NULL) {
+        int kind;
+        unsigned long address;
+        char first;
+
+        line_number++;
+        if (sscanf(line, " %c", &first) != 1 || first == '#') continue;
+        if (sscanf(line, "%d %lx", &kind, &address) != 2 || kind < TRACE_READ || kind > TRACE_FETCH || address >= MEM_SIZE) {
+            fprintf(stderr, "Error: invalid trace record on line %d of %s\n", line_number, name);
+            return false;
+        }
+        SweepAccess(sweep, kind, (unsigned short)address);
+    }
+    return true;
+}
+
+/*
+*  purpose   : Gives the LRU misses of one configuration from the stack distances
+*  parameters: sweep - Sweep
+*              sets  - Sets of the cache
+*              ways  - Lines per set
+*  return    : Misses
+*/
+static unsigned long LruMisses(const Sweep* sweep, unsigned int sets, unsigned int ways) {
+    const StackSets* stack = &sweep->stacks[Log2(sets)];
+    unsigned long misses = sweep->accesses[TRACE_READ] + sweep->accesses[TRACE_WRITE] + sweep->accesses[TRACE_FETCH];
+
+    for (unsigned int distance = 0; distance < ways; distance++) misses -= stack->distances[distance];
+    return misses;
+}
+
+/*
+*  purpose   : Writes the miss rate tables of a sweep, one row per cache size and one column per
+*              associativity; "-" marks a configuration that does not exist or was not shadowed
+*  parameters: out   - File written to
+*              sweep - Sweep
+*  return    : None
+*/
+void PrintSweep(FILE* out, const Sweep* sweep) {
+    unsigned long total = sweep->accesses[TRACE_READ] + sweep->accesses[TRACE_WRITE] + sweep->accesses[TRACE_FETCH];
+
+    fprintf(out, "Accesses: %lu (%lu reads, %lu writes, %lu fetches), %u-byte lines\n", total,
+        sweep->accesses[TRACE_READ], sweep->accesses[TRACE_WRITE], sweep->accesses[TRACE_FETCH], sweep->line_size);
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (!sweep->policies[policy]) continue;
+        fprintf(out, "\n%s miss rate (%s)\n%9s", ReplacementPolicies[policy].name,
+            (policy == POLICY_LRU) ? "stack distance" : "shadow tag arrays", "size");
+        for (int column = 0; column < SWEEP_WAY_COLUMNS; column++) fprintf(out, " | %3u-way", 1u << column);
+        fprintf(out, " | %7s\n", "full");
+
+        for (int size_bits = Log2(sweep->line_size); (1u << size_bits) <= sweep->max_size; size_bits++) {
+            unsigned int lines = (1u << size_bits) / sweep->line_size;
+
+            fprintf(out, "%9u", 1u << size_bits);
+            for (int column = 0; column < SWEEP_COLUMNS; column++) {
+                unsigned int ways = ColumnWays(column, lines);
+                const ShadowCache* shadow = &sweep->shadows[policy][size_bits][column];
+                unsigned long misses;
+
+                if (ways == 0 || (policy != POLICY_LRU && shadow->tag == NULL)) {
+                    fprintf(out, " | %7s", "-");
+                    continue;
+                }
+                misses = (policy == POLICY_LRU) ? LruMisses(sweep, lines / ways, ways) : shadow->misses;
+                fprintf(out, " | %7.4f", total ? (double)misses / total : 0.0);
+            }
+            fprintf(out, "\n");
+        }
+    }
+}
+
+/*
+*  purpose   : Writes one access as a din trace line. A TraceFunction.
+*  parameters: file    - Trace file written to (FILE*)
+*              kind    - Kind of access (enum TraceKinds)
+*              address - Address accessed
+*  return    : None
+*/
+void WriteTraceRecord(void* file, int kind, unsigned short address) {
+    fprintf((FILE*)file, "%d %04x\n", kind, address);
+}
+
+/*
+*  purpose   : Prints the sweep command line
+*  parameters: None
+*  return    : EXIT_USAGE
+*/
+static int Usage() {
+    fprintf(stderr, "usage: -sweep <trace.din | - | image.xme> [-l line size] [-m max size] [-p lru|plru|fifo|random|srrip|brrip]...\n"
+        "              [-r seed] [-i instructions] [-c cycles] [-s stop address (hex)] [-o table file]\n"
+        "              [-core blocks|threaded]\n");
+    return EXIT_USAGE;
+}
+
+/*
+*  Purpose   : Sweeps the cache configurations over the accesses of a trace, or of an image run
+*              headless to a halt condition, and writes the miss rate tables.
+*              InitializeDecodeTable() must have been called before.
+*
+*  Parameters:
+*              argc - number of strings pointed to by argv
+*              argv - command line, argv[1] is "-sweep"
+*
+*  Return    : EXIT_HALTED once the tables are written, EXIT_USAGE or EXIT_LOAD_ERROR otherwise
+*              (EXIT_LOAD_ERROR also when the -o table file cannot be written)
+*/
+int RunSweep(int argc, char* argv[]) {
+    HaltConditions halt = { NO_LIMIT, NO_LIMIT, NO_STOP_ADDRESS };
+    const char* source = NULL;
+    const char* table_name = NULL;
+    unsigned long line_size = CACHE_LINE_SIZE;
+    unsigned long max_size = MEM_SIZE;
+    unsigned int seed = 1;
+    bool policies[POLICY_COUNT] = { false };
+    bool policy_given = false;
+    bool valid;
+    int core = CORE_BLOCKS;
+    Sweep* sweep;
+    FILE* out = stdout;
+
+    for (int i = 2; i < argc; i++) {
+        char* end;
+
+        if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            if (source != NULL) return Usage();
+            source = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "-core") == 0 && i + 1 < argc) {
+            core = FindCore(argv[++i]);
+            if (core < 0) return Usage();
+            continue;
+        }
+        if (i + 1 == argc || argv[i][2] != '\0') return Usage();
+        switch (argv[i][1]) {
+        case 'l': line_size = strtoul(argv[++i], &end, 10); break;
+        case 'm': max_size = strtoul(argv[++i], &end, 10); break;
+        case 'r': seed = (unsigned int)strtoul(argv[++i], &end, 10); break;
+        case 'i': halt.max_instr = strtoul(argv[++i], &end, 10); break;
+        case 'c': halt.max_cycles = strtoull(argv[++i], &end, 10); break;
+        case 's': halt.stop_address = (unsigned short)strtoul(argv[++i], &end, 16); break;
+        case 'o': table_name = argv[++i]; continue;
+        case 'p':
+            if (FindPolicy(argv[++i]) < 0) return Usage();
+            policies[FindPolicy(argv[i])] = true;
+            policy_given = true;
+            continue;
+        default: return Usage();
+        }
+        if (*end != '\0') return Usage();
+    }
+    if (source == NULL) return Usage();
+    if (line_size < 2 || line_size > MAX_LINE_SIZE || (line_size & (line_size - 1)) != 0 ||
+        max_size < line_size || max_size > MEM_SIZE || (max_size & (max_size - 1)) != 0) {
+        fprintf(stderr, "Error: the line size must be a power of two from 2 to 256 bytes, the max size one from a line to 65536 bytes\n");
+        return EXIT_USAGE;
+    }
+    if (!policy_given) {
+        for (int policy = 0; policy < POLICY_COUNT; policy++) policies[policy] = true;
+    }
+
+    sweep = malloc(sizeof(Sweep));
+    if (sweep == NULL || !InitializeSweep(sweep, (unsigned int)line_size, (unsigned int)max_size, policies, seed)) {
+        fprintf(stderr, "Error: not enough memory for the sweep\n");
+        free(sweep);
+        return EXIT_LOAD_ERROR;
+    }
+
+    if (IsProgramName(source)) {
+        // Live: every fetch, load and store of the run goes straight to the sweep
+        Machine* m = CreateMachine();
+        unsigned long executed;
+
+        valid = (m != NULL);
+        if (valid) {
+            m->headless = true;
+            m->core = core;
+            m->trace = SweepAccess;
+            m->trace_context = sweep;
+            valid = (LoadFile(m, source) == 0);
+        }
+        if (valid) RunToHalt(m, &halt, &executed);
+        else fprintf(stderr, "Error: %s could not be loaded\n", source);
+        DestroyMachine(m);
+    }
+    else {
+        FILE* in = (strcmp(source, "-") == 0) ? stdin : fopen(source, "r");
+
+        valid = (in != NULL && ReadTrace(sweep, in, source));
+        if (in == NULL) fprintf(stderr, "Error: %s could not be opened\n", source);
+        if (in != NULL && in != stdin) fclose(in);
+    }
+
+    if (valid) {
+        if (table_name != NULL) out = fopen(table_name, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: could not write %s\n", table_name);
+            valid = false;
+        }
+        else {
+            PrintSweep(out, sweep);
+            if (out != stdout) fclose(out);
+        }
+    }
+    ReleaseSweep(sweep);
+    free(sweep);
+    return valid ? EXIT_HALTED : EXIT_LOAD_ERROR;
+}
@@ -0,0 +1,53 @@
+/*
+* This is the header file for the cache design-space sweep.
+* A sweep reads a stream of memory accesses, from a trace file or live from a running image, and
+* gives the miss rate of every cache size and associativity in one pass: LRU from the stack
+* distances of the accesses (Mattson), the other replacement policies from one shadow tag array
+* per configuration.
+* Traces are in the Dinero din format, one "<kind> <hex address>" line per access (enum TraceKinds).
+*/
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "emulator.h"
+
+// Defining constants
+#define SWEEP_MAX_WAYS 16           // Most ways of a set-associative column of the table
+#define SWEEP_WAY_COLUMNS 5         // Columns of 1, 2, 4, 8 and 16 ways
+#define SWEEP_COLUMNS (SWEEP_WAY_COLUMNS + 1)   // and a fully associative column
+#define SWEEP_SIZES 17              // Sizes of 1 to MEM_SIZE bytes, powers of two, one row per size of a line or more
+#define SWEEP_FULL_SHADOW_LINES 256 // Largest fully associative cache shadowed for the policies other than LRU
+#define TRACE_LINE 128              // Longest line of a trace file
+
+// StackSets struct definition, the LRU stacks of every set of the caches with one number of sets
+typedef struct StackSets {
+    int sets;                       // Number of sets, a power of two
+    int depth;                      // Lines kept per stack, the most ways of a cache with this many sets
+    unsigned short* tags;           // depth line addresses per set, most recently used first
+    unsigned short* used;           // Lines held by each stack
+    unsigned long* distances;       // Accesses that found their line at each depth of its set's stack
+} StackSets;
+
+// Sweep struct definition, everything a sweep has seen
+typedef struct Sweep {
+    unsigned int line_size;         // Bytes per line of every configuration
+    unsigned int max_size;          // Largest cache size of the table
+    unsigned long accesses[TRACE_FETCH + 1];    // Accesses of each kind (enum TraceKinds)
+    int stack_count;                // Numbers of sets, 1 to max_size / line_size
+    StackSets stacks[SWEEP_SIZES];  // Indexed by log2 of the number of sets
+    bool policies[POLICY_COUNT];    // Policies given a table besides LRU
+    ShadowCache shadows[POLICY_COUNT][SWEEP_SIZES][SWEEP_COLUMNS];  // By policy, log2 of the size and column,
+                                                                    // NULL tags for no shadow
+} Sweep;
+
+extern bool InitializeSweep(Sweep* sweep, unsigned int line_size, unsigned int max_size, const bool policies[POLICY_COUNT], unsigned int seed);
+extern void ReleaseSweep(Sweep* sweep);
+extern void SweepAccess(void* sweep, int kind, unsigned short address);
+extern bool ReadTrace(Sweep* sweep, FILE* in, const char* name);
+extern void PrintSweep(FILE* out, const Sweep* sweep);
+extern void WriteTraceRecord(void* file, int kind, unsigned short address);
+extern int RunSweep(int argc, char* argv[]);
+
+#endif
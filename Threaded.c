@@ -0,0 +1,187 @@
+/**
+ * @file Threaded.c
+ * @brief Threaded Interpreter Core for the XM-23 Emulator
+ *
+ * This module runs instructions without the Control() -> Fetch() / Decode() -> handler call chain.
+ * Each instruction is fetched through the predecode store and dispatched on the kind recorded in
+ * its decode table entry. With GCC or Clang every operation ends with its own indirect jump
+ * (labels as values), so the host branch predictor learns each transition separately. Other
+ * compilers get the same body as a plain switch.
+ *
+ * Branches, BL, MOV, SWAP, SWPB and the MOVx instructions run inline; every other instruction
+ * calls its handler directly. The clock is charged exactly as Control() charges it.
+ *
+ */
+
+#include <stdio.h>
+#include "emulator.h"
+#include "Block.h"
+
+// Labels as values are a GCC extension that Clang also supports
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_GOTO
+#endif
+
+/*
+* Fetches the instruction at the PC, as Fetch() does: the first fetch from an address reads it from
+* memory and records its decode table entry, later fetches reuse the entry.
+* The memory access (FETCH_MEMORY()), the fetch (1) and the decode (1) are charged up front.
+* A headless machine stops before a BRA to itself, as RunBlocks() does, so RunToHalt() sees it.
+*/
+#define THREADED_FETCH()                                                                          \
+    if (PC == stop_address || executed == max_instr) goto done;                                   \
+    instr = m->predecoded[PC >> 1];                                                               \
+    if (instr == NULL) instr = m->predecoded[PC >> 1] = &DecodeTable[m->memory.WordMem[PC >> 1]]; \
+    if (instr->kind == T_BRA && m->headless && BranchesToSelf(instr)) goto done;                  \
+    m->instr_reg = instr->word;                                                                   \
+    FETCH_MEMORY(m, PC);                                                                          \
+    PC = PC + 2;                                                                                  \
+    m->cpu_clock += 2;                                                                            \
+    executed++
+
+#ifdef THREADED_GOTO
+#define OPERATION(kind) L_##kind
+#define DISPATCH() THREADED_FETCH(); goto *labels[instr->kind]
+#else
+#define OPERATION(kind) case kind
+#define DISPATCH() goto dispatch
+#endif
+
+// Registers written by the inlined operations
+#define DST_REG m->reg_file[REG][instr->dst]
+#define SRC_REG m->reg_file[REG][instr->src]
+
+/*
+*  purpose   : Runs instructions starting at the PC until the PC reaches stop_address or
+*              max_instr instructions have run. Unlike RunBlocks() this checks both before
+*              every instruction. A headless machine also stops before a BRA to itself.
+*
+*  parameters: stop_address - Address to stop at (break point)
+*              max_instr    - Number of instructions after which control returns to the caller
+*
+*  return    : Number of instructions executed
+*/
+unsigned long RunThreaded(Machine* m, unsigned short stop_address, unsigned long max_instr) {
+    unsigned long executed = 0;
+    const DecodedInstr* instr;
+    unsigned short src_val;
+
+#ifdef THREADED_GOTO
+    static void* labels[T_KINDS] = {
+        [T_RELATIVE] = &&L_T_RELATIVE, [T_INDEXED] = &&L_T_INDEXED,
+        [T_ARITHMETIC] = &&L_T_ARITHMETIC, [T_SRA_RRC] = &&L_T_SRA_RRC,
+        [T_SIGN_CHANGE] = &&L_T_SIGN_CHANGE, [T_UNIMPLEMENTED] = &&L_T_UNIMPLEMENTED,
+        [T_BL] = &&L_T_BL, [T_BEQ] = &&L_T_BEQ, [T_BNE] = &&L_T_BNE, [T_BC] = &&L_T_BC,
+        [T_BNC] = &&L_T_BNC, [T_BN] = &&L_T_BN, [T_BGE] = &&L_T_BGE, [T_BLT] = &&L_T_BLT,
+        [T_BRA] = &&L_T_BRA, [T_MOV] = &&L_T_MOV, [T_SWAP] = &&L_T_SWAP, [T_SWPB] = &&L_T_SWPB,
+        [T_MOVL] = &&L_T_MOVL, [T_MOVLZ] = &&L_T_MOVLZ, [T_MOVLS] = &&L_T_MOVLS, [T_MOVH] = &&L_T_MOVH
+    };
+
+    DISPATCH();
+#else
+dispatch:
+    THREADED_FETCH();
+    switch (instr->kind) {
+#endif
+
+    /* ---- Instructions run by their handlers ---- */
+    OPERATION(T_RELATIVE):
+        RelativeAddressing(m, instr);
+        DISPATCH();
+    OPERATION(T_INDEXED):
+        IndexedAddressing(m, instr);
+        DISPATCH();
+    OPERATION(T_ARITHMETIC):
+        Arithmetic(m, instr);
+        DISPATCH();
+    OPERATION(T_SRA_RRC):
+        SRA_RRC(m, instr);
+        DISPATCH();
+    OPERATION(T_SIGN_CHANGE):
+        SignChange(m, instr);
+        DISPATCH();
+    OPERATION(T_UNIMPLEMENTED):
+        Unimplemented(m, instr);
+        DISPATCH();
+
+    /* ---- Branches, the execute cycle (1) is charged by each ---- */
+    OPERATION(T_BL):
+        m->cpu_clock += 1;
+        LR = PC;
+        PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BEQ):
+        m->cpu_clock += 1;
+        if (PSW_Z() == 1) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BNE):
+        m->cpu_clock += 1;
+        if (PSW_Z() == 0) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BC):
+        m->cpu_clock += 1;
+        if (PSW_C() == 1) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BNC):
+        m->cpu_clock += 1;
+        if (PSW_C() == 0) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BN):
+        m->cpu_clock += 1;
+        if (PSW_N() == 1) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BGE):
+        m->cpu_clock += 1;
+        if ((PSW_N() ^ PSW_V()) == 0) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BLT):
+        m->cpu_clock += 1;
+        if ((PSW_N() ^ PSW_V()) == 1) PC = PC + instr->offset;
+        DISPATCH();
+    OPERATION(T_BRA):
+        m->cpu_clock += 1;
+        PC = PC + instr->offset;
+        DISPATCH();
+
+    /* ---- Register moves, same results as Mov_SWAP(), SwapPB() and Movs() ---- */
+    OPERATION(T_MOV):
+        m->cpu_clock += 1;
+        DST_REG = (instr->word_byte == WORD) ? SRC_REG : (unsigned char)SRC_REG;
+        DISPATCH();
+    OPERATION(T_SWAP):
+        m->cpu_clock += 1;
+        src_val = SRC_REG;
+        SRC_REG = DST_REG;
+        DST_REG = src_val;
+        DISPATCH();
+    OPERATION(T_SWPB):
+        m->cpu_clock += 1;
+        DST_REG = (unsigned short)(DST_REG << 8 | DST_REG >> 8);
+        DISPATCH();
+    OPERATION(T_MOVL):
+        m->cpu_clock += 1;
+        DST_REG = (DST_REG & SET_HI) | instr->offset;
+        DISPATCH();
+    OPERATION(T_MOVLZ):
+        m->cpu_clock += 1;
+        DST_REG = instr->offset;
+        DISPATCH();
+    OPERATION(T_MOVLS):
+        m->cpu_clock += 1;
+        DST_REG = SET_HI | instr->offset;
+        DISPATCH();
+    OPERATION(T_MOVH):
+        m->cpu_clock += 1;
+        DST_REG = (DST_REG & SET_LOW) | instr->offset;
+        DISPATCH();
+
+#ifndef THREADED_GOTO
+    default:
+        Unimplemented(m, instr);
+        DISPATCH();
+    }
+#endif
+
+done:
+    return executed;
+}
@@ -0,0 +1,212 @@
+/**
+ * @file WriteBuffer.c
+ * @brief Write Buffer Model for the XM-23 Emulator
+ *
+ * This module holds the write buffer a cache level (Cache.c) can have, set with the wbuffer option.
+ * Without one, a write-through store waits for the level below (a bus access, 3 cycles) before the
+ * CPU goes on. With one, the store waits in an entry and drains in the background:
+ *
+ *  - Each entry holds the stores to one line of the level. A store to a line whose entry has not
+ *    started to drain is combined into it, so stores to the same word or line drain once.
+ *  - Entries drain one after the other, in order. Each takes the cycles its first store would have
+ *    cost going down. An entry leaves the buffer once the clock passes the end of its drain.
+ *  - A store that finds the buffer full stalls the CPU until the oldest entry has drained.
+ *  - A load that misses a write-through cache takes its bytes from the newest entry of its line
+ *    when that entry holds all of them, instead of going down.
+ *
+ * The stores still reach the level below as they are made, so memory and the levels below always
+ * hold the values the CPU wrote; the buffer only changes when the CPU pays for them. The levels
+ * below count every store. The counters of the level (CacheCounters) count the buffered,
+ * combined and forwarded accesses, the stalls of a full buffer and how full the buffer was.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "WriteBuffer.h"
+
+/*
+*  purpose   : Allocates an empty write buffer
+*  parameters: buffer    - Write buffer
+*              entries   - Entries, 0 for no buffer (nothing is allocated)
+*              line_size - Bytes per entry, a line of the level
+*  return    : true if it could be allocated, the buffer is left released otherwise
+*/
+bool InitializeWriteBuffer(WriteBuffer* buffer, int entries, unsigned int line_size) {
+    memset(buffer, 0, sizeof(*buffer));
+    if (entries == 0) return true;
+
+    buffer->entry = calloc(entries, sizeof(WriteEntry));
+    buffer->data = calloc(entries, line_size);
+    buffer->written = calloc(entries, line_size);
+    if (buffer->entry == NULL || buffer->data == NULL || buffer->written == NULL) {
+        ReleaseWriteBuffer(buffer);
+        return false;
+    }
+    buffer->entries = entries;
+    buffer->line_size = line_size;
+    return true;
+}
+
+/*
+*  purpose   : Empties a write buffer
+*  parameters: buffer - Write buffer
+*  return    : None
+*/
+void ResetWriteBuffer(WriteBuffer* buffer) {
+    buffer->count = 0;
+}
+
+/*
+*  purpose   : Frees a write buffer, leaving none
+*  parameters: buffer - Write buffer
+*  return    : None
+*/
+void ReleaseWriteBuffer(WriteBuffer* buffer) {
+    free(buffer->entry);
+    free(buffer->data);
+    free(buffer->written);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+/*
+*  purpose   : Copies the entries waiting in a write buffer into another of the same size
+*  parameters: to   - Write buffer overwritten
+*              from - Write buffer copied
+*  return    : None
+*/
+void CopyWriteBuffer(WriteBuffer* to, const WriteBuffer* from) {
+    to->count = from->count;
+    if (from->entries == 0) return;
+    memcpy(to->entry, from->entry, from->count * sizeof(WriteEntry));
+    memcpy(to->data, from->data, from->count * from->line_size);
+    memcpy(to->written, from->written, from->count * from->line_size);
+}
+
+/*
+*  purpose   : Removes the oldest entries of a write buffer, as many as have drained by the clock
+*  parameters: m      - Machine
+*              buffer - Write buffer
+*  return    : None
+*/
+static void RetireWrites(Machine* m, WriteBuffer* buffer) {
+    int retired = 0;
+
+    while (retired < buffer->count && buffer->entry[retired].done <= m->cpu_clock) retired++;
+    if (retired == 0) return;
+    buffer->count -= retired;
+    memmove(buffer->entry, &buffer->entry[retired], buffer->count * sizeof(WriteEntry));
+    memmove(buffer->data, &buffer->data[retired * buffer->line_size], buffer->count * buffer->line_size);
+    memmove(buffer->written, &buffer->written[retired * buffer->line_size], buffer->count * buffer->line_size);
+}
+
+/*
+*  purpose   : Sends a store of a level down through its write buffer. The store is combined into
+*              the entry of its line if that entry has not started to drain, otherwise it takes a
+*              new entry, waiting for the oldest to drain when the buffer is full. The store goes
+*              down at once with the clock put back; the cycles it took are the drain time of a new
+*              entry.
+*  parameters: m       - Machine
+*              level   - Level with a write buffer
+*              address - Address of the first byte, even unless length is 1
+*              data    - Bytes stored
+*              length  - Number of bytes, a word or a byte
+*  return    : None
+*/
+void BufferStore(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length) {
+    WriteBuffer* buffer = &level->wbuffer;
+    CacheCounters* counters = &level->counters;
+    unsigned int offset = address & (buffer->line_size - 1);
+    unsigned short base = address - offset;
+    unsigned long long start = m->cpu_clock;
+    int slot;
+
+    RetireWrites(m, buffer);
+    slot = buffer->count - 1;
+    counters->buffered_stores++;
+    counters->buffer_occupancy += buffer->count;
+    if (buffer->count > (int)counters->max_buffer_occupancy) counters->max_buffer_occupancy = buffer->count;
+
+    // Only the newest entry of a line can still take a store, until it starts to drain
+    while (slot >= 0 && buffer->entry[slot].line != base) slot--;
+    if (slot >= 0 && buffer->entry[slot].start > m->cpu_clock) {
+        counters->combined_stores++;
+        WriteBelow(m, level, address, data, length);
+        m->cpu_clock = start;
+    }
+    else {
+        WriteEntry* entry;
+        unsigned long long cycles;
+
+        if (buffer->count == buffer->entries) {
+            counters->buffer_stalls++;
+            counters->buffer_stall_cycles += buffer->entry[0].done - m->cpu_clock;
+            m->cpu_clock = buffer->entry[0].done;
+            RetireWrites(m, buffer);
+            start = m->cpu_clock;
+        }
+        WriteBelow(m, level, address, data, length);
+        cycles = m->cpu_clock - start;
+        m->cpu_clock = start;
+
+        // Drains once the entries before it have
+        slot = buffer->count++;
+        entry = &buffer->entry[slot];
+        entry->line = base;
+        entry->start = (slot > 0 && buffer->entry[slot - 1].done > start) ? buffer->entry[slot - 1].done : start;
+        entry->done = entry->start + cycles;
+        memset(&buffer->written[slot * buffer->line_size], 0, buffer->line_size);
+    }
+    memcpy(&buffer->data[slot * buffer->line_size + offset], data, length);
+    memset(&buffer->written[slot * buffer->line_size + offset], 1, length);
+}
+
+/*
+*  purpose   : Answers a load that missed a level from its write buffer, when the newest entry of
+*              the line holds every byte the load reads. Only a write-through level answers loads:
+*              every store it takes goes through the buffer, so no newer copy can be anywhere else.
+*  parameters: m         - Machine
+*              level     - Level with a write buffer
+*              address   - Address read
+*              content   - Set to the value read, a word from the even address or a byte zero extended
+*              word_byte - WORD or BYTE
+*  return    : true if the load was answered, false if it has to go down
+*/
+bool BufferForward(Machine* m, CacheLevel* level, unsigned short address, unsigned short* content, int word_byte) {
+    WriteBuffer* buffer = &level->wbuffer;
+    unsigned int offset = address & (buffer->line_size - 1);
+    unsigned short base = address - offset;
+    unsigned int length = (word_byte == WORD) ? 2 : 1;
+
+    if (level->config.write_back) return false;
+    if (word_byte == WORD) offset &= ~1;
+    RetireWrites(m, buffer);
+    for (int i = buffer->count - 1; i >= 0; i--) {
+        const unsigned char* written = &buffer->written[i * buffer->line_size + offset];
+        const unsigned char* data = &buffer->data[i * buffer->line_size + offset];
+
+        if (buffer->entry[i].line != base) continue;
+        if (!written[0] || !written[length - 1]) return false;
+        if (word_byte == WORD) memcpy(content, data, sizeof(*content));
+        else *content = *data;
+        level->counters.forwarded_loads++;
+        return true;
+    }
+    return false;
+}
+
+/*
+*  purpose   : Forgets the bytes of a line waiting in a write buffer, so no load is answered with
+*              them once memory under the line has been changed another way. The entries still
+*              drain as they would have: their stores have already gone down.
+*  parameters: buffer - Write buffer
+*              base   - Address of the first byte of the line
+*  return    : None
+*/
+void BufferInvalidate(WriteBuffer* buffer, unsigned short base) {
+    for (int i = 0; i < buffer->count; i++) {
+        if (buffer->entry[i].line == base) memset(&buffer->written[i * buffer->line_size], 0, buffer->line_size);
+    }
+}
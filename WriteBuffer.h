@@ -0,0 +1,48 @@
+/*
+* This is the header file for the write buffer.
+* A write buffer sits between the data cache and the level below it. The stores the cache sends
+* down (write-through, and stores that miss without write allocation) wait in its entries, one
+* line each, and drain in the background, so a store only costs the CPU cycles when the buffer is
+* full. Stores to a line already waiting are combined into its entry, and a load that misses a
+* write-through cache is answered from the buffer when a waiting entry holds every byte it reads.
+*/
+#ifndef WRITE_BUFFER_H
+#define WRITE_BUFFER_H
+
+#include <stdbool.h>
+
+// Defining constants
+#define WBUFFER_MAX_ENTRIES 16      // Most entries of a write buffer
+
+// WriteEntry struct definition, the stores to one line waiting to drain
+typedef struct WriteEntry {
+    unsigned short line;            // Address of the first byte of the line
+    unsigned long long start;       // Clock the entry starts to drain, stores are combined into it until then
+    unsigned long long done;        // Clock it has drained by, it leaves the buffer then
+} WriteEntry;
+
+// WriteBuffer struct definition, the write buffer of one cache level
+typedef struct WriteBuffer {
+    int entries;                    // Entries of the buffer, 0 for no buffer
+    int count;                      // Entries waiting, oldest first
+    unsigned int line_size;         // Bytes per entry, a line of the level
+    WriteEntry* entry;              // entries entries
+    unsigned char* data;            // line_size bytes per entry
+    unsigned char* written;         // line_size flags per entry, set for each byte stored
+} WriteBuffer;
+
+typedef struct Machine Machine;
+typedef struct CacheLevel CacheLevel;
+
+// Set when a level has a write buffer
+#define BUFFERING(level) ((level)->wbuffer.entries != 0)
+
+extern bool InitializeWriteBuffer(WriteBuffer* buffer, int entries, unsigned int line_size);
+extern void ResetWriteBuffer(WriteBuffer* buffer);
+extern void ReleaseWriteBuffer(WriteBuffer* buffer);
+extern void CopyWriteBuffer(WriteBuffer* to, const WriteBuffer* from);
+extern void BufferStore(Machine* m, CacheLevel* level, unsigned short address, unsigned char* data, unsigned int length);
+extern bool BufferForward(Machine* m, CacheLevel* level, unsigned short address, unsigned short* content, int word_byte);
+extern void BufferInvalidate(WriteBuffer* buffer, unsigned short base);
+
+#endif
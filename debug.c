@@ -21,10 +21,17 @@
 #include <stdlib.h>
 #include "emulator.h"
 #include "Cache.h"
+#include "Block.h"
+#include "Headless.h"
+#include "Image.h"
+#include "Snapshot.h"
 #include <stdbool.h>
 #include <ctype.h>
 #include <signal.h>
 #define MAX_LINE_SIZE 16
+#define STRINGIFY(x) #x
+#define FIELD_WIDTH(x) STRINGIFY(x)
+#define BLOCK_RUN_CHUNK 100000 // Instructions run between checks for ^C
 
 enum { FALSE, TRUE };
 
@@ -41,6 +48,54 @@ void sigint_hdlr()
     signal(SIGINT, (_crt_signal_t)sigint_hdlr); /* Reinitialize SIGINT */
 }
 
+/*
+Function: ReloadMode
+
+Purpose:
+    Loads a new .XME (or .XMB) file over the program in memory (NF). Only the bytes that changed
+    are written, and only their cache lines and decoded instructions are dropped. The user picks
+    whether the registers, PSW and clock are kept, to go on running with the changed code, or
+    cleared to start the new program from its entry.
+*/
+void ReloadMode(Machine* m) {
+    char file_name[MAX_FILE_NAME + 1];
+    char answer[2];
+    LoadResult result;
+    ReloadSummary summary;
+    bool loaded;
+
+    printf("Enter the name of the .XME file to read (- for standard input): ");
+    if (scanf(" %" FIELD_WIDTH(MAX_FILE_NAME) "[^\n]", file_name) != 1) return;
+    printf("Keep registers, PSW and clock? (y/n): ");
+    if (scanf("%1s", answer) != 1) return;
+
+    loaded = ReloadProgram(m, file_name, tolower(answer[0]) == 'y', &result, &summary);
+    PrintLoadResult(stdout, file_name, &result);
+    if (!loaded) return;
+    printf("XME File reloaded: %u bytes changed in %u ranges, %d cache lines dropped\n", summary.bytes, summary.ranges, summary.lines);
+}
+
+/*
+Function: SnapshotMode
+
+Purpose:
+    SS keeps the whole machine as it is now, typically at a boot point reached with BK, replacing
+    any snapshot taken before. SR puts the machine back to that snapshot, copying back only the
+    memory written since, and can be used any number of times.
+*/
+void SnapshotMode(Machine* m, char command) {
+    if (command == 's') {
+        if (TakeSnapshot(m)) printf("Snapshot taken at PC %04X, clock %010llu\n", PC, m->cpu_clock);
+        else printf(RED "Error: not enough memory for the snapshot\n" RESET);
+    }
+    else if (command == 'r') {
+        if (m->snapshot == NULL) printf(RED "Error: no snapshot taken, use SS first\n" RESET);
+        else if (RestoreSnapshot(m)) printf("Snapshot restored at PC %04X, clock %010llu\n", PC, m->cpu_clock);
+        else printf(RED "Error: the caches were reconfigured since the snapshot\n" RESET);
+    }
+    else printf(RED "Human Error: That is not an option\n" RESET);
+}
+
 /*
 Function: DebugMode
 
@@ -52,7 +107,7 @@ Purpose:
     a message is printed to indicate this. If execution stops for any other reason, a warning message
     is printed.
 */
-void DebugMode() {
+void DebugMode(Machine* m) {
     printf("Enter a stop address:");
     unsigned short stop_address;
     scanf("%04hx", &stop_address);
@@ -72,7 +127,9 @@ void DebugMode() {
     printf("Running program to address : %04hx\n", stop_address);
     int pri_isa = 0;
     while (PC != stop_address && !ctrl_c_fnd) { //&& !ctrl_c_fnd
-        Control();
+        // The machine's core (-core) runs until the stop address, ^C is checked between runs
+        if (m->core == CORE_THREADED) RunThreaded(m, stop_address, BLOCK_RUN_CHUNK);
+        else RunBlocks(m, stop_address, BLOCK_RUN_CHUNK);
     }
 
     if (PC == stop_address && !ctrl_c_fnd) printf("Break point reached at address %04hx \n", PC);
@@ -84,17 +141,17 @@ void DebugMode() {
  *   Purpose: Displays the content of all the registers in the register file and
  *            the location in memory they point to.
  */
-void PrintRegMem(int iter) {
-    unsigned short data = RegFile[0][iter];
-    Bus(RegFile[0][iter], &data, R, WORD);
+void PrintRegMem(Machine* m, int iter) {
+    unsigned short data = m->reg_file[0][iter];
+    Bus(m, m->reg_file[0][iter], &data, R, WORD);
     printf(" -------------> |_%04X_|\n", data);
 
 }
-void DisplayRegisters() {
+void DisplayRegisters(Machine* m) {
     for (int j = 0; j < NUM_REG; j++) {
-        printf("R%d: %04X", j, RegFile[REG][j]);
+        printf("R%d: %04X", j, m->reg_file[REG][j]);
 
-        PrintRegMem(j);
+        PrintRegMem(m, j);
     }
 }
 /*
@@ -118,12 +175,13 @@ void PrintBits(unsigned short value) {
 /*
  *   Purpose: Displays all PSW bits.
  */
-void PrintPswValues() {
+void PrintPswValues(Machine* m) {
+    SyncPsw(m);
     printf("PSW Values:\n");
-    printf("c: %u\n", pswptr->c);
-    printf("z: %u\n", pswptr->z);
-    printf("n: %u\n", pswptr->n);
-    printf("v: %u\n", pswptr->v);
+    printf("c: %u\n", m->psw.c);
+    printf("z: %u\n", m->psw.z);
+    printf("n: %u\n", m->psw.n);
+    printf("v: %u\n", m->psw.v);
 }
 
 /*
@@ -197,6 +255,8 @@ void PrintInstructions() {
     printf("    C   : Continue to the next instruction\n");
     printf("    PC  : Change the program-counter\n");
     printf("    BK  : Add a break point to a specific Address\n");
+    printf("    SS  : Take a snapshot of the machine (e.g. at a boot point)\n");
+    printf("    SR  : Restore the machine to the snapshot\n");
     printf("    PW  : Update PSW (Warning this will affect program flow\n");
     printf("    L  : Print CPU Clock\n");
     printf("\n");
@@ -211,7 +271,7 @@ void PrintInstructions() {
 
     printf("\033[1;33m----- File Control Commands -----\033[0m\n");
     printf("   E   : End the program\n");
-    printf("   NF  : Load New .xme File in memory");
+    printf("   NF  : Load New .xme File in memory, writing only what changed");
     printf(YELLOW " (Warning: This might overwrite the contents loaded to memory)\n" RESET);
     printf("\n");
 
@@ -232,7 +292,7 @@ void PrintInstructions() {
  *            The function provides multiple user commands to inspect and manipulate the state of
  *            the XM-23 emulator.
  */
-void Controller() {
+void Controller(Machine* m) {
     /************ Debugger startup software ************/
     unsigned short pc_input;
     unsigned short start, end;
@@ -241,7 +301,7 @@ void Controller() {
     int reg_num;
     int update_psw;
 
-    char* primitive[] = { "c", "e", "pc", "pr", "pm", "pb", "ps", "bk", "nf", "a", "pw","l","h" };
+    char* primitive[] = { "c", "e", "pc", "pr", "pm", "pb", "ps", "bk", "nf", "ss", "sr", "a", "pw","l","h" };
 
     char input[3]; // Increase the size to accommodate the null terminator
     bool debug = true;
@@ -254,7 +314,7 @@ void Controller() {
         }
         switch (input[0]) {
         case 'c':
-            Control();
+            Control(m);
             break;
 
         case 'p':
@@ -271,12 +331,12 @@ void Controller() {
                 }
                 // Assign pc_value to input if necessary
                 PC = pc_input;
-                Control();
+                Control(m);
                 printf("NEW PC : %2X \n", PC);
                 break;
             case 'r':
                 printf("Displaying Register's  (In HEX format)\n");
-                DisplayRegisters();
+                DisplayRegisters(m);
                 break;
             case 'm':
 
@@ -292,7 +352,7 @@ void Controller() {
                 }
                 else {
                     // Print the specified range of memory
-                    PrintMem(&memory_u.ByteMem[start], &memory_u.ByteMem[end], start);
+                    PrintMem(&m->memory.ByteMem[start], &m->memory.ByteMem[end], start);
                 }
                 break;
             case 'b':
@@ -303,32 +363,33 @@ void Controller() {
                     printf("\nEnter Register number:");
                     fscanf(stdin, "%d", &reg_num);
                     if (reg_num > 7) printf("Error: only registers 0 to 7 possible \n");
-                    PrintBits(RegFile[0][reg_num]);
+                    PrintBits(m->reg_file[0][reg_num]);
                 }
-                else if (input_choice == 2) PrintBits(instr_reg);
+                else if (input_choice == 2) PrintBits(m->instr_reg);
                 else  printf(RED "Error: nope either 1 or 2 only \n" RESET);
 
                 break;
             case 's':
-                PrintPswValues();
+                PrintPswValues(m);
                 break;
             case 'w':
 
                 printf(" To change Z (1) C (2) V (3) N (4): ");
                 fscanf(stdin, "%d", &update_psw);
+                SyncPsw(m);
                 switch (update_psw)
                 {
                 case 1:
-                    psw.z = psw.z ^ 1;
+                    m->psw.z = m->psw.z ^ 1;
                     break;
                 case 2:
-                    psw.c = psw.c ^ 1;
+                    m->psw.c = m->psw.c ^ 1;
                     break;
                 case 3:
-                    psw.v = psw.v ^ 1;
+                    m->psw.v = m->psw.v ^ 1;
                     break;
                 case 4:
-                    psw.n = psw.n ^ 1;
+                    m->psw.n = m->psw.n ^ 1;
                     break;
 
                 default:
@@ -337,7 +398,7 @@ void Controller() {
                     break;
                 }
             case 'h':
-                PrintCache();
+                PrintCache(m);
                 break;
             defult:
                 printf(RED "Human Error: That is not an option\n" RESET);
@@ -347,10 +408,13 @@ void Controller() {
             }
             break;
         case 'b':
-            DebugMode();
+            DebugMode(m);
             break;
         case 'n':
-            OpenLoadF(0, NULL);
+            ReloadMode(m);
+            break;
+        case 's':
+            SnapshotMode(m, input[1]);
             break;
 
         case 'h':
@@ -361,7 +425,7 @@ void Controller() {
             goto exit_loop;
 
         case 'l':
-            printf("Current CPU Clock %010d\n", CPU_CLOCK);
+            printf("Current CPU Clock %010llu\n", m->cpu_clock);
             break;
         default:
             printf(RED "Human Error: That is not an option\n" RESET);
@@ -22,6 +22,12 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include "Cache.h"
+#include "Replacement.h"
+
+// Every machine's state lives in its own Machine (see Machine context below)
+typedef struct Machine Machine;
+
 #define MAXBufSize 256
 
 #define WORD 0
@@ -32,10 +38,11 @@
 #define REG_CONS 2
 #define REG 0
 #define GP_REG 4
-#define BP RegFile[0][4]
-#define LR RegFile[0][5]
-#define SP RegFile[0][6]
-#define PC RegFile[REG][7] 
+// Register aliases name the registers of the machine "m" in scope
+#define BP m->reg_file[0][4]
+#define LR m->reg_file[0][5]
+#define SP m->reg_file[0][6]
+#define PC m->reg_file[REG][7] 
 #define number_reg 8
 #define num_consts 8
 #define NUM_REG 8
@@ -47,7 +54,7 @@
 #define MAXBufSize 256
 #define WORD_MEM_SIZE 1<<15
 #define BYTE_MEM_SIZE 1<<16
-#define MAX_FILE_NAME 20
+#define MAX_FILE_NAME 1024
 #define DataStart 8
 
 //  Instruction Specific definitions
@@ -76,6 +83,7 @@ enum BR { BEQ , BNE , BC, BNC, BN, BGE, BLT, BRA };
 enum Arithmetics {ADD, ADDC, SUB, SUBC, DADD, CMP, XOR, AND, OR, BIT , BIC , BIS };
 enum Mov{MOVL, MOVLZ, MOVLS, MOVH};
 enum IndexedAddressings {LD =0b10, ST = 0b11};
+enum RelativeAddressings {LDR, STR};
 enum OneOprands{SRA, RRC, COMP, SWAPB, SXT };
 enum PrePos{Normal, POS_INC, POS_DEC,PRE_INC = 0b101, PRE_DEC = 0b110};
 
@@ -98,10 +106,10 @@ enum PrePos{Normal, POS_INC, POS_DEC,PRE_INC = 0b101, PRE_DEC = 0b110};
 #define SET_BIT(var, pos, val) ((var) = ((var) & ~(1 << (pos))) | ((val) << (pos))) 
 #define Hex_2_Bit(var, pos) (((var) & (1 << pos))>>pos)
 
-extern union Memory {
+union Memory {
     unsigned short WordMem[WORD_MEM_SIZE];
     unsigned char ByteMem[BYTE_MEM_SIZE];
-}memory_u;
+};
 
 
 /***************************************** Program Status Word **********************************************/
@@ -120,11 +128,40 @@ typedef struct
     unsigned short reserved : 4;
     unsigned short previous : 3; /* Previous priority */
 }psw_bits;
-//extern struct psw_bits *psw_ptr;
-extern psw_bits psw;
-extern psw_bits* pswptr;
 extern unsigned carry[2][2][2];
 extern unsigned overflow[2][2][2];
+
+/*
+* Lazy flags: update_psw() and update_psw_2() only record the operation, and each flag is
+* computed when it is read through PSW_C() .. PSW_V() (of the machine "m" in scope). Code that reads
+* or writes the psw struct directly must call SyncPsw() first. Comment out LAZY_PSW to update the PSW eagerly.
+*/
+#define LAZY_PSW
+
+typedef struct {
+    unsigned char arith;        // update_psw() pending: C, Z, N and V
+    unsigned char logic;        // update_psw_2() pending: Z and N (newer than arith)
+    unsigned short src, dst, res, wb;       // Operands of the pending update_psw()
+    unsigned short logic_res, logic_wb;     // Operands of the pending update_psw_2()
+}lazy_psw_state;
+
+extern void SyncPsw(Machine* m);
+extern unsigned short PswCarry(Machine* m);
+extern unsigned short PswZero(Machine* m);
+extern unsigned short PswNegative(Machine* m);
+extern unsigned short PswOverflow(Machine* m);
+
+#ifdef LAZY_PSW
+#define PSW_C() PswCarry(m)
+#define PSW_Z() PswZero(m)
+#define PSW_N() PswNegative(m)
+#define PSW_V() PswOverflow(m)
+#else
+#define PSW_C() m->psw.c
+#define PSW_Z() m->psw.z
+#define PSW_N() m->psw.n
+#define PSW_V() m->psw.v
+#endif
 /************************************* DADD Implementation *************************************************/
 
 typedef struct {
@@ -147,6 +184,121 @@ extern union word_byte {
 
 extern dadd_bits dadd;
 
+/* ******************************** Decode Table ****************************************** */
+
+/*
+* Every 16-bit instruction word is decoded once at startup into DecodeTable[word].
+* Decode() then costs a single indexed load and one call through the handler.
+*
+*   handler   : Instruction implementation to call
+*   word      : Raw instruction word this entry was decoded from
+*   offset    : Branch offset (shifted + sign extended), LDR/STR offset (sign extended)
+*               or the MOVx byte (already aligned for MOVH)
+*   op        : Operation passed to the handler (enum BR, Arithmetics, Mov, OneOprands ...)
+*   src, dst  : Source and destination register (or constant) numbers
+*   word_byte : W/B bit
+*   reg_const : R/C bit
+*   addr_mode : PRPO | DEC | INC bits of LD and ST (enum PrePos)
+*   kind      : Label the threaded interpreter jumps to (enum ThreadedKinds)
+*/
+#define DECODE_TABLE_SIZE (1 << 16)
+
+typedef struct DecodedInstr DecodedInstr;
+typedef void (*InstrHandler)(Machine* m, const DecodedInstr* instr);
+
+struct DecodedInstr {
+    InstrHandler handler;
+    unsigned short word;
+    unsigned short offset;
+    unsigned char op;
+    unsigned char src;
+    unsigned char dst;
+    unsigned char word_byte;
+    unsigned char reg_const;
+    unsigned char addr_mode;
+    unsigned char kind;
+#ifdef PrintInstra
+    const char* mnemonic;
+#endif
+};
+
+extern DecodedInstr DecodeTable[DECODE_TABLE_SIZE];
+extern void InvalidateDecoded(Machine* m, unsigned short address);
+
+/* Dispatch targets of the threaded interpreter, one per handler and one per inlined operation */
+enum ThreadedKinds {
+    T_RELATIVE, T_INDEXED, T_ARITHMETIC, T_SRA_RRC, T_SIGN_CHANGE, T_UNIMPLEMENTED,
+    T_BL, T_BEQ, T_BNE, T_BC, T_BNC, T_BN, T_BGE, T_BLT, T_BRA,
+    T_MOV, T_SWAP, T_SWPB, T_MOVL, T_MOVLZ, T_MOVLS, T_MOVH,
+    T_KINDS
+};
+
+/* Instructions recognised by the decoder but not implemented yet */
+enum Unimplemented { UNIMPL_PRI, UNIMPL_CEX, UNIMPL_OPCODE, UNIMPL_NONE };
+
+/* ******************************** Machine context ****************************************** */
+
+/* Kinds of memory access in a trace, the labels of the Dinero din format */
+enum TraceKinds { TRACE_READ, TRACE_WRITE, TRACE_FETCH };
+
+/* Receives every fetch, load and store of a machine, in program order (Machine.trace) */
+typedef void (*TraceFunction)(void* context, int kind, unsigned short address);
+
+/*
+* Everything one XM-23 machine owns. Each machine is independent, so one process can run many
+* of them (one per thread); only DecodeTable is shared, and it is read only once built.
+*
+*   reg_file       : Registers (row REG) and constants (row 1)
+*   memory         : 64 KiB of memory, word and byte addressable
+*   psw, lazy_psw  : Program status word and its pending flag updates
+*   instr_reg      : Instruction register
+*   cpu_clock      : CPU clock cycles
+*   origin_address : Address extracted from the last S-record read
+*   cache          : L1 instruction, L1 data and L2 caches: configuration, lines, replacement policy
+*                    and hit, miss and write back counts of each (Cache.c, ConfigureCache())
+*   fetch_level    : Cache fetches go through, NULL for a flat memory access (FETCH_MEMORY())
+*   data_level     : Cache loads and stores go through (Cache()), NULL for the Bus
+*   shadows        : Shadow tag arrays of the data cache, one per policy, NULL unless enabled
+*   fetch_misses   : L1 instruction cache misses fetching each word address (TopMisses())
+*   data_misses    : Data cache misses of the loads and stores of the instruction at each word address
+*   trace          : Called with every fetch, load and store before the cache sees it, NULL unless
+*                    recording (WriteTraceRecord()) or sweeping live (SweepAccess())
+*   trace_context  : First argument of trace
+*   predecoded     : Decoded instruction at each word address, NULL until that address is first fetched
+*   blocks         : Basic-block translation cache (Block.c)
+*   jit            : Native code, NULL until the first block is compiled (Jit.c)
+*   snapshot       : State to restore and the pages written since (Snapshot.c), NULL for none
+*   headless       : Set when no console is attached: run-time messages are not printed and
+*                    RunBlocks() stops at a branch to itself instead of spinning on it
+*/
+struct Machine {
+    unsigned short reg_file[REG_CONS][NUM_REG];
+    union Memory memory;
+    psw_bits psw;
+    lazy_psw_state lazy_psw;
+    unsigned short instr_reg;
+    unsigned long long cpu_clock;
+    unsigned short origin_address;
+    CacheLevel cache[CACHE_LEVELS];
+    CacheLevel* fetch_level;
+    CacheLevel* data_level;
+    ShadowCache* shadows;
+    unsigned int fetch_misses[WORD_MEM_SIZE];
+    unsigned int data_misses[WORD_MEM_SIZE];
+    TraceFunction trace;
+    void* trace_context;
+    const DecodedInstr* predecoded[WORD_MEM_SIZE];
+    struct BlockCache* blocks;
+    struct JitState* jit;
+    struct Snapshot* snapshot;
+    int core;               // Core RunToHalt() and BK run on (enum RunCores, Headless.h)
+    bool headless;
+};
+
+extern Machine* CreateMachine();
+extern void DestroyMachine(Machine* m);
+extern void ResetMachineState(Machine* m);
+
 /* ******************************** Program Flow control ****************************************** */
 
 /*
@@ -158,55 +310,68 @@ Fetch cycle   : 1
 Decode cycle  : 1
 Execute cycle : 1
 
+With an L1 instruction cache the memory access of a fetch costs nothing on a hit and a line fill
+on a miss, instead of 3.
+
 */
-extern void Controller();
-extern void Control();
-extern void Fetch();
-extern void Decode();
-extern void update_psw(unsigned short src, unsigned short dst, unsigned short res, unsigned short wb);
-extern void Bus(unsigned short mar, unsigned short* mdr_ptr, int read_write, int word_byte);
-int CPU_CLOCK;
+#define BUS_CYCLES 3
+
+// Charges the memory access of fetching the instruction at an address, and traces it when a trace is recorded
+#define FETCH_MEMORY(m, address)                                                                     \
+    do {                                                                                             \
+        if ((m)->trace != NULL) (m)->trace((m)->trace_context, TRACE_FETCH, (address));              \
+        if ((m)->fetch_level == NULL) (m)->cpu_clock += BUS_CYCLES; else InstructionFetch((m), (address)); \
+    } while (0)
+
+extern void Controller(Machine* m);
+extern void Control(Machine* m);
+extern unsigned long RunThreaded(Machine* m, unsigned short stop_address, unsigned long max_instr);
+extern void Fetch(Machine* m);
+extern void Decode(Machine* m);
+extern void InitializeDecodeTable();
+extern void update_psw(Machine* m, unsigned short src, unsigned short dst, unsigned short res, unsigned short wb);
+extern void update_psw_2(Machine* m, unsigned short result, unsigned short word_byte);
+extern void Bus(Machine* m, unsigned short mar, unsigned short* mdr_ptr, int read_write, int word_byte);
+extern void BusBurst(Machine* m, unsigned short mar, unsigned char* data, unsigned int length, int read_write);
 
 /* ******************************** Memory management ****************************************** */
 extern unsigned char memory[MEM_SIZE];
-extern unsigned short RegFile[REG_CONS][NUM_REG];
-extern unsigned short instr_reg;
 
-/* Loader Memory management:
-*   testing_input : Input file buffer 
-*   origin_address: Address extracted from S9 record
-*/ 
-extern unsigned char testing_input[MAXBufSize];
-unsigned short origin_address; 
-extern void ReadFile(FILE* in_file);
-int OpenLoadF(int argc, char* argv[]);
+/* Loader Memory management */
+int OpenLoadF(Machine* m, int argc, char* argv[]);
+extern int LoadFile(Machine* m, const char* file_name);
 
 
 /* ******************************** Instruction Implementations ******************************** */
-extern void RelativeAddressing();
-extern void IndexedAddressing(extern enum IndexedAddressings load_store);
-
-extern void Branching(int branch_type);
-extern void BranchLink();
-extern void Movs();
-
-extern void OneOprand(extern enum OneOprands);
-
-extern void SignChange(int defined);
-extern void Arithmetic(extern enum Arithmetics arithmetics);
-extern unsigned short Dadd(unsigned short srcValue, unsigned short dstValue, unsigned char word_byte);
-extern unsigned short BcdAdd(unsigned short nibble_x, unsigned short nibble_y, unsigned short* carry);
-extern unsigned short Addc(unsigned short src, unsigned short dst, unsigned short temp_carry, char word_byte);
+extern void RelativeAddressing(Machine* m, const DecodedInstr* instr);
+extern void IndexedAddressing(Machine* m, const DecodedInstr* instr);
+
+extern void Branching(Machine* m, const DecodedInstr* instr);
+extern int BranchCondition(Machine* m, unsigned char branch);
+extern void BranchLink(Machine* m, const DecodedInstr* instr);
+extern void Movs(Machine* m, const DecodedInstr* instr);
+
+extern void Mov_SWAP(Machine* m, const DecodedInstr* instr);
+extern void SRA_RRC(Machine* m, const DecodedInstr* instr);
+extern void SwapPB(Machine* m, const DecodedInstr* instr);
+extern void SignChange(Machine* m, const DecodedInstr* instr);
+extern void Arithmetic(Machine* m, const DecodedInstr* instr);
+extern void Unimplemented(Machine* m, const DecodedInstr* instr);
+extern unsigned short Dadd(Machine* m, unsigned short srcValue, unsigned short dstValue, unsigned char word_byte);
+extern unsigned short BcdAdd(Machine* m, unsigned short nibble_x, unsigned short nibble_y, unsigned short* carry);
+extern unsigned short Addc(Machine* m, unsigned short src, unsigned short dst, unsigned short temp_carry, char word_byte);
 
 /* ******************************** User Interface ******************************************************/
 extern void PrintInstructions();
-extern void DisplayRegisters();
+extern void DisplayRegisters(Machine* m);
 extern void printBits(instr_reg);
 extern void PrintMemory(unsigned short, int);
-extern void PrintRegMem(int);
-extern void PrintPswValues();
+extern void PrintRegMem(Machine* m, int);
+extern void PrintPswValues(Machine* m);
 extern void PrintWholeMemory();
-extern void DebugMode();
+extern void DebugMode(Machine* m);
+extern void ReloadMode(Machine* m);
+extern void SnapshotMode(Machine* m, char command);
 extern void PrintMemoryRange();
 extern void PrintMem(unsigned char* start, unsigned char* end, unsigned short start_address);
 extern void AddAssembly();
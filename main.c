@@ -13,28 +13,91 @@
 #include <signal.h> /* Signal handling software */
 
 #include "emulator.h"
+#include "Block.h"
+#include "Farm.h"
+#include "Headless.h"
+#include "Image.h"
+#include "Sweep.h"
 
 
-union Memory memory_u;
 
-unsigned short instr_reg;
+int main(int argc, char* argv[]) {
+    Machine* m;
+    CacheConfig configs[CACHE_LEVELS];
+    const char* config_error;
+    int core = CORE_BLOCKS;
+
+    InitializeDecodeTable();
+    DefaultCacheConfig(configs);
 
+    // Batch farm: FauxProcessor -farm <manifest> [results file] [threads] [cache options] [blocks|threaded]
+    if (argc >= 3 && strcmp(argv[1], "-farm") == 0) {
+        if (argc >= 6 && !ParseCacheOptions(configs, argv[5])) {
+            printf("Error: invalid cache options %s\n", argv[5]);
+            return 1;
+        }
+        if (argc >= 7 && FindCore(argv[6]) < 0) {
+            printf("Error: unknown core %s\n", argv[6]);
+            return 1;
+        }
+        config_error = CheckCacheConfig(configs);
+        if (config_error != NULL) {
+            printf("Error: invalid cache configuration, %s\n", config_error);
+            return 1;
+        }
+        return RunFarm(argv[2], (argc >= 4) ? argv[3] : "results.txt", (argc >= 5) ? atoi(argv[4]) : 0, configs,
+            (argc >= 7) ? FindCore(argv[6]) : CORE_BLOCKS);
+    }
+    // Headless run: FauxProcessor -run <image.xme> [options], prints only the final state
+    if (argc >= 2 && strcmp(argv[1], "-run") == 0) {
+        return RunHeadless(argc, argv);
+    }
 
+    // Cache sweep: FauxProcessor -sweep <trace.din | - | image.xme> [options], prints the miss rate tables
+    if (argc >= 2 && strcmp(argv[1], "-sweep") == 0) {
+        return RunSweep(argc, argv);
+    }
 
+    // Conversion: FauxProcessor -convert <image.xme> [image.xmb], writes the binary image
+    if (argc >= 2 && strcmp(argv[1], "-convert") == 0) {
+        return ConvertImage(argc, argv);
+    }
 
-int main(int argc, char* argv[]) {
     printf("ECED3403 - Computer Architecture Assigment 1\n");
     printf("X-Makina (XM-23) Emulator\n");
     printf("Developed by Omar Hameeed (B00764655)\n");
     printf("\n");
 
-    if (OpenLoadF(argc, argv) != 0) {
+    // Interactive run: FauxProcessor [image.xme] [-cache options] [-cachefile file] [-core blocks|threaded]
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-cache") == 0 && ParseCacheOptions(configs, argv[i + 1])) continue;
+        if (strcmp(argv[i], "-cachefile") == 0 && ReadCacheConfig(configs, argv[i + 1])) continue;
+        if (strcmp(argv[i], "-core") == 0 && (core = FindCore(argv[i + 1])) >= 0) continue;
+        printf("Error: invalid cache option %s %s. Exiting program.\n", argv[i], argv[i + 1]);
+        return 1;
+    }
+    config_error = CheckCacheConfig(configs);
+    if (config_error != NULL) {
+        printf("Error: invalid cache configuration, %s. Exiting program.\n", config_error);
+        return 1;
+    }
+
+    m = CreateMachine();
+    if (m == NULL || !ConfigureCache(m, configs)) {
+        printf("Error: not enough memory for the machine. Exiting program.\n");
+        DestroyMachine(m);
+        return 1;
+    }
+    m->core = core;
+
+    if (OpenLoadF(m, argc, argv) != 0) {
         printf("Error opening file. Exiting program.\n");
+        DestroyMachine(m);
         return 1;
     }
 
-    CPU_CLOCK = 0;
-    Controller();
+    Controller(m);
+    DestroyMachine(m);
 
     return 0;
 }
@@ -4,16 +4,13 @@
 //#define PSW_DEBUG
 unsigned carry[2][2][2] = { 0, 0, 1, 0, 1, 0, 1, 1 };
 unsigned overflow[2][2][2] = { 0, 1, 0, 0, 0, 0, 1, 0 };
-psw_bits psw = { 0 };
-psw_bits* pswptr = &psw;
-
-struct psw_bits* psw_ptr; /* PSW */
 
 /**
 * Reference: Hughes, L (2023) Using the PSW software (Version 2.0) [Source code].
 
  * Purpose: Updates the PSW based on the results of arithmetic operations.
  *
+ * @param m: Machine whose PSW is updated.
  * @param src: The source of operation.
  * @param dst: The destination of operation.
  * @param res: The result of  operation.
@@ -21,7 +18,7 @@ struct psw_bits* psw_ptr; /* PSW */
  *
  * 
  */
-void update_psw (unsigned short src, unsigned short dst, unsigned short res,
+void update_psw (Machine* m, unsigned short src, unsigned short dst, unsigned short res,
     unsigned short wb)
 {
     /*
@@ -29,6 +26,15 @@ void update_psw (unsigned short src, unsigned short dst, unsigned short res,
      - Using src, dst, and res values and whether word or byte
      - ADD, ADDC, SUB, and SUBC
     */
+#ifdef LAZY_PSW
+    /* Record the operation, the flags are computed when read */
+    m->lazy_psw.arith = 1;
+    m->lazy_psw.logic = 0;
+    m->lazy_psw.src = src;
+    m->lazy_psw.dst = dst;
+    m->lazy_psw.res = res;
+    m->lazy_psw.wb = wb;
+#else
     unsigned short mss, msd, msr; /* Most significant src, dst, and res bits */
 
     if (wb == 0)
@@ -46,17 +52,18 @@ void update_psw (unsigned short src, unsigned short dst, unsigned short res,
     }
 
     /* Carry */
-    pswptr->c = carry[mss][msd][msr];
+    m->psw.c = carry[mss][msd][msr];
     /* Zero */
-    pswptr->z = (res == 0);
+    m->psw.z = (res == 0);
     /* Negative */
-    pswptr->n = (msr == 1);
+    m->psw.n = (msr == 1);
     /* oVerflow */
-    pswptr->v = overflow[mss][msd][msr];
+    m->psw.v = overflow[mss][msd][msr];
 #ifdef PSW_DEBUG
 
     printf("mss: %d msd: %d msr: %d\n", mss, msd, msr);
 #endif // PSW_DEBUG
+#endif // LAZY_PSW
 
 
 
@@ -65,25 +72,101 @@ void update_psw (unsigned short src, unsigned short dst, unsigned short res,
 /**
  * Purpose: Updates the PSW based on the result of a logic operation.
  * Only the Negative (N) and Zero (Z) flags of the PSW are updated.
+ * @param m: Machine whose PSW is updated.
  * @param result: The result of the operation.
  * @param word_byte: Indicator for the size.
  */
 
-void update_psw_2(unsigned short result, unsigned short word_byte) 
+void update_psw_2(Machine* m, unsigned short result, unsigned short word_byte) 
 {
     /*
      - Update the PSW bits (N & Z) only 
      - OR, XOR and AND. 
     */
-    unsigned short msr;
+#ifdef LAZY_PSW
+    /* Record the operation, the flags are computed when read */
+    m->lazy_psw.logic = 1;
+    m->lazy_psw.logic_res = result;
+    m->lazy_psw.logic_wb = word_byte;
+#else
+    unsigned short msr; /* Most significant result bit */
+
     if (word_byte == 0)msr = B15(result);
     else {
         msr = B7(result);
         result &= 0x00FF;	/* Mask high byte for 'z' check */
     }
     /* Zero */
-    pswptr->z = (result == 0);
+    m->psw.z = (result == 0);
     /* Negative */
-    pswptr->n = (msr == 1);
+    m->psw.n = (msr == 1);
+#endif // LAZY_PSW
+
+}
+
+/**
+ * Purpose: Returns the most significant bit of a pending operand, bit 15 for words and bit 7 for bytes.
+ *
+ * @param value: Operand or result.
+ * @param wb: Indicator for the size of the data operation.
+ */
+static unsigned short MostSignificant(unsigned short value, unsigned short wb)
+{
+    return (wb == 0) ? B15(value) : B7(value);
+}
 
-}
\ No newline at end of file
+/**
+ * Purpose: Computes the Carry (C) flag, from the pending update_psw() if there is one.
+ */
+unsigned short PswCarry(Machine* m)
+{
+    if (!m->lazy_psw.arith) return m->psw.c;
+    return carry[MostSignificant(m->lazy_psw.src, m->lazy_psw.wb)][MostSignificant(m->lazy_psw.dst, m->lazy_psw.wb)]
+        [MostSignificant(m->lazy_psw.res, m->lazy_psw.wb)];
+}
+
+/**
+ * Purpose: Computes the oVerflow (V) flag, from the pending update_psw() if there is one.
+ */
+unsigned short PswOverflow(Machine* m)
+{
+    if (!m->lazy_psw.arith) return m->psw.v;
+    return overflow[MostSignificant(m->lazy_psw.src, m->lazy_psw.wb)][MostSignificant(m->lazy_psw.dst, m->lazy_psw.wb)]
+        [MostSignificant(m->lazy_psw.res, m->lazy_psw.wb)];
+}
+
+/**
+ * Purpose: Computes the Zero (Z) flag from the newest pending update.
+ */
+unsigned short PswZero(Machine* m)
+{
+    if (m->lazy_psw.logic) return ((m->lazy_psw.logic_wb == 0) ? m->lazy_psw.logic_res : (m->lazy_psw.logic_res & 0x00FF)) == 0;
+    if (m->lazy_psw.arith) return ((m->lazy_psw.wb == 0) ? m->lazy_psw.res : (m->lazy_psw.res & 0x00FF)) == 0;
+    return m->psw.z;
+}
+
+/**
+ * Purpose: Computes the Negative (N) flag from the newest pending update.
+ */
+unsigned short PswNegative(Machine* m)
+{
+    if (m->lazy_psw.logic) return MostSignificant(m->lazy_psw.logic_res, m->lazy_psw.logic_wb);
+    if (m->lazy_psw.arith) return MostSignificant(m->lazy_psw.res, m->lazy_psw.wb);
+    return m->psw.n;
+}
+
+/**
+ * Purpose: Writes any pending flags into the PSW. Must be called before the psw struct is read
+ *          or written directly (debugger, DADD, RRC, JIT).
+ */
+void SyncPsw(Machine* m)
+{
+    if (!m->lazy_psw.arith && !m->lazy_psw.logic) return;
+
+    m->psw.c = PswCarry(m);
+    m->psw.v = PswOverflow(m);
+    m->psw.z = PswZero(m);
+    m->psw.n = PswNegative(m);
+    m->lazy_psw.arith = 0;
+    m->lazy_psw.logic = 0;
+}